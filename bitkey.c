@@ -12,50 +12,30 @@
 #include "utils/numeric.h"
 #include "utils/builtins.h"
 #include "bitkey.h"
+#include "zkey.h"
 
 #define WITH_HACKED_NUMERIC
 #ifdef WITH_HACKED_NUMERIC
 #include "ex_numeric.h"
 #endif
 
-/* 2D -------------------------------------------------------------------------------------------------------- */
+/* the bit arithmetic is in zkey.c, here is numeric glue only */
+#define ZKEY_VALS(pk) ((uint64_t *)(pk)->vals_)
 
-static uint32 stoBits[8] = {
-	0x0001, 0x0002, 0x0004, 0x0008, 
-	0x0010, 0x0020, 0x0040, 0x0080};
+/* 2D -------------------------------------------------------------------------------------------------------- */
 
 static int 
 bit2Key_cmp (const bitKey_t *pl, const bitKey_t *pr)
 {
 	Assert(pl && pr);
-	return (pl->vals_[0] == pr->vals_[0])? 0 :
-			((pl->vals_[0] > pr->vals_[0]) ? 1 : -1);
+	return zkey_cmp2(ZKEY_VALS(pl), ZKEY_VALS(pr));
 }
 
 static bool  
 bit2Key_between (const bitKey_t *ckey, const bitKey_t *lKey, const bitKey_t *hKey)
 {
-	/* bit over bit */
-  	uint64 bitMask = 0xAAAAAAAAAAAAAAAAULL;
-	int i;
 	Assert(ckey && lKey && hKey);
-
-	/* by X & Y */
-	for(i = 0; i < 2; i++, bitMask >>= 1)
-	{
-		/* current coordinate */
-		uint64 tmpK = ckey->vals_[0] & bitMask;
-		/* diapason High and Low coordinates */
-		uint64 tmpL = lKey->vals_[0] & bitMask;
-		uint64 tmpH = hKey->vals_[0] & bitMask;
-
-		if (tmpK < tmpL)
-			return 0;
-		if (tmpK > tmpH)
-			return 0;
-	}
-	/* OK, return true */
-	return 1;
+	return zkey_between2(ZKEY_VALS(ckey), ZKEY_VALS(lKey), ZKEY_VALS(hKey));
 }
 
 static int 
@@ -75,72 +55,29 @@ bit2Key_clearKey (bitKey_t *pk)
 static void 
 bit2Key_fromCoords (bitKey_t *pk, const uint32 *coords, int n)
 {
-	int curmask = 0xf, i;
-	unsigned char *ptr = NULL;
-	uint32 ix = coords[0];
-	uint32 iy = coords[1];
 	Assert(NULL != pk && NULL != coords && n >= 2);
-
-	pk->vals_[0] = 0;
-	ptr = (unsigned char *)&pk->vals_[0];
-	for (i = 0; i < 8; i++)
-	{
-		int xp = (ix & curmask) >> (i<<2);
-		int yp = (iy & curmask) >> (i<<2);
-		int tmp = (xp & stoBits[0]) | ((yp & stoBits[0])<<1) |
-			((xp & stoBits[1])<<1) | ((yp & stoBits[1])<<2) |
-			((xp & stoBits[2])<<2) | ((yp & stoBits[2])<<3) |
-			((xp & stoBits[3])<<3) | ((yp & stoBits[3])<<4);
-		curmask <<= 4;
-		ptr[i] = (unsigned char)tmp;
-	}
+	zkey_encode2(coords, ZKEY_VALS(pk));
 }
 
 static void 
 bit2Key_toCoords (const bitKey_t *pk, uint32 *coords, int n)
 {
- 	unsigned char *ptr = NULL;
-	uint32 ix = 0;
-	uint32 iy = 0;
-	int i;
 	Assert(NULL != pk && NULL != coords && n >= 2);
- 	ptr = (unsigned char *)&pk->vals_[0];
-	for (i = 0; i < 8; i++)
-	{
-		int tmp = ptr[i];
-		int tmpx = (tmp & stoBits[0]) + 
-			((tmp & stoBits[2])>>1) + 
-			((tmp & stoBits[4])>>2) + 
-			((tmp & stoBits[6])>>3);
-		int tmpy = ((tmp & stoBits[1])>>1) + 
-			((tmp & stoBits[3])>>2) + 
-			((tmp & stoBits[5])>>3) + 
-			((tmp & stoBits[7])>>4);
-		ix |= tmpx << (i << 2);
-		iy |= tmpy << (i << 2);
-	}
-	coords[0] = ix;
-	coords[1] = iy;
+	zkey_decode2(ZKEY_VALS(pk), coords);
 }
 
 static void 
 bit2Key_setLowBits(bitKey_t *pk, int idx)
 {
-	uint64 bitMask = 0xAAAAAAAAAAAAAAAAULL >> (63 - idx);
-	uint64 bit = ((uint64) 1) << ((uint64) (idx & 0x3f));
 	Assert(NULL != pk);
-	pk->vals_[0] |= bitMask;
-	pk->vals_[0] -= bit;
+	zkey_setLowBits2(ZKEY_VALS(pk), idx);
 }
 
 static void 
 bit2Key_clearLowBits(bitKey_t *pk, int idx)
 {
-	uint64 bitMask = 0xAAAAAAAAAAAAAAAAULL >> (63 - idx);
-	uint64 bit = ((uint64) 1) << ((uint64) (idx & 0x3f));
 	Assert(NULL != pk);
-	pk->vals_[0] &= ~bitMask;
-	pk->vals_[0] |= bit;
+	zkey_clearLowBits2(ZKEY_VALS(pk), idx);
 }
 
 static void 
@@ -199,47 +136,14 @@ static int
 bit3Key_cmp(const bitKey_t *pl, const bitKey_t *pr)
 {
 	Assert(pl && pr);
-	if ((pl->vals_[0] != pr->vals_[0]))
-		return ((pl->vals_[0] > pr->vals_[0]) ? 1 : -1);
-	if ((pl->vals_[1] != pr->vals_[1]))
-		return ((pl->vals_[1] > pr->vals_[1]) ? 1 : -1);
-	return 0;
+	return zkey_cmp3(ZKEY_VALS(pl), ZKEY_VALS(pr));
 }
 
 static bool
 bit3Key_between(const bitKey_t *ckey, const bitKey_t *lKey, const bitKey_t *hKey)
 {
-	/* bit over bit */
-	uint64 bitMask = 0x0000924924924924ULL;
-	int i;
 	Assert(ckey && lKey && hKey);
-
-	/* by X & Y & Z*/
-	for (i = 0; i < 3; i++, bitMask >>= 1)
-	{
-		/* current coordinate */
-		uint64 tmpK = ckey->vals_[0] & bitMask;
-		/* diapason High and Low coordinates */
-		uint64 tmpL = lKey->vals_[0] & bitMask;
-		uint64 tmpH = hKey->vals_[0] & bitMask;
-
-		if (tmpK < tmpL)
-			return 0;
-		if (tmpK > tmpH)
-			return 0;
-
-		tmpK = ((ckey->vals_[0] >> 48) | (ckey->vals_[1] << 16)) & bitMask;
-		/* diapason High and Low coordinates */
-		tmpL = ((lKey->vals_[0] >> 48) | (lKey->vals_[1] << 16)) & bitMask;
-		tmpH = ((hKey->vals_[0] >> 48) | (hKey->vals_[1] << 16)) & bitMask;
-
-		if (tmpK < tmpL)
-			return 0;
-		if (tmpK > tmpH)
-			return 0;
-	}
-	/* OK, return true */
-	return 1;
+	return zkey_between3(ZKEY_VALS(ckey), ZKEY_VALS(lKey), ZKEY_VALS(hKey));
 }
 
 static int
@@ -259,46 +163,18 @@ bit3Key_clearKey(bitKey_t *pk)
 	pk->vals_[1] = 0;
 }
 
-static const uint64 smasks[3] = {
-	0x9249249249249249ULL,
-	0x2492492492492492ULL,
-	0x4924924924924924ULL,
-};
-
 static void
 bit3Key_setLowBits(bitKey_t *pk, int idx)
 {
 	Assert(NULL != pk && idx < 96 && idx >= 0);
-	if (idx >= 64)
-	{
-		unsigned lidx = (idx - 64) & 0x3ff;
-		pk->vals_[1] |= (smasks[0] >> (63 - lidx));
-		pk->vals_[1] -= (1ULL << lidx);
-		pk->vals_[0] |= smasks[idx % 3];
-	}
-	else
-	{
-		pk->vals_[0] |= (smasks[0] >> (63 - idx));
-		pk->vals_[0] -= (1ULL << idx);
-	}
+	zkey_setLowBits3(ZKEY_VALS(pk), idx);
 }
 
 static void
 bit3Key_clearLowBits(bitKey_t *pk, int idx)
 {
 	Assert(NULL != pk && idx < 96 && idx >= 0);
-	if (idx >= 64)
-	{
-		unsigned lidx = (idx - 64) & 0x3ff;
-		pk->vals_[1] &= ~(smasks[0] >> (63 - lidx));
-		pk->vals_[1] |= (1ULL << lidx);
-		pk->vals_[0] &= ~smasks[idx % 3];
-	}
-	else
-	{
-		pk->vals_[0] &= ~(smasks[0] >> (63 - idx));
-		pk->vals_[0] |= (1ULL << idx);
-	}
+	zkey_clearLowBits3(ZKEY_VALS(pk), idx);
 }
 
 #ifdef WITH_HACKED_NUMERIC
@@ -382,85 +258,25 @@ bit3Key_toLong(const bitKey_t *pk)
 }
 
 
-
-static uint32 key3ToBits[16] = {
-	0, 1, 1 << 3, 1 | (1 << 3),
-	(1 << 6), (1 << 6) | 1, (1 << 6) | (1 << 3), 1 | (1 << 3) | (1 << 6),
-	(1 << 9), (1 << 9) | 1, (1 << 9) | (1 << 3), 1 | (1 << 3) | (1 << 9),
-	(1 << 6) | (1 << 9), (1 << 6) | (1 << 9) | 1, (1 << 9) | (1 << 6) | (1 << 3), 1 | (1 << 3) | (1 << 6) | (1 << 9),
-};
-
 static void
 bit3Key_fromCoords(bitKey_t *pk, const uint32 *coords, int n)
 {
-	uint32 x = coords[0];
-	uint32 y = coords[1];
-	uint32 z = coords[2];
-	int ix0, ix1, i;
-
 	Assert(pk && coords && n >= 3);
-	pk->vals_[0] = pk->vals_[1] = 0;
-	for (i = 0; i < 8; i++)
-	{
-		uint64 tmp =
-			(key3ToBits[x & 0xf] << 2) |
-			(key3ToBits[y & 0xf] << 1) |
-			(key3ToBits[z & 0xf]);
-		ix0 = (i * 12);
-		pk->vals_[0] |= tmp << ix0;
-		ix1 = ix0 + 12;
-		pk->vals_[1] |= (ix1 >> 6) * (ix0 >= 64 ?
-			(tmp << (ix0 - 64)) :
-			(tmp >> (64 - ix0)));
-		x >>= 4; y >>= 4; z >>= 4;
-	}
+	zkey_encode3(coords, ZKEY_VALS(pk));
 }
 
 static void
 bit3Key_toCoords(const bitKey_t *pk, uint32 *coords, int n)
 {
-	int i;
-	uint64 vals[2] = { pk->vals_[0], pk->vals_[1] };
-	uint32 x = 0, y = 0, z = 0;
-
 	Assert(pk && coords && n >= 3);
-	/* 8 X 4 */
-	for (i = 0; i < 8; i++)
-	{
-		uint32 tmp = vals[0] & 0xfff;
-		uint32 tmpz = (tmp & 1) +
-			((tmp & (1 << 3)) >> 2) +
-			((tmp & (1 << 6)) >> 4) +
-			((tmp & (1 << 9)) >> 6);
-
-		uint32 tmpy = ((tmp & (1 << 1)) >> 1) +
-			((tmp & (1 << 4)) >> 3) +
-			((tmp & (1 << 7)) >> 5) +
-			((tmp & (1 << 10)) >> 7);
-
-		uint32 tmpx = ((tmp & (1 << 2)) >> 2) +
-			((tmp & (1 << 5)) >> 4) +
-			((tmp & (1 << 8)) >> 6) +
-			((tmp & (1 << 11)) >> 8);
-
-		x |= tmpx << (i << 2);
-		y |= tmpy << (i << 2);
-		z |= tmpz << (i << 2);
-
-		vals[0] >>= 12;
-		vals[0] |= (0xfff & vals[1]) << (64 - 12);
-		vals[1] >>= 12;
-	}
-	coords[0] = x;
-	coords[1] = y;
-	coords[2] = z;
+	zkey_decode3(ZKEY_VALS(pk), coords);
 }
 
 static void  
 bit3Key_toStr(const bitKey_t *pk, char *buf, int buflen)
 {
 	uint32 coords[3];
-	bit2Key_toCoords (pk, coords, 3);
+	bit3Key_toCoords (pk, coords, 3);
 	Assert(pk && buf && buflen > 128);
 	sprintf(buf, "[%x %x %x]: %d %d %d", 
 		(int)(pk->vals_[1] & 0xffffffff),
@@ -579,3 +395,24 @@ void  bitKey_toStr(const bitKey_t *pk, char *buf, int buflen)
 	pk->vtab_->f_toStr(pk, buf, buflen);
 }
 
+
+/* 
+   h - l as a floating point value, h >= l is supposed,
+   the keys are subtracted word by word, so no precision is lost on close keys 
+ */
+double bitKey_distance(const bitKey_t *l, const bitKey_t *h)
+{
+	double ret = 0., mul = 1.;
+	int borrow = 0, i;
+	Assert(l && h);
+	for (i = 0; i < ZKEY_BUFLEN_BY_WORDS64; i++)
+	{
+		uint64 lv = l->vals_[i];
+		uint64 hv = h->vals_[i];
+		uint64 d = hv - lv - borrow;
+		borrow = (hv < lv || (hv == lv && borrow)) ? 1 : 0;
+		ret += (double)d * mul;
+		mul *= 18446744073709551616.0;
+	}
+	return ret;
+}
@@ -28,7 +28,8 @@
 
 	/* key stuff ------------------------------------------------------------------------------- */
 #define ZKEY_BUFLEN_BY_WORDS64 3
-#define ZKEY_MAX_COORDS 6
+#define ZKEY_MAX_COORDS 6	/* coordinate buffers size */
+#define ZKEY_MAX_DIMS 3		/* dimensions bitKey_CTOR implements, 2..ZKEY_MAX_DIMS */
 	typedef struct bitKey_s {
 		zkey_vtab_t 	*vtab_;
 		uint64 		vals_[ZKEY_BUFLEN_BY_WORDS64];
@@ -47,6 +48,7 @@
 	extern void  bitKey_fromCoords(bitKey_t *pk, const uint32 *coords, int n);
 	extern void  bitKey_toCoords(const bitKey_t *pk, uint32 *coords, int n);
 	extern void  bitKey_toStr(const bitKey_t *pk, char *buf, int buflen);
+	extern double bitKey_distance(const bitKey_t *l, const bitKey_t *h);
 
 
 #endif /* __ZCURVE_BITKEY_H */
\ No newline at end of file
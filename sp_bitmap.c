@@ -0,0 +1,61 @@
+/*
+ * contrib/zcurve/sp_bitmap.c
+ *
+ *
+ * sp_bitmap.c -- lookup results as TIDBitmap, heap pages order
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#include "postgres.h"
+
+#include "miscadmin.h"
+#include "nodes/tidbitmap.h"
+
+#include "sp_query.h"
+#include "sp_bitmap.h"
+
+/* t_tids are added to bitmap by batches */
+#define BITMAP_BATCH 256
+
+/* PUBLIC, creates an empty bitmap */
+TIDBitmap *
+zcurve_bitmap_create(void)
+{
+#if PG_VERSION_NUM >= 100000
+	return tbm_create(work_mem * 1024L, NULL);
+#else
+	return tbm_create(work_mem * 1024L);
+#endif
+}
+
+/* PUBLIC, lookup to bitmap */
+double
+zcurve_lookup_bitmap(spt_query2_t *q, TIDBitmap *tbm)
+{
+	ItemPointerData tids[BITMAP_BATCH];
+	uint32		coords[ZKEY_MAX_COORDS];
+	double		cnt = 0;
+	int		ntids = 0;
+	int		ret;
+
+	Assert(q && tbm);
+
+	/* only t_tids are required */
+	q->wantCoords_ = false;
+
+	ret = spt_query2_moveFirst(q, coords, &tids[ntids]);
+	while (ret)
+	{
+		cnt += 1;
+		if (++ntids == BITMAP_BATCH)
+		{
+			tbm_add_tuples(tbm, tids, ntids, false);
+			ntids = 0;
+		}
+		ret = spt_query2_moveNext(q, coords, &tids[ntids]);
+	}
+	if (ntids)
+		tbm_add_tuples(tbm, tids, ntids, false);
+	return cnt;
+}
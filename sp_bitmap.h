@@ -0,0 +1,25 @@
+/*
+ * contrib/zcurve/sp_bitmap.h
+ *
+ *
+ * sp_bitmap.h -- lookup results as TIDBitmap, heap pages order
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#ifndef __ZCURVE_SP_BITMAP_H
+#define __ZCURVE_SP_BITMAP_H
+
+#include "nodes/tidbitmap.h"
+#include "sp_query.h"
+
+/* creates an empty bitmap, pages become lossy when it exceeds work_mem */
+extern TIDBitmap *zcurve_bitmap_create(void);
+
+/* 
+   runs lookup and adds all the found t_tids to bitmap, 
+   returns the number of index items found
+*/
+extern double zcurve_lookup_bitmap(spt_query2_t *q, TIDBitmap *tbm);
+
+#endif /* __ZCURVE_SP_BITMAP_H */
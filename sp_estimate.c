@@ -0,0 +1,420 @@
+/*
+ * contrib/zcurve/sp_estimate.c
+ *
+ *
+ * sp_estimate.c -- approximate lookup cardinality by the upper levels of index tree
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#include "postgres.h"
+
+#include <string.h>
+#include "utils/rel.h"
+#include "access/nbtree.h"
+#include "storage/bufmgr.h"
+#include "storage/bufpage.h"
+
+#include "sp_tree.h"
+#include "sp_query.h"
+#include "sp_estimate.h"
+#include "bitkey.h"
+
+/* extent splitting limits for a single key diapason */
+#define EST_STACK_SIZE 256
+#define EST_MAX_SPLITS 4096
+
+/* index subtree waiting for estimation */
+typedef struct est_node_s {
+	BlockNumber	blkno_;		/* subtree root page */
+	bitKey_t	lowKey_;	/* subtree keys are >= lowKey_ */
+	bitKey_t	highKey_;	/* and < highKey_ */
+	bool		hasLow_;	/* false for the leftmost subtree, there is no low bound */
+	bool		hasHigh_;	/* false for the rightmost subtree, there is no high bound */
+	double		tuples_;	/* estimated number of leaf items in the subtree */
+	double		share_;		/* estimated part of them in lookup extent */
+	struct est_node_s *next_;	/* queue link */
+} est_node_t;
+
+/* estimation context */
+typedef struct est_ctx_s {
+	Relation	rel_;		/* index tree */
+	spatial2Query_t	extent_;	/* lookup extent as the top level subquery */
+	bitKey_t	key_;		/* temporary key */
+	est_node_t	*head_;		/* subtrees queue, level by level */
+	est_node_t	*tail_;
+	zcurve_estimate_t *res_;	/* the result */
+} est_ctx_t;
+
+
+/* 
+   the number of extent points with keys in [lo, hi) diapason, NULL bound means infinity.
+   The extent is split the same way as lookup does, solid subqueries are contiguous on z-curve.
+   When splitting limit is exhausted the rest is interpolated linearly 
+ */
+static double
+est_countRange(const spatial2Query_t *extent, const bitKey_t *lo, const bitKey_t *hi)
+{
+	spatial2Query_t stack[EST_STACK_SIZE];
+	int sp = 0, nsplits = 0;
+	double ret = 0.;
+
+	stack[sp++] = *extent;
+	while (sp > 0)
+	{
+		spatial2Query_t *sq = &stack[--sp];
+		const bitKey_t *l = NULL;
+		double part = 0.;
+
+		/* out of diapason */
+		if (lo && bitKey_cmp(&sq->highKey_, lo) < 0)
+			continue;
+		if (hi && bitKey_cmp(&sq->lowKey_, hi) >= 0)
+			continue;
+
+		/* fully inside */
+		if ((!lo || bitKey_cmp(&sq->lowKey_, lo) >= 0) &&
+		    (!hi || bitKey_cmp(&sq->highKey_, hi) < 0))
+		{
+			ret += spt_query2_volume(sq);
+			continue;
+		}
+
+		/* the length of keys diapason intersection */
+		l = (lo && bitKey_cmp(lo, &sq->lowKey_) > 0) ? lo : &sq->lowKey_;
+		if (hi && bitKey_cmp(hi, &sq->highKey_) <= 0)
+			part = bitKey_distance(l, hi);
+		else
+			part = bitKey_distance(l, &sq->highKey_) + 1.;
+
+		/* solid subquery has no holes, every key in it belongs to extent */
+		if (spt_query2_isSolid(sq))
+		{
+			ret += part;
+			continue;
+		}
+
+		if (nsplits >= EST_MAX_SPLITS || sp + 2 > EST_STACK_SIZE)
+		{
+			/* no more splitting, extent points are supposed to be spread uniformly */
+			ret += spt_query2_volume(sq) * part / 
+				(bitKey_distance(&sq->lowKey_, &sq->highKey_) + 1.);
+			continue;
+		}
+
+		/* split it, the upper half stays in place, the lower one goes on the top */
+		spt_query2_cutQuery(sq, &stack[sp + 1]);
+		sp += 2;
+		nsplits++;
+	}
+	return ret;
+}
+
+/* reads key value from the page item */
+static void
+est_itemKey(est_ctx_t *ctx, Page page, OffsetNumber off, bitKey_t *key)
+{
+	IndexTuple	itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, off));
+	bool		null;
+	Datum		arg = index_getattr(itup, 1, RelationGetDescr(ctx->rel_), &null);
+
+	bitKey_fromLong(key, arg);
+}
+
+/* subtree was not read, its contribution is interpolated */
+static void
+est_interpolate(est_ctx_t *ctx, const est_node_t *node)
+{
+	ctx->res_->rows_ += node->tuples_ * node->share_;
+	ctx->res_->margin_ += node->tuples_ * Min(node->share_, 1. - node->share_);
+}
+
+/* 
+   tests the subtree against lookup extent, 
+   fully covered subtree is accounted immediately, boundary one is queued for refinement
+ */
+static void
+est_testChild(est_ctx_t *ctx, BlockNumber blkno, 
+	const bitKey_t *lowKey, bool hasLow, 
+	const bitKey_t *highKey, bool hasHigh, 
+	double tuples)
+{
+	const bitKey_t *lo = hasLow ? lowKey : NULL;
+	const bitKey_t *hi = hasHigh ? highKey : NULL;
+	double share = 0.;
+	est_node_t *node = NULL;
+
+	if (lo && hi && bitKey_cmp(lo, hi) >= 0)
+	{
+		/* all the subtree keys are equal (duplicates) */
+		share = bitKey_between(lo, &ctx->extent_.lowKey_, &ctx->extent_.highKey_) ? 1. : 0.;
+	}
+	else
+	{
+		double count = est_countRange(&ctx->extent_, lo, hi);
+		double width = 0.;
+
+		if (count <= 0.)
+			return;
+
+		/* infinite bounds are cut by the extent, data are supposed to reach them */
+		if (!lo)
+			lo = &ctx->extent_.lowKey_;
+
+		width = hi ? bitKey_distance(lo, hi) :
+			bitKey_distance(lo, &ctx->extent_.highKey_) + 1.;
+		share = (width > count) ? count / width : 1.;
+	}
+
+	if (share <= 0.)
+		return;
+
+	if (share >= 1.)
+	{
+		ctx->res_->rows_ += tuples;
+		return;
+	}
+
+	/* boundary subtree, let's queue it */
+	node = (est_node_t *)palloc(sizeof(est_node_t));
+	node->blkno_ = blkno;
+	node->lowKey_ = *lowKey;
+	node->highKey_ = *highKey;
+	node->hasLow_ = hasLow;
+	node->hasHigh_ = hasHigh;
+	node->tuples_ = tuples;
+	node->share_ = share;
+	node->next_ = NULL;
+	if (ctx->tail_)
+		ctx->tail_->next_ = node;
+	else
+		ctx->head_ = node;
+	ctx->tail_ = node;
+}
+
+/* 
+   leaf page items are counted exactly, 
+   internal page subtrees are tested by their keys diapasons 
+ */
+static void
+est_processPage(est_ctx_t *ctx, Buffer buf, const est_node_t *node)
+{
+	Page		page = BufferGetPage(buf);
+	BTPageOpaque	opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+	OffsetNumber	low = P_FIRSTDATAKEY(opaque);
+	OffsetNumber	maxoff = PageGetMaxOffsetNumber(page);
+	OffsetNumber	off;
+	bitKey_t	lowKey, highKey;
+	bool		hasLow, hasHigh;
+	double		tuples;
+
+	ctx->res_->pages_++;
+
+	/* deleted or half-dead page, no way to refine */
+	if (P_IGNORE(opaque))
+	{
+		est_interpolate(ctx, node);
+		return;
+	}
+
+	if (P_ISLEAF(opaque))
+	{
+		for (off = low; off <= maxoff; off++)
+		{
+			est_itemKey(ctx, page, off, &ctx->key_);
+			if (bitKey_between(&ctx->key_, &ctx->extent_.lowKey_, &ctx->extent_.highKey_))
+				ctx->res_->rows_ += 1.;
+		}
+		return;
+	}
+
+	/* internal page is never empty, but who knows */
+	if (maxoff < low)
+		return;
+
+	/* internal page, subtree items are supposed to be spread over downlinks evenly */
+	tuples = node->tuples_ / (maxoff - low + 1);
+	lowKey = node->lowKey_;
+	hasLow = node->hasLow_;
+	bitKey_CTOR(&highKey, ctx->extent_.ncoords_);
+	for (off = low; off <= maxoff; off = OffsetNumberNext(off))
+	{
+		IndexTuple itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, off));
+		BlockNumber blkno = ItemPointerGetBlockNumber(&(itup->t_tid));
+
+		/* the subtree ends where the next one begins */
+		if (off < maxoff)
+		{
+			est_itemKey(ctx, page, OffsetNumberNext(off), &highKey);
+			hasHigh = true;
+		}
+		else if (!P_RIGHTMOST(opaque))
+		{
+			est_itemKey(ctx, page, P_HIKEY, &highKey);
+			hasHigh = true;
+		}
+		else
+		{
+			highKey = node->highKey_;
+			hasHigh = node->hasHigh_;
+		}
+
+		est_testChild(ctx, blkno, &lowKey, hasLow, &highKey, hasHigh, tuples);
+
+		lowKey = highKey;
+		hasLow = true;
+	}
+}
+
+/* 
+   index has never been analyzed, 
+   let's count items on the leftmost leaf and suppose the other pages are alike 
+ */
+static double
+est_guessTuples(est_ctx_t *ctx)
+{
+	Buffer		buf = _bt_getroot(ctx->rel_, BT_READ);
+	Page		page;
+	BTPageOpaque	opaque;
+	IndexTuple	itup;
+	int		items;
+
+	if (!BufferIsValid(buf))
+		return 0.;
+
+	for (;;)
+	{
+		ctx->res_->pages_++;
+		page = BufferGetPage(buf);
+		opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+		if (P_ISLEAF(opaque))
+			break;
+
+		itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, P_FIRSTDATAKEY(opaque)));
+		buf = _bt_relandgetbuf(ctx->rel_, buf, ItemPointerGetBlockNumber(&(itup->t_tid)), BT_READ);
+	}
+	items = (int)PageGetMaxOffsetNumber(page) - (int)P_FIRSTDATAKEY(opaque) + 1;
+	_bt_relbuf(ctx->rel_, buf);
+
+	return (double)Max(items, 0) * (double)(RelationGetNumberOfBlocks(ctx->rel_) - 1);
+}
+
+/* PUBLIC, estimates the number of index items in lookup extent */
+void
+zcurve_estimate_extent(Relation rel, const uint32 *min_coords, const uint32 *max_coords, int ncoords, int max_pages, zcurve_estimate_t *pres)
+{
+	est_ctx_t	ctx;
+	est_node_t	root;
+	est_node_t	*node = NULL;
+	Buffer		buf;
+
+	Assert(rel && min_coords && max_coords && pres);
+	memset(pres, 0, sizeof(*pres));
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.rel_ = rel;
+	ctx.res_ = pres;
+
+	/* the whole lookup extent as the top level subquery */
+	ctx.extent_.ncoords_ = ncoords;
+	ctx.extent_.curBitNum_ = ((32 * ncoords) - 1);
+	bitKey_CTOR(&ctx.extent_.lowKey_, ncoords);
+	bitKey_CTOR(&ctx.extent_.highKey_, ncoords);
+	bitKey_CTOR(&ctx.key_, ncoords);
+	bitKey_fromCoords(&ctx.extent_.lowKey_, min_coords, ncoords);
+	bitKey_fromCoords(&ctx.extent_.highKey_, max_coords, ncoords);
+
+	/* the root subtree holds everything */
+	memset(&root, 0, sizeof(root));
+	root.lowKey_ = ctx.extent_.lowKey_;
+	root.highKey_ = ctx.extent_.highKey_;
+	root.hasLow_ = false;
+	root.hasHigh_ = false;
+	root.share_ = 1.;
+	root.tuples_ = rel->rd_rel->reltuples;
+	if (root.tuples_ <= 0.)
+		root.tuples_ = est_guessTuples(&ctx);
+
+	buf = _bt_getroot(rel, BT_READ);
+	/* empty index */
+	if (!BufferIsValid(buf))
+		return;
+
+	root.blkno_ = BufferGetBlockNumber(buf);
+	est_processPage(&ctx, buf, &root);
+	_bt_relbuf(rel, buf);
+
+	/* boundary subtrees are refined level by level while the pages limit allows */
+	while (NULL != (node = ctx.head_))
+	{
+		ctx.head_ = node->next_;
+		if (NULL == ctx.head_)
+			ctx.tail_ = NULL;
+
+		if (pres->pages_ >= max_pages)
+		{
+			est_interpolate(&ctx, node);
+		}
+		else
+		{
+			buf = _bt_getbuf(rel, node->blkno_, BT_READ);
+			est_processPage(&ctx, buf, node);
+			_bt_relbuf(rel, buf);
+		}
+		pfree(node);
+	}
+}
+
+/* PUBLIC, coordinates of the greatest key, the rightmost path of the tree is read */
+bool
+zcurve_estimate_domain(Relation rel, int ncoords, uint32 *max_coords)
+{
+	Buffer		buf;
+	Page		page;
+	BTPageOpaque	opaque;
+	OffsetNumber	maxoff;
+	IndexTuple	itup;
+	Datum		arg;
+	bool		null;
+	bitKey_t	key;
+
+	Assert(rel && max_coords);
+
+	buf = _bt_getroot(rel, BT_READ);
+	/* empty index */
+	if (!BufferIsValid(buf))
+		return false;
+
+	for (;;)
+	{
+		BlockNumber blkno;
+
+		page = BufferGetPage(buf);
+		opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+		maxoff = PageGetMaxOffsetNumber(page);
+
+		/* concurrent split, the rightmost page is further */
+		if (!P_RIGHTMOST(opaque))
+			blkno = opaque->btpo_next;
+		else if (maxoff < P_FIRSTDATAKEY(opaque))
+		{
+			/* all the items were deleted */
+			_bt_relbuf(rel, buf);
+			return false;
+		}
+		else if (P_ISLEAF(opaque))
+			break;
+		else
+			blkno = ItemPointerGetBlockNumber(&((IndexTuple) PageGetItem(page, PageGetItemId(page, maxoff)))->t_tid);
+
+		_bt_relbuf(rel, buf);
+		buf = _bt_getbuf(rel, blkno, BT_READ);
+	}
+
+	itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, maxoff));
+	arg = index_getattr(itup, 1, RelationGetDescr(rel), &null);
+	bitKey_CTOR(&key, ncoords);
+	bitKey_fromLong(&key, arg);
+	bitKey_toCoords(&key, max_coords, ZKEY_MAX_COORDS);
+	_bt_relbuf(rel, buf);
+	return true;
+}
@@ -0,0 +1,43 @@
+/*
+ * contrib/zcurve/sp_estimate.h
+ *
+ *
+ * sp_estimate.h -- approximate lookup cardinality by the upper levels of index tree
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#ifndef __ZCURVE_SP_ESTIMATE_H
+#define __ZCURVE_SP_ESTIMATE_H
+
+#include "bitkey.h"
+#include "sp_query.h"
+
+/* default index pages limit for one estimation */
+#define ZCURVE_ESTIMATE_PAGES 64
+
+/* the same at planning time, planner must be fast */
+#define ZCURVE_PLANNER_ESTIMATE_PAGES 16
+
+/* estimation result */
+typedef struct zcurve_estimate_s {
+	double	rows_;		/* estimated number of index items in lookup extent */
+	double	margin_;	/* error margin, comes from boundary subtrees those were interpolated instead of reading, 0 if none */
+	int	pages_;		/* the number of index pages read */
+} zcurve_estimate_t;
+
+/* 
+   estimates the number of index items in lookup extent,
+   reads index tree top-down level by level refining boundary subtrees only, 
+   no more than max_pages pages are read 
+*/
+extern void zcurve_estimate_extent(Relation rel, const uint32 *min_coords, const uint32 *max_coords, int ncoords, int max_pages, zcurve_estimate_t *pres);
+
+/* 
+   coordinates of the greatest index key, ZKEY_MAX_COORDS of them, 
+   every indexed point is inside the cube of the power of 2 side covering them,
+   returns false for an empty index
+*/
+extern bool zcurve_estimate_domain(Relation rel, int ncoords, uint32 *max_coords);
+
+#endif /* __ZCURVE_SP_ESTIMATE_H */
@@ -0,0 +1,248 @@
+/*
+ * contrib/zcurve/sp_fetch.c
+ *
+ *
+ * sp_fetch.c -- table rows fetching by lookup bitmap, heap blocks order
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#include "postgres.h"
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "catalog/index.h"
+#include "executor/executor.h"
+#include "executor/tuptable.h"
+#include "storage/bufmgr.h"
+#include "storage/bufpage.h"
+#include "utils/snapmgr.h"
+
+#include "bitkey.h"
+#include "sp_fetch.h"
+
+/* heap prefetch distance, GUC parameter */
+int zcurve_prefetch_pages = ZCURVE_DEFAULT_PREFETCH_PAGES;
+
+/* lossy pages rows checking by index expression and partial index predicate */
+typedef struct fetch_recheck_s {
+	IndexInfo	*indexInfo_;	/* index expression */
+	EState		*estate_;	/* its evaluation */
+#if PG_VERSION_NUM >= 100000
+	ExprState	*predicate_;	/* partial index predicate, NULL if none */
+#else
+	List		*predicate_;
+#endif
+	TupleTableSlot	*slot_;		/* current row */
+	bitKey_t	key_;		/* current row key */
+	int		ncoords_;	/* dimension */
+	const uint32	*min_coords_;	/* lookup extent */
+	const uint32	*max_coords_;
+} fetch_recheck_t;
+
+static void
+fetch_recheck_CTOR(fetch_recheck_t *rc, Relation heapRel, Relation indexRel, const uint32 *min_coords, const uint32 *max_coords, int ncoords)
+{
+	rc->indexInfo_ = BuildIndexInfo(indexRel);
+	rc->estate_ = CreateExecutorState();
+#if PG_VERSION_NUM >= 120000
+	rc->slot_ = MakeSingleTupleTableSlot(RelationGetDescr(heapRel), &TTSOpsHeapTuple);
+#else
+	rc->slot_ = MakeSingleTupleTableSlot(RelationGetDescr(heapRel));
+#endif
+	GetPerTupleExprContext(rc->estate_)->ecxt_scantuple = rc->slot_;
+	rc->predicate_ = NULL;
+	if (rc->indexInfo_->ii_Predicate)
+#if PG_VERSION_NUM >= 100000
+		rc->predicate_ = ExecPrepareQual(rc->indexInfo_->ii_Predicate, rc->estate_);
+#else
+		rc->predicate_ = (List *) ExecPrepareExpr((Expr *) rc->indexInfo_->ii_Predicate, rc->estate_);
+#endif
+	bitKey_CTOR(&rc->key_, ncoords);
+	rc->ncoords_ = ncoords;
+	rc->min_coords_ = min_coords;
+	rc->max_coords_ = max_coords;
+}
+
+static void
+fetch_recheck_DTOR(fetch_recheck_t *rc)
+{
+	ExecDropSingleTupleTableSlot(rc->slot_);
+	FreeExecutorState(rc->estate_);
+}
+
+/* row is in lookup extent, the partial index would contain it */
+static bool
+fetch_recheck(fetch_recheck_t *rc, HeapTuple tuple)
+{
+	Datum	values[INDEX_MAX_KEYS];
+	bool	isnull[INDEX_MAX_KEYS];
+	uint32	coords[ZKEY_MAX_COORDS];
+	int	i;
+
+	ResetPerTupleExprContext(rc->estate_);
+#if PG_VERSION_NUM >= 120000
+	ExecStoreHeapTuple(tuple, rc->slot_, false);
+#else
+	ExecStoreTuple(tuple, rc->slot_, InvalidBuffer, false);
+#endif
+	if (rc->predicate_)
+	{
+#if PG_VERSION_NUM >= 100000
+		if (!ExecQual(rc->predicate_, GetPerTupleExprContext(rc->estate_)))
+#else
+		if (!ExecQual(rc->predicate_, GetPerTupleExprContext(rc->estate_), false))
+#endif
+			return false;
+	}
+	FormIndexDatum(rc->indexInfo_, rc->slot_, rc->estate_, values, isnull);
+	if (isnull[0])
+		return false;
+
+	bitKey_fromLong(&rc->key_, values[0]);
+	bitKey_toCoords(&rc->key_, coords, ZKEY_MAX_COORDS);
+	for (i = 0; i < rc->ncoords_; i++)
+	{
+		if (coords[i] < rc->min_coords_[i] || coords[i] > rc->max_coords_[i])
+			return false;
+	}
+	return true;
+}
+
+/* 
+   PUBLIC, bitmap to table rows, every visible row in the extent goes to callback.
+   The same way heapam bitmap scan does, visible offsets of the page are collected
+   under the buffer lock, the rows are rechecked and passed to callback with the pin only,
+   pruning needs cleanup lock, so the line pointers stay in place meanwhile
+*/
+double
+zcurve_scan_bitmap(Relation heapRel, Relation indexRel, TIDBitmap *tbm,
+	const uint32 *min_coords, const uint32 *max_coords, int ncoords, zcurve_fetch_cb cb, void *arg)
+{
+	Snapshot	snapshot = GetActiveSnapshot();
+	TBMIterator	*iterator = tbm_begin_iterate(tbm);
+	TBMIterator	*prefetch_iterator = NULL;
+	TBMIterateResult *tbmres;
+	fetch_recheck_t	recheck;
+	bool		recheck_ready = false;
+	OffsetNumber	visible[MaxHeapTuplesPerPage];
+	double		cnt = 0;
+	long		pages = 0, prefetched = 0;
+
+#ifdef USE_PREFETCH
+	if (zcurve_prefetch_pages > 0)
+		prefetch_iterator = tbm_begin_iterate(tbm);
+#endif
+
+	while ((tbmres = tbm_iterate(iterator)) != NULL)
+	{
+		Buffer	buffer;
+		Page	page;
+		int	nvisible = 0, i;
+
+		CHECK_FOR_INTERRUPTS();
+#ifdef USE_PREFETCH
+		/* keep prefetching zcurve.prefetch_pages ahead */
+		while (prefetch_iterator && prefetched <= pages + zcurve_prefetch_pages)
+		{
+			TBMIterateResult *pfres = tbm_iterate(prefetch_iterator);
+			if (NULL == pfres)
+			{
+				tbm_end_iterate(prefetch_iterator);
+				prefetch_iterator = NULL;
+				break;
+			}
+			/* the current page is read right now */
+			if (prefetched++ > pages)
+				PrefetchBuffer(heapRel, MAIN_FORKNUM, pfres->blockno);
+		}
+#endif
+		pages++;
+
+		buffer = ReadBuffer(heapRel, tbmres->blockno);
+		LockBuffer(buffer, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buffer);
+
+		if (tbmres->ntuples >= 0)
+		{
+			/* exact page, HOT chains are followed to the visible version */
+			for (i = 0; i < tbmres->ntuples; i++)
+			{
+				ItemPointerData tid;
+				HeapTupleData	tuple;
+				bool		all_dead;
+
+				ItemPointerSet(&tid, tbmres->blockno, tbmres->offsets[i]);
+				if (heap_hot_search_buffer(&tid, heapRel, buffer, snapshot, &tuple, &all_dead, true))
+					visible[nvisible++] = ItemPointerGetOffsetNumber(&tid);
+			}
+		}
+		else
+		{
+			/* lossy page, every visible row is to be checked by its key */
+			OffsetNumber off, maxoff = PageGetMaxOffsetNumber(page);
+
+			for (off = FirstOffsetNumber; off <= maxoff; off = OffsetNumberNext(off))
+			{
+				ItemId		lp = PageGetItemId(page, off);
+				HeapTupleData	tuple;
+
+				if (!ItemIdIsNormal(lp))
+					continue;
+
+				tuple.t_data = (HeapTupleHeader) PageGetItem(page, lp);
+				tuple.t_len = ItemIdGetLength(lp);
+				tuple.t_tableOid = RelationGetRelid(heapRel);
+				ItemPointerSet(&tuple.t_self, tbmres->blockno, off);
+
+				if (HeapTupleSatisfiesVisibility(&tuple, snapshot, buffer))
+					visible[nvisible++] = off;
+			}
+		}
+		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+
+		/* index expressions & callback run without the content lock */
+		if (tbmres->ntuples < 0 && nvisible > 0 && !recheck_ready)
+		{
+			fetch_recheck_CTOR(&recheck, heapRel, indexRel, min_coords, max_coords, ncoords);
+			recheck_ready = true;
+		}
+		for (i = 0; i < nvisible; i++)
+		{
+			ItemId		lp = PageGetItemId(page, visible[i]);
+			HeapTupleData	tuple;
+
+			tuple.t_data = (HeapTupleHeader) PageGetItem(page, lp);
+			tuple.t_len = ItemIdGetLength(lp);
+			tuple.t_tableOid = RelationGetRelid(heapRel);
+			ItemPointerSet(&tuple.t_self, tbmres->blockno, visible[i]);
+
+			if (tbmres->ntuples < 0 && !fetch_recheck(&recheck, &tuple))
+				continue;
+			cb(&tuple, arg);
+			cnt += 1;
+		}
+		ReleaseBuffer(buffer);
+	}
+
+	if (prefetch_iterator)
+		tbm_end_iterate(prefetch_iterator);
+	tbm_end_iterate(iterator);
+	if (recheck_ready)
+		fetch_recheck_DTOR(&recheck);
+	return cnt;
+}
+
+static void
+fetch_to_tuplestore(HeapTuple tuple, void *arg)
+{
+	tuplestore_puttuple((Tuplestorestate *) arg, tuple);
+}
+
+/* PUBLIC, bitmap to table rows */
+double
+zcurve_fetch_bitmap(Relation heapRel, Relation indexRel, TIDBitmap *tbm,
+	const uint32 *min_coords, const uint32 *max_coords, int ncoords, Tuplestorestate *tupstore)
+{
+	return zcurve_scan_bitmap(heapRel, indexRel, tbm, min_coords, max_coords, ncoords, fetch_to_tuplestore, tupstore);
+}
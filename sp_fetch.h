@@ -0,0 +1,43 @@
+/*
+ * contrib/zcurve/sp_fetch.h
+ *
+ *
+ * sp_fetch.h -- table rows fetching by lookup bitmap, heap blocks order
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#ifndef __ZCURVE_SP_FETCH_H
+#define __ZCURVE_SP_FETCH_H
+
+#include "access/htup.h"
+#include "nodes/tidbitmap.h"
+#include "utils/rel.h"
+#include "utils/tuplestore.h"
+
+/* default number of heap blocks prefetched ahead of reading */
+#define ZCURVE_DEFAULT_PREFETCH_PAGES 16
+
+/* heap prefetch distance, GUC parameter, 0 means no prefetching */
+extern int zcurve_prefetch_pages;
+
+/* visible row handler, the heap buffer is pinned but not locked, the tuple is valid till return */
+typedef void (*zcurve_fetch_cb)(HeapTuple tuple, void *arg);
+
+/* 
+   reads heap blocks in bitmap order and passes visible rows to callback, 
+   rows of lossy pages are rechecked against lookup extent by the index expression 
+   and against the partial index predicate, returns the number of rows
+*/
+extern double zcurve_scan_bitmap(Relation heapRel, Relation indexRel, TIDBitmap *tbm,
+	const uint32 *min_coords, const uint32 *max_coords, int ncoords, zcurve_fetch_cb cb, void *arg);
+
+/* 
+   reads heap blocks in bitmap order and puts visible rows to tuplestore, 
+   rows of lossy pages are rechecked against lookup extent by the index expression,
+   returns the number of rows
+*/
+extern double zcurve_fetch_bitmap(Relation heapRel, Relation indexRel, TIDBitmap *tbm,
+	const uint32 *min_coords, const uint32 *max_coords, int ncoords, Tuplestorestate *tupstore);
+
+#endif /* __ZCURVE_SP_FETCH_H */
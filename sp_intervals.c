@@ -0,0 +1,350 @@
+/*
+ * contrib/zcurve/sp_intervals.c
+ *
+ *
+ * sp_intervals.c -- lookup extent compilation to the sorted list of z-curve intervals
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#include "postgres.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/ilist.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+
+#include "sp_query.h"
+#include "sp_intervals.h"
+#include "bitkey.h"
+
+/* keys diapason length when it is still exact in double */
+#define EXACT_DOUBLE_LIMIT 4503599627370496.0
+
+/* initial capacity of the pieces arrays, they grow twice when exhausted */
+#define CMP_INITIAL_PIECES 64
+
+/* subquery waiting for splitting */
+typedef struct cmp_piece_s {
+	spatial2Query_t	query_;		/* subquery diapason */
+	double		waste_;		/* the number of keys in diapason outside of extent */
+} cmp_piece_t;
+
+/* keys outside of extent, 0 means the subquery is solid */
+static double
+cmp_waste(const spatial2Query_t *sq)
+{
+	double len;
+
+	if (spt_query2_isSolid(sq))
+		return 0.;
+
+	len = bitKey_distance(&sq->lowKey_, &sq->highKey_) + 1.;
+	/* very long diapason is never solid, but the difference can be lost in rounding */
+	if (len >= EXACT_DOUBLE_LIMIT)
+		return Max(len - spt_query2_volume(sq), 1.);
+	return len - spt_query2_volume(sq);
+}
+
+/* binary heap by waste, max on the top */
+static void
+cmp_heapPush(cmp_piece_t *heap, int *pn, const spatial2Query_t *sq, double waste)
+{
+	int i = (*pn)++;
+
+	while (i > 0)
+	{
+		int parent = (i - 1) / 2;
+		if (heap[parent].waste_ >= waste)
+			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i].query_ = *sq;
+	heap[i].waste_ = waste;
+}
+
+static void
+cmp_heapPop(cmp_piece_t *heap, int *pn, spatial2Query_t *sq)
+{
+	cmp_piece_t last;
+	int n, i = 0;
+
+	*sq = heap[0].query_;
+	n = --(*pn);
+	if (0 == n)
+		return;
+
+	last = heap[n];
+	for (;;)
+	{
+		int child = 2 * i + 1;
+		if (child >= n)
+			break;
+		if (child + 1 < n && heap[child + 1].waste_ > heap[child].waste_)
+			child++;
+		if (heap[child].waste_ <= last.waste_)
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+}
+
+/* adds the final subquery to the result */
+static void
+cmp_append(zcurve_intervals_t *res, const spatial2Query_t *sq, bool solid)
+{
+	zcurve_interval_t *it = &res->items_[res->count_++];
+	it->lowKey_ = sq->lowKey_;
+	it->highKey_ = sq->highKey_;
+	it->solid_ = solid;
+}
+
+static int
+cmp_intervals(const void *l, const void *r)
+{
+	return bitKey_cmp(&((const zcurve_interval_t *)l)->lowKey_, 
+			  &((const zcurve_interval_t *)r)->lowKey_);
+}
+
+/* PUBLIC, extent compilation */
+void
+zcurve_intervals_compile(zcurve_intervals_t *res, const uint32 *min_coords, const uint32 *max_coords, int ncoords, int max_intervals)
+{
+	cmp_piece_t	*heap = NULL;
+	int		nheap = 0, npieces = 1, capacity, i, j;
+	spatial2Query_t	sq, lower;
+	double		waste;
+
+	Assert(res && min_coords && max_coords);
+	max_intervals = Max(max_intervals, 1);
+
+	res->ncoords_ = ncoords;
+	res->count_ = 0;
+	bitKey_CTOR(&res->lowKey_, ncoords);
+	bitKey_CTOR(&res->highKey_, ncoords);
+	bitKey_fromCoords(&res->lowKey_, min_coords, ncoords);
+	bitKey_fromCoords(&res->highKey_, max_coords, ncoords);
+
+	/* 
+	   every split adds one subquery only, so both arrays never hold more than npieces, 
+	   they are grown on demand, max_intervals is just a limit, most of extents need much less
+	*/
+	capacity = Min(max_intervals, CMP_INITIAL_PIECES);
+	res->items_ = (zcurve_interval_t *)palloc(sizeof(zcurve_interval_t) * capacity);
+	heap = (cmp_piece_t *)palloc(sizeof(cmp_piece_t) * capacity);
+
+	/* the whole extent as the top level subquery */
+	memset(&sq, 0, sizeof(sq));
+	sq.ncoords_ = ncoords;
+	sq.curBitNum_ = ((32 * ncoords) - 1);
+	sq.lowKey_ = res->lowKey_;
+	sq.highKey_ = res->highKey_;
+
+	waste = cmp_waste(&sq);
+	if (waste > 0.)
+		cmp_heapPush(heap, &nheap, &sq, waste);
+	else
+		cmp_append(res, &sq, true);
+
+	/* the most wasteful subquery is split first */
+	while (nheap > 0 && npieces < max_intervals)
+	{
+		if (npieces >= capacity)
+		{
+			capacity = (capacity > max_intervals / 2) ? max_intervals : capacity * 2;
+			res->items_ = (zcurve_interval_t *)repalloc_huge(res->items_, sizeof(zcurve_interval_t) * capacity);
+			heap = (cmp_piece_t *)repalloc_huge(heap, sizeof(cmp_piece_t) * capacity);
+		}
+		cmp_heapPop(heap, &nheap, &sq);
+		spt_query2_cutQuery(&sq, &lower);
+		npieces++;
+
+		waste = cmp_waste(&lower);
+		if (waste > 0.)
+			cmp_heapPush(heap, &nheap, &lower, waste);
+		else
+			cmp_append(res, &lower, true);
+
+		waste = cmp_waste(&sq);
+		if (waste > 0.)
+			cmp_heapPush(heap, &nheap, &sq, waste);
+		else
+			cmp_append(res, &sq, true);
+	}
+
+	/* the rest are to be filtered */
+	for (i = 0; i < nheap; i++)
+		cmp_append(res, &heap[i].query_, false);
+	pfree(heap);
+
+	/* intervals are disjoint, so sorting by the low bound is enough */
+	qsort(res->items_, res->count_, sizeof(zcurve_interval_t), cmp_intervals);
+
+	/* adjacent intervals are merged, the result is solid if both of them are */
+	for (i = 0, j = 1; j < res->count_; j++)
+	{
+		zcurve_interval_t *prev = &res->items_[i];
+		zcurve_interval_t *cur = &res->items_[j];
+
+		if (1. == bitKey_distance(&prev->highKey_, &cur->lowKey_))
+		{
+			prev->highKey_ = cur->highKey_;
+			prev->solid_ = prev->solid_ && cur->solid_;
+		}
+		else
+		{
+			res->items_[++i] = *cur;
+		}
+	}
+	if (res->count_ > 0)
+		res->count_ = i + 1;
+}
+
+/* PUBLIC, frees intervals list memory */
+void
+zcurve_intervals_free(zcurve_intervals_t *res)
+{
+	Assert(res);
+	if (res->items_)
+		pfree(res->items_);
+	res->items_ = NULL;
+	res->count_ = 0;
+}
+
+/* compiled lookups cache size, GUC parameter */
+int zcurve_intervals_cache_size = ZCURVE_DEFAULT_INTERVALS_CACHE_SIZE;
+
+/* cached lookup identity */
+typedef struct icache_key_s {
+	Oid		relid_;				/* index */
+	int		ncoords_;			/* dimension */
+	int		max_intervals_;			/* compilation limit */
+	uint32		min_coords_[ZKEY_MAX_COORDS];	/* lookup extent left bottom corner */
+	uint32		max_coords_[ZKEY_MAX_COORDS];	/* lookup extent upper right corner */
+} icache_key_t;
+
+/* cache entry */
+typedef struct icache_entry_s {
+	icache_key_t	key_;		/* hash key, must be the first */
+	dlist_node	lru_;		/* LRU list link, the most recently used are in head */
+	zcurve_intervals_t ivs_;	/* compiled lookup */
+} icache_entry_t;
+
+static MemoryContext icache_mcxt = NULL;
+static HTAB *icache_hash = NULL;
+static dlist_head icache_lru;
+
+/* copies compiled lookup to current memory context */
+static void
+icache_copy(zcurve_intervals_t *dst, const zcurve_intervals_t *src)
+{
+	*dst = *src;
+	dst->items_ = (zcurve_interval_t *)MemoryContextAllocHuge(CurrentMemoryContext, sizeof(zcurve_interval_t) * Max(src->count_, 1));
+	memcpy(dst->items_, src->items_, sizeof(zcurve_interval_t) * src->count_);
+}
+
+static void
+icache_remove(icache_entry_t *entry)
+{
+	dlist_delete(&entry->lru_);
+	zcurve_intervals_free(&entry->ivs_);
+	hash_search(icache_hash, &entry->key_, HASH_REMOVE, NULL);
+}
+
+/* relcache callback, index is rebuilt or dropped, InvalidOid means all of relations */
+static void
+icache_invalidate(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS status;
+	icache_entry_t *entry;
+
+	if (NULL == icache_hash || 0 == hash_get_num_entries(icache_hash))
+		return;
+
+	hash_seq_init(&status, icache_hash);
+	while ((entry = (icache_entry_t *)hash_seq_search(&status)) != NULL)
+	{
+		if (!OidIsValid(relid) || entry->key_.relid_ == relid)
+			icache_remove(entry);
+	}
+}
+
+/* the first usage in backend */
+static void
+icache_init(void)
+{
+	HASHCTL ctl;
+
+	icache_mcxt = AllocSetContextCreate(TopMemoryContext,
+		"zcurve intervals cache",
+		ALLOCSET_DEFAULT_MINSIZE,
+		ALLOCSET_DEFAULT_INITSIZE,
+		ALLOCSET_DEFAULT_MAXSIZE);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(icache_key_t);
+	ctl.entrysize = sizeof(icache_entry_t);
+	ctl.hash = tag_hash;
+	ctl.hcxt = icache_mcxt;
+	icache_hash = hash_create("zcurve intervals cache", 256, &ctl, HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	dlist_init(&icache_lru);
+	CacheRegisterRelcacheCallback(icache_invalidate, (Datum) 0);
+}
+
+/* PUBLIC, compiled lookup, cached version */
+void
+zcurve_intervals_cached_compile(zcurve_intervals_t *res, Oid relid, const uint32 *min_coords, const uint32 *max_coords, int ncoords, int max_intervals)
+{
+	icache_key_t key;
+	icache_entry_t *entry;
+	MemoryContext oldcontext;
+	int i;
+
+	Assert(res && min_coords && max_coords);
+	if (zcurve_intervals_cache_size <= 0)
+	{
+		zcurve_intervals_compile(res, min_coords, max_coords, ncoords, max_intervals);
+		return;
+	}
+	if (NULL == icache_hash)
+		icache_init();
+
+	memset(&key, 0, sizeof(key));
+	key.relid_ = relid;
+	key.ncoords_ = ncoords;
+	key.max_intervals_ = max_intervals;
+	for (i = 0; i < ncoords; i++)
+	{
+		key.min_coords_[i] = min_coords[i];
+		key.max_coords_[i] = max_coords[i];
+	}
+
+	entry = (icache_entry_t *)hash_search(icache_hash, &key, HASH_FIND, NULL);
+	if (entry)
+	{
+		dlist_move_head(&icache_lru, &entry->lru_);
+		icache_copy(res, &entry->ivs_);
+		return;
+	}
+
+	zcurve_intervals_compile(res, min_coords, max_coords, ncoords, max_intervals);
+
+	/* the least recently used go out */
+	while (hash_get_num_entries(icache_hash) >= zcurve_intervals_cache_size)
+		icache_remove(dlist_container(icache_entry_t, lru_, dlist_tail_node(&icache_lru)));
+
+	entry = (icache_entry_t *)hash_search(icache_hash, &key, HASH_ENTER, NULL);
+	entry->ivs_.items_ = NULL;
+	entry->ivs_.count_ = 0;
+	dlist_push_head(&icache_lru, &entry->lru_);
+
+	oldcontext = MemoryContextSwitchTo(icache_mcxt);
+	icache_copy(&entry->ivs_, res);
+	MemoryContextSwitchTo(oldcontext);
+}
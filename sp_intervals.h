@@ -0,0 +1,55 @@
+/*
+ * contrib/zcurve/sp_intervals.h
+ *
+ *
+ * sp_intervals.h -- lookup extent compilation to the sorted list of z-curve intervals
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#ifndef __ZCURVE_SP_INTERVALS_H
+#define __ZCURVE_SP_INTERVALS_H
+
+#include "bitkey.h"
+
+/* keys diapason, both bounds are inclusive */
+typedef struct zcurve_interval_s {
+	bitKey_t	lowKey_;	/* the begining of diapason */
+	bitKey_t	highKey_;	/* the end of diapason */
+	bool		solid_;		/* all the keys in diapason belong to lookup extent, no filtering required */
+} zcurve_interval_t;
+
+/* compiled lookup extent */
+typedef struct zcurve_intervals_s {
+	int		ncoords_;	/* dimension */
+	bitKey_t	lowKey_;	/* lookup extent left bottom corner, for non-solid intervals filtering */
+	bitKey_t	highKey_;	/* lookup extent upper right corner */
+	int		count_;		/* intervals number */
+	zcurve_interval_t *items_;	/* intervals sorted by keys, adjacent ones are merged */
+} zcurve_intervals_t;
+
+/* 
+   splits lookup extent the same way as lookup does, but up-front, 
+   subqueries with the most keys outside of extent are split first, 
+   till all of them are solid or max_intervals is reached, 
+   the result is sorted and adjacent intervals are merged
+*/
+extern void zcurve_intervals_compile(zcurve_intervals_t *res, const uint32 *min_coords, const uint32 *max_coords, int ncoords, int max_intervals);
+
+/* frees intervals list memory */
+extern void zcurve_intervals_free(zcurve_intervals_t *res);
+
+/* default number of compiled lookups cached in backend */
+#define ZCURVE_DEFAULT_INTERVALS_CACHE_SIZE 1024
+
+/* compiled lookups cache size, GUC parameter, 0 means no caching */
+extern int zcurve_intervals_cache_size;
+
+/* 
+   the same as zcurve_intervals_compile, but repeated lookups over the same index are 
+   taken from backend LRU cache, cache entries are dropped when the index is invalidated,
+   result is a copy in current memory context
+*/
+extern void zcurve_intervals_cached_compile(zcurve_intervals_t *res, Oid relid, const uint32 *min_coords, const uint32 *max_coords, int ncoords, int max_intervals);
+
+#endif /* __ZCURVE_SP_INTERVALS_H */
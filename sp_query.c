@@ -20,23 +20,45 @@
 #include "utils/fmgroids.h"
 #include "catalog/namespace.h"
 #include "access/nbtree.h"
+#include "access/heapam.h"
+#include "access/visibilitymap.h"
+#include "access/xlog.h"
+#include "storage/bufmgr.h"
 #include "storage/bufpage.h"
+#include "utils/snapmgr.h"
+#if PG_VERSION_NUM >= 130000
+#include "access/table.h"
+#define heap_open table_open
+#define heap_close table_close
+#endif
 
 #include "sp_tree.h"
 #include "sp_query.h"
+#include "sp_stats.h"
 #include "bitkey.h"
 
+/* splitting cost model, GUC parameters */
+double zcurve_descent_cost = ZCURVE_DEFAULT_DESCENT_COST;
+double zcurve_filter_cost = ZCURVE_DEFAULT_FILTER_COST;
+
+/* compiled lookup intervals limit, GUC parameter */
+int zcurve_max_intervals = 0;
+
+/* heap visibility checking of found rows, GUC parameter */
+bool zcurve_check_visibility = false;
+
 
 /* constructor */
 void 
 spt_query2_CTOR (spt_query2_t *ps, Relation rel, const uint32 *min_coords, const uint32 *max_coords, int ncoords)
 {
 	int i;
-	Assert(NULL != ps && ncoords < ZKEY_MAX_COORDS);
+	Assert(NULL != ps && ncoords >= 2 && ncoords <= ZKEY_MAX_DIMS);
 
 	ps->ncoords_ = ncoords;
 	ps->queryHead_ = NULL;
 	ps->freeHead_ = NULL;
+	ps->mcxt_ = CurrentMemoryContext;
 
 	for (i = 0; i < ncoords; i++)
 	{
@@ -47,6 +69,21 @@ spt_query2_CTOR (spt_query2_t *ps, Relation rel, const uint32 *min_coords, const
 	bitKey_CTOR(&ps->currentKey_, ncoords);
 	bitKey_CTOR(&ps->lastKey_, ncoords);
 
+	ps->wantCoords_ = true;
+	ps->intervals_ = NULL;
+	ps->curInterval_ = -1;
+	ps->heapRel_ = NULL;
+	ps->vmBuffer_ = InvalidBuffer;
+	/* LP_DEAD hints of the primary are not reliable on a standby, as nbtree does */
+	ps->ignoreKilled_ = !RecoveryInProgress();
+	memset(&ps->stats_, 0, sizeof(ps->stats_));
+	ps->statTracked_ = false;
+	ps->trace_ = NULL;
+	ps->visItems_ = NULL;
+	ps->visSize_ = ps->visCount_ = ps->visPos_ = 0;
+	ps->visBatch_ = ps->visResume_ = ps->visDone_ = false;
+	bitKey_CTOR(&ps->visLastKey_, ncoords);
+
 	/* tree cursor init */
 	zcurve_scan_ctx_CTOR(&ps->qctx_, rel, ncoords);
 }
@@ -56,7 +93,28 @@ void
 spt_query2_DTOR (spt_query2_t *ps)
 {
 	Assert(NULL != ps);
-	zcurve_scan_ctx_DTOR(&ps->qctx_);
+	spt_query2_closeQuery(ps);
+}
+
+/* retargeting */
+void 
+spt_query2_reset (spt_query2_t *ps, Relation rel, const uint32 *min_coords, const uint32 *max_coords)
+{
+	int i;
+	Assert(NULL != ps);
+
+	spt_query2_closeQuery(ps);
+	for (i = 0; i < ps->ncoords_; i++)
+	{
+		ps->min_point_[i] = min_coords[i];
+		ps->max_point_[i] = max_coords[i];
+	}
+	bitKey_CTOR(&ps->currentKey_, ps->ncoords_);
+	bitKey_CTOR(&ps->lastKey_, ps->ncoords_);
+	ps->curInterval_ = -1;
+	memset(&ps->stats_, 0, sizeof(ps->stats_));
+
+	zcurve_scan_ctx_CTOR(&ps->qctx_, rel, ps->ncoords_);
 }
 
 
@@ -66,13 +124,14 @@ spt_query2_createQuery(spt_query2_t *q)
 {
 	spatial2Query_t *ret = NULL;
 	Assert(q);
+	q->stats_.subqueries_++;
 	if(q->freeHead_)
 	{
 		spatial2Query_t *retval = q->freeHead_;
 		q->freeHead_ = q->freeHead_->prevQuery_;
 		return retval;
 	}
-	ret = (spatial2Query_t *)palloc(sizeof(spatial2Query_t));
+	ret = (spatial2Query_t *)MemoryContextAlloc(q->mcxt_, sizeof(spatial2Query_t));
 	ret->curBitNum_ = 0;
 	ret->solid_ = 0;
 	ret->ncoords_ = q->ncoords_;
@@ -102,9 +161,9 @@ Log2(int n)
 		| !!(n & 0xAAAAAAAA);
 }
 
-/* testing for query is solid - no additional splitting etc, just out data */
-void
-spt_query2_testSolidity (spatial2Query_t *q)
+/* testing for query is solid, the flag only, nothing is changed */
+bool
+spt_query2_isSolid (const spatial2Query_t *q)
 {
 	uint32_t lcoords[ZKEY_MAX_COORDS];
 	uint32_t hcoords[ZKEY_MAX_COORDS];
@@ -131,6 +190,12 @@ spt_query2_testSolidity (spatial2Query_t *q)
 				ok = 0;
 				break;
 			}
+			/* hypercube must be aligned to be contiguous on z-curve */
+			if (lcoords[i] & (diff - 1))
+			{
+				ok = 0;
+				break;
+			}
 			odiff = diff;
 		}
 	}
@@ -138,34 +203,225 @@ spt_query2_testSolidity (spatial2Query_t *q)
 	{
 		ok = 0;
 	}
-	q->solid_ = ok;
-	if (ok)
+	return ok;
+}
+
+void
+zcurve_trace_CTOR(zcurve_trace_t *trace)
+{
+	Assert(trace);
+	trace->count_ = 0;
+	trace->size_ = 64;
+	trace->open_ = false;
+	trace->items_ = (zcurve_trace_item_t *)palloc(sizeof(zcurve_trace_item_t) * trace->size_);
+}
+
+void
+zcurve_trace_DTOR(zcurve_trace_t *trace)
+{
+	Assert(trace);
+	if (trace->items_)
+		pfree(trace->items_);
+	trace->items_ = NULL;
+	trace->count_ = trace->size_ = 0;
+}
+
+/* lookup counters so far, the cursor ones are not added till it is closed */
+static void
+spt_query2_traceCounters(spt_query2_t *q, zcurve_stats_t *dst)
+{
+	*dst = q->stats_;
+	if (zcurve_scan_ctx_is_opened(&q->qctx_))
+		zcurve_stats_add(dst, &q->qctx_.stats_);
+}
+
+/* the last traced subquery is finished */
+static void
+spt_query2_traceClose(spt_query2_t *q)
+{
+	zcurve_trace_t *trace = q->trace_;
+	zcurve_trace_item_t *item;
+	zcurve_stats_t cur;
+
+	if (!trace || !trace->open_)
+		return;
+
+	spt_query2_traceCounters(q, &cur);
+	item = &trace->items_[trace->count_ - 1];
+	item->pages_ = cur.pages_ - trace->start_.pages_;
+	item->keys_ = cur.keys_ - trace->start_.keys_;
+	item->rows_ = cur.rows_ - trace->start_.rows_;
+	trace->open_ = false;
+}
+
+/* new subquery is started, the previous one is finished if not yet */
+static void
+spt_query2_traceOpen(spt_query2_t *q, const bitKey_t *low, const bitKey_t *high, int splitBit, bool solid)
+{
+	zcurve_trace_t *trace = q->trace_;
+	zcurve_trace_item_t *item;
+
+	if (!trace)
+		return;
+
+	spt_query2_traceClose(q);
+	if (trace->count_ == trace->size_)
+	{
+		trace->size_ *= 2;
+		trace->items_ = (zcurve_trace_item_t *)repalloc(trace->items_, sizeof(zcurve_trace_item_t) * trace->size_);
+	}
+	item = &trace->items_[trace->count_++];
+	item->lowKey_ = *low;
+	item->highKey_ = *high;
+	item->splitBit_ = splitBit;
+	item->solid_ = solid;
+	item->pages_ = item->keys_ = item->rows_ = 0;
+	spt_query2_traceCounters(q, &trace->start_);
+	trace->open_ = true;
+}
+
+/* subquery was split after its start, the lower part is executed */
+static void
+spt_query2_traceKeys(spt_query2_t *q, const spatial2Query_t *sq)
+{
+	zcurve_trace_item_t *item;
+
+	if (!q->trace_ || !q->trace_->open_)
+		return;
+
+	item = &q->trace_->items_[q->trace_->count_ - 1];
+	item->lowKey_ = sq->lowKey_;
+	item->highKey_ = sq->highKey_;
+	item->splitBit_ = sq->curBitNum_;
+	item->solid_ = sq->solid_;
+}
+
+/* testing for query is solid - no additional splitting etc, just out data */
+void
+spt_query2_testSolidity (spatial2Query_t *q)
+{
+	q->solid_ = spt_query2_isSolid(q);
+	if (q->solid_)
 	{
 		q->dhighKey_ = bitKey_toLong(&q->highKey_);
 	}
+}
 
-#if 0
-	/* gnuplot line compatible output*/
-	elog(INFO, "%d %d",lcoords[0], lcoords[2]);
-	elog(INFO, "%d %d",lcoords[0], hcoords[2]);
-	elog(INFO, "%d %d",hcoords[0], hcoords[2]);
-	elog(INFO, "%d %d",hcoords[0], lcoords[2]);
-	elog(INFO, "%d %d %d %d %d %llu %c",lcoords[0], lcoords[2], dcoords[0], dcoords[1], dcoords[2], vol, ok?'*':' ');
-	elog(INFO, "");
-#endif
+/* 
+   cuts subquery sq by its split bit, sq keeps the upper half of diapason, 
+   the lower one goes to lower, solidity is not tested here 
+ */
+void
+spt_query2_cutQuery (spatial2Query_t *sq, spatial2Query_t *lower)
+{
+	Assert(sq && lower && bitKey_cmp(&sq->lowKey_, &sq->highKey_) < 0);
+
+	/* decrease curBitNum till corresponding bits are equal in both diapason numbers */
+	while ( bitKey_getBit(&sq->lowKey_, sq->curBitNum_) == 
+		bitKey_getBit(&sq->highKey_, sq->curBitNum_))
+	{
+		sq->curBitNum_--;
+	}
+
+	/* init diapason */
+	lower->lowKey_ = sq->lowKey_;
+	lower->highKey_ = sq->highKey_;
+	/* cut diapason by curBitNum for new subquery */
+	bitKey_setLowBits(&lower->highKey_, sq->curBitNum_);
+	/* cut diapason by curBitNum for old subquery */
+	bitKey_clearLowBits(&sq->lowKey_, sq->curBitNum_);
+	/* decrease bits pointers */
+	lower->curBitNum_ = --sq->curBitNum_;
+	lower->ncoords_ = sq->ncoords_;
+}
+
+/* the number of points in subquery extent, subquery diapason is always a box */
+double
+spt_query2_volume (const spatial2Query_t *q)
+{
+	uint32_t lcoords[ZKEY_MAX_COORDS];
+	uint32_t hcoords[ZKEY_MAX_COORDS];
+	double vol = 1.;
+	int i;
+
+	bitKey_toCoords (&q->lowKey_, lcoords, ZKEY_MAX_COORDS);
+	bitKey_toCoords (&q->highKey_, hcoords, ZKEY_MAX_COORDS);
+	for (i = 0; i < q->ncoords_; i++)
+		vol *= (double)(hcoords[i] - lcoords[i]) + 1.;
+	return vol;
 }
 
 
+/* unfinished subqueries go to the reuse list */
+static void
+spt_query2_freeQueue(spt_query2_t *q)
+{
+	while (q->queryHead_)
+	{
+		spatial2Query_t *prevQuery = q->queryHead_->prevQuery_;
+		spt_query2_freeQuery(q, q->queryHead_);
+		q->queryHead_ = prevQuery;
+	}
+}
+
 /* just closes index tree cursor */
 void 
 spt_query2_closeQuery(spt_query2_t *q)
 {
 	Assert(q);
+	spt_query2_traceClose(q);
 	if (zcurve_scan_ctx_is_opened(&q->qctx_))
 	{
-		q->queryHead_ = q->freeHead_ = NULL;
+		spt_query2_freeQueue(q);
+		zcurve_stats_add(&q->stats_, &q->qctx_.stats_);
 		zcurve_scan_ctx_DTOR(&q->qctx_);
 	}
+	/* once per lookup, shared totals are not touched while rows are fetched */
+	if (q->statTracked_)
+	{
+		instr_time elapsed;
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, q->statStart_);
+		zcurve_stat_report(q->statRelid_, &q->stats_, INSTR_TIME_GET_MILLISEC(elapsed));
+		q->statTracked_ = false;
+	}
+	if (q->intervals_)
+	{
+		zcurve_intervals_free(q->intervals_);
+		pfree(q->intervals_);
+		q->intervals_ = NULL;
+	}
+	if (BufferIsValid(q->vmBuffer_))
+	{
+		ReleaseBuffer(q->vmBuffer_);
+		q->vmBuffer_ = InvalidBuffer;
+	}
+	if (q->heapRel_)
+	{
+		heap_close(q->heapRel_, AccessShareLock);
+		q->heapRel_ = NULL;
+	}
+}
+
+/* 
+   PUBLIC, the index page is released, the lookup is not finished yet and is not reported, 
+   it is resumed by spt_query2_moveFirstFrom, subqueries are built again from the resume key
+*/
+void
+spt_query2_suspendQuery(spt_query2_t *q)
+{
+	Assert(q);
+	spt_query2_traceClose(q);
+	if (!zcurve_scan_ctx_is_opened(&q->qctx_))
+		return;
+	spt_query2_freeQueue(q);
+	zcurve_scan_ctx_release(&q->qctx_);
+	if (q->intervals_)
+	{
+		zcurve_intervals_free(q->intervals_);
+		pfree(q->intervals_);
+		q->intervals_ = NULL;
+	}
 }
 
 /* marks subquery on the top of queue as finished and pops it out */
@@ -176,18 +432,510 @@ spt_query2_releaseSubQuery(spt_query2_t *q)
 	if(q->queryHead_)
 	{
 		spatial2Query_t *prevQuery = q->queryHead_->prevQuery_;
+		spt_query2_traceClose(q);
 		spt_query2_freeQuery(q, q->queryHead_);
 		q->queryHead_ = prevQuery;
 		q->subQueryFinished_ = 1;
 	}
 }
 
+/* for solid subqueries keys are not decoded while scanning, but coordinates may be required */
+static void
+spt_query2_rawCoords(spt_query2_t *q, uint32 *coords)
+{
+	bitKey_t key;
+
+	if (!q->wantCoords_)
+		return;
+
+	bitKey_CTOR(&key, q->ncoords_);
+	bitKey_fromLong(&key, q->qctx_.raw_val_);
+	bitKey_toCoords(&key, coords, ZKEY_MAX_COORDS);
+	q->stats_.decoded_++;
+}
+
+/* 
+   compiled lookup, moves to the next interval which is not behind the cursor.
+   Cursor goes forward only, index is not touched when the cursor is already in the interval.
+   Returns 0 when intervals are exhausted
+ */
+static int
+spt_query2_nextInterval(spt_query2_t *q)
+{
+	zcurve_intervals_t *civ = q->intervals_;
+	zcurve_interval_t *iv = NULL;
+	bool positioned = (q->curInterval_ >= 0);
+
+	/* where is the cursor now? solid interval keys are not decoded while scanning */
+	if (positioned && civ->items_[q->curInterval_].solid_)
+	{
+		bitKey_fromLong(&q->qctx_.cur_val_, q->qctx_.raw_val_);
+		q->stats_.decoded_++;
+	}
+
+	while (++q->curInterval_ < civ->count_)
+	{
+		iv = &civ->items_[q->curInterval_];
+		if (!positioned || bitKey_cmp(&q->qctx_.cur_val_, &iv->highKey_) <= 0)
+			break;
+	}
+	if (q->curInterval_ >= civ->count_)
+		return 0;
+
+	spt_query2_traceOpen(q, &iv->lowKey_, &iv->highKey_, -1, iv->solid_);
+	if (iv->solid_)
+	{
+		q->dhighKey_ = bitKey_toLong(&iv->highKey_);
+		q->stats_.solid_++;
+	}
+	else
+		q->stats_.nonsolid_++;
+
+	/* the cursor is before the interval, let's seek */
+	if (!positioned || bitKey_cmp(&q->qctx_.cur_val_, &iv->lowKey_) < 0)
+	{
+		if (!zcurve_scan_move_first(&q->qctx_, &iv->lowKey_, iv->solid_))
+			return 0;
+	}
+	return 1;
+}
+
+/* compiled lookup main loop, returns not 0 in case of cuccess, resulting data in coords & iptr */
+static int
+spt_query2_intervalsMatch(spt_query2_t *q, uint32 *coords, ItemPointerData *iptr, bool advance)
+{
+	for (;;)
+	{
+		const zcurve_interval_t *iv = &q->intervals_->items_[q->curInterval_];
+
+		if (advance && !zcurve_scan_move_next(&q->qctx_, iv->solid_))
+		{
+			/* end of tree */
+			spt_query2_closeQuery(q);
+			return 0;
+		}
+		advance = true;
+
+		if (iv->solid_)
+		{
+			int cmp = DatumGetInt32(
+				DirectFunctionCall2(
+					numeric_cmp,
+					q->qctx_.raw_val_,
+					q->dhighKey_));
+			if (cmp <= 0)
+			{
+				spt_query2_rawCoords(q, coords);
+				*iptr = q->qctx_.iptr_;
+				return 1;
+			}
+		}
+		else if (bitKey_cmp(&q->qctx_.cur_val_, &iv->highKey_) <= 0)
+		{
+			/* test if current key in lookup extent */
+			if (bitKey_between(&q->qctx_.cur_val_, &q->intervals_->lowKey_, &q->intervals_->highKey_))
+			{
+				bitKey_toCoords (&q->qctx_.cur_val_, coords, ZKEY_MAX_COORDS);
+				*iptr = q->qctx_.iptr_;
+				return 1;
+			}
+			q->stats_.rejected_++;
+			continue;
+		}
+
+		/* the interval is finished, the key under cursor may belong to the next one */
+		if (!spt_query2_nextInterval(q))
+		{
+			spt_query2_closeQuery(q);
+			return 0;
+		}
+		advance = false;
+	}
+}
+
+/* compiled lookup start, intervals below start key are skipped */
+static int
+spt_query2_intervalsFirst(spt_query2_t *q, const bitKey_t *start, uint32 *coords, ItemPointerData *iptr)
+{
+	zcurve_intervals_t *civ;
+	zcurve_interval_t *iv;
+
+	q->intervals_ = (zcurve_intervals_t *)palloc(sizeof(zcurve_intervals_t));
+	zcurve_intervals_cached_compile(q->intervals_, RelationGetRelid(q->qctx_.rel_),
+		q->min_point_, q->max_point_, q->ncoords_, zcurve_max_intervals);
+	civ = q->intervals_;
+
+	if (NULL == start)
+	{
+		q->curInterval_ = -1;
+		if (!spt_query2_nextInterval(q))
+		{
+			spt_query2_closeQuery(q);
+			return 0;
+		}
+		return spt_query2_intervalsMatch(q, coords, iptr, false);
+	}
+
+	for (q->curInterval_ = 0; q->curInterval_ < civ->count_; q->curInterval_++)
+	{
+		if (bitKey_cmp(&civ->items_[q->curInterval_].highKey_, start) >= 0)
+			break;
+	}
+	if (q->curInterval_ >= civ->count_)
+	{
+		spt_query2_closeQuery(q);
+		return 0;
+	}
+	iv = &civ->items_[q->curInterval_];
+	spt_query2_traceOpen(q, &iv->lowKey_, &iv->highKey_, -1, iv->solid_);
+	if (iv->solid_)
+	{
+		q->dhighKey_ = bitKey_toLong(&iv->highKey_);
+		q->stats_.solid_++;
+	}
+	else
+		q->stats_.nonsolid_++;
+	if (!zcurve_scan_move_first(&q->qctx_, (bitKey_cmp(&iv->lowKey_, start) < 0) ? start : &iv->lowKey_, iv->solid_))
+	{
+		spt_query2_closeQuery(q);
+		return 0;
+	}
+	return spt_query2_intervalsMatch(q, coords, iptr, false);
+}
+
+/* 
+   subqueries below start key are pruned, the one containing it is split 
+   till its lower bound is not less than start key, so the index is never read below start
+ */
+static void
+spt_query2_pruneBelow(spt_query2_t *q, const bitKey_t *start)
+{
+	while (q->queryHead_ && bitKey_cmp(&q->queryHead_->lowKey_, start) < 0)
+	{
+		spatial2Query_t *sq = q->queryHead_;
+		spatial2Query_t *lower;
+
+		/* completely below, drop it */
+		if (bitKey_cmp(&sq->highKey_, start) < 0)
+		{
+			q->queryHead_ = sq->prevQuery_;
+			spt_query2_freeQuery(q, sq);
+			continue;
+		}
+
+		/* contains start key, let's split it */
+		lower = spt_query2_createQuery (q);
+		spt_query2_cutQuery(sq, lower);
+		q->stats_.splits_++;
+		spt_query2_testSolidity(lower);
+		spt_query2_testSolidity(sq);
+
+		if (bitKey_cmp(&lower->highKey_, start) < 0)
+		{
+			spt_query2_freeQuery(q, lower);
+		}
+		else
+		{
+			lower->prevQuery_ = sq;
+			q->queryHead_ = lower;
+		}
+	}
+}
+
+static int spt_query2_moveFirstFromRaw(spt_query2_t *q, const bitKey_t *start, uint32 *coords, ItemPointerData *iptr);
+static int spt_query2_moveNextRaw (spt_query2_t *q, uint32 *coords, ItemPointerData *iptr);
+
+/* 
+   index items killed by earlier scans are skipped (unless in recovery, see ignoreKilled_),
+   the cursor stays on the index item the row came from, the leaf page is locked
+*/
+static bool
+spt_query2_isKilled(spt_query2_t *q, const ItemPointerData *iptr)
+{
+	zcurve_scan_ctx_t *ctx = &q->qctx_;
+	Page		page;
+	ItemId		itemid;
+
+	if (!q->ignoreKilled_ || !BufferIsValid(ctx->buf_))
+		return false;
+
+	page = BufferGetPage(ctx->buf_);
+	if (ctx->offset_ > PageGetMaxOffsetNumber(page))
+		return false;
+	itemid = PageGetItemId(page, ctx->offset_);
+	return ItemIdIsDead(itemid) &&
+		ItemPointerEquals(&((IndexTuple) PageGetItem(page, itemid))->t_tid, (ItemPointer) iptr);
+}
+
+/* 
+   the row is looked up in the heap unless its page is all-visible, no index page is locked here,
+   *pbuf keeps the last heap page pinned, rows of a leaf page often share heap pages,
+   all_dead is set when the whole HOT chain is dead
+*/
+static bool
+spt_query2_heapVisible(spt_query2_t *q, Relation irel, const ItemPointerData *iptr, Buffer *pbuf, bool *all_dead)
+{
+	BlockNumber	blkno = ItemPointerGetBlockNumber(iptr);
+	HeapTupleData	tuple;
+	ItemPointerData	tid = *iptr;
+	bool		found;
+
+	*all_dead = false;
+	if (NULL == q->heapRel_)
+		q->heapRel_ = heap_open(irel->rd_index->indrelid, AccessShareLock);
+
+#if PG_VERSION_NUM >= 90600
+	if (VM_ALL_VISIBLE(q->heapRel_, blkno, &q->vmBuffer_))
+#else
+	if (visibilitymap_test(q->heapRel_, blkno, &q->vmBuffer_))
+#endif
+		return true;
+
+	*pbuf = ReleaseAndReadBuffer(*pbuf, q->heapRel_, blkno);
+	LockBuffer(*pbuf, BUFFER_LOCK_SHARE);
+	found = heap_hot_search_buffer(&tid, q->heapRel_, *pbuf, GetActiveSnapshot(), &tuple, all_dead, true);
+	LockBuffer(*pbuf, BUFFER_LOCK_UNLOCK);
+	return found;
+}
+
+/* 
+   index items of dead rows are marked LP_DEAD, the leaf pages are locked again for that,
+   it is just a hint, so read lock is enough, as in _bt_killitems a page changed since 
+   the items were read is skipped, its items may point to other rows by now
+*/
+static void
+spt_query2_killItems(spt_query2_t *q, Relation irel)
+{
+	int i = 0;
+
+	while (i < q->visCount_)
+	{
+		BlockNumber	blkno = q->visItems_[i].blkno_;
+		Buffer		buf;
+		Page		page;
+		OffsetNumber	maxoff;
+		bool		killed = false;
+
+		if (SPT_VIS_DEAD != q->visItems_[i].state_)
+		{
+			i++;
+			continue;
+		}
+
+		buf = _bt_getbuf(irel, blkno, BT_READ);
+		page = BufferGetPage(buf);
+		maxoff = PageGetMaxOffsetNumber(page);
+		for (; i < q->visCount_ && q->visItems_[i].blkno_ == blkno; i++)
+		{
+			spt_visItem_t	*it = &q->visItems_[i];
+			ItemId		itemid;
+
+			if (SPT_VIS_DEAD != it->state_ || BufferGetLSNAtomic(buf) != it->lsn_ || it->offset_ > maxoff)
+				continue;
+			itemid = PageGetItemId(page, it->offset_);
+			if (ItemPointerEquals(&((IndexTuple) PageGetItem(page, itemid))->t_tid, &it->iptr_))
+			{
+				ItemIdMarkDead(itemid);
+				killed = true;
+			}
+		}
+		if (killed)
+		{
+			BTPageOpaque opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+
+			opaque->btpo_flags |= BTP_HAS_GARBAGE;
+#if PG_VERSION_NUM >= 90400
+			MarkBufferDirtyHint(buf, true);
+#else
+			SetBufferCommitInfoNeedsSave(buf);
+#endif
+		}
+		_bt_relbuf(irel, buf);
+	}
+}
+
+/* 
+   zcurve.check_visibility batch, the matching rows of one leaf page (and the rest of the rows 
+   of its last key) are collected under the leaf lock, then the page is released and 
+   the rows are checked against the heap, so a heap page is never locked while an index page is,
+   the lookup is resumed after the last key of the batch by the next call
+*/
+static void
+spt_query2_visFill(spt_query2_t *q, const bitKey_t *start)
+{
+	Relation	irel = q->qctx_.rel_;
+	uint32		coords[ZKEY_MAX_COORDS];
+	ItemPointerData iptr;
+	BlockNumber	blkno = InvalidBlockNumber;
+	Buffer		heapBuf = InvalidBuffer;
+	bool		tracked = q->statTracked_;
+	bitKey_t	key;
+	int		ret, i, n;
+
+	q->visCount_ = q->visPos_ = 0;
+	memset(coords, 0, sizeof(coords));
+	bitKey_CTOR(&key, q->ncoords_);
+
+	/* shared totals are reported when the rows are checked, not when the index part is exhausted */
+	q->statTracked_ = false;
+	ret = spt_query2_moveFirstFromRaw(q, q->visResume_ ? &q->visLastKey_ : start, coords, &iptr);
+	while (ret)
+	{
+		zcurve_scan_ctx_t *ctx = &q->qctx_;
+		BlockNumber	curblk = BufferGetBlockNumber(ctx->buf_);
+		spt_visItem_t	*it;
+
+		if (spt_query2_isKilled(q, &iptr))
+		{
+			ret = spt_query2_moveNextRaw(q, coords, &iptr);
+			continue;
+		}
+		bitKey_fromLong(&key, ctx->raw_val_);
+		/* rows of the last key went out with the previous batch */
+		if (0 == q->visCount_ && q->visResume_ && bitKey_cmp(&key, &q->visLastKey_) <= 0)
+		{
+			ret = spt_query2_moveNextRaw(q, coords, &iptr);
+			continue;
+		}
+		/* the next leaf page, but the last key may have some more rows */
+		if (q->visCount_ > 0 && curblk != blkno && 0 != bitKey_cmp(&key, &q->visLastKey_))
+			break;
+
+		if (q->visCount_ == q->visSize_)
+		{
+			q->visSize_ = q->visSize_ ? q->visSize_ * 2 : 256;
+			q->visItems_ = q->visItems_ ?
+				(spt_visItem_t *) repalloc(q->visItems_, sizeof(spt_visItem_t) * q->visSize_) :
+				(spt_visItem_t *) MemoryContextAlloc(q->mcxt_, sizeof(spt_visItem_t) * q->visSize_);
+		}
+		it = &q->visItems_[q->visCount_++];
+		it->iptr_ = iptr;
+		memcpy(it->coords_, coords, sizeof(coords));
+		it->blkno_ = curblk;
+		it->offset_ = ctx->offset_;
+		it->lsn_ = BufferGetLSNAtomic(ctx->buf_);
+		it->state_ = SPT_VIS_VISIBLE;
+		if (1 == q->visCount_)
+			blkno = curblk;
+		q->visLastKey_ = key;
+		ret = spt_query2_moveNextRaw(q, coords, &iptr);
+	}
+	if (ret)
+	{
+		spt_query2_suspendQuery(q);
+		q->visResume_ = true;
+	}
+	else
+		q->visDone_ = true;
+
+	/* no index page is locked from here */
+	for (i = 0; i < q->visCount_; i++)
+	{
+		spt_visItem_t	*it = &q->visItems_[i];
+		bool		all_dead;
+
+		if (!spt_query2_heapVisible(q, irel, &it->iptr_, &heapBuf, &all_dead))
+			it->state_ = (all_dead && q->ignoreKilled_) ? SPT_VIS_DEAD : SPT_VIS_INVISIBLE;
+	}
+	if (BufferIsValid(heapBuf))
+		ReleaseBuffer(heapBuf);
+	spt_query2_killItems(q, irel);
+
+	for (i = 0, n = 0; i < q->visCount_; i++)
+	{
+		if (SPT_VIS_VISIBLE == q->visItems_[i].state_)
+			q->visItems_[n++] = q->visItems_[i];
+	}
+	q->visCount_ = n;
+	q->stats_.rows_ += n;
+
+	q->statTracked_ = tracked;
+	if (q->visDone_)
+		spt_query2_closeQuery(q);
+}
+
+/* the next visible row of zcurve.check_visibility batches, start is used by the first batch only */
+static int
+spt_query2_visNext(spt_query2_t *q, const bitKey_t *start, uint32 *coords, ItemPointerData *iptr)
+{
+	spt_visItem_t *it;
+
+	while (q->visPos_ >= q->visCount_)
+	{
+		if (q->visDone_)
+			return 0;
+		spt_query2_visFill(q, start);
+	}
+	it = &q->visItems_[q->visPos_++];
+	*iptr = it->iptr_;
+	memcpy(coords, it->coords_, sizeof(uint32) * q->ncoords_);
+	return 1;
+}
+
 /* PUBLIC, spatial cursor start, returns not 0 in case of cuccess, resulting data in x,y,iptr */
 int
 spt_query2_moveFirst(spt_query2_t *q, uint32 *coords, ItemPointerData *iptr)
+{
+	return spt_query2_moveFirstFrom(q, NULL, coords, iptr);
+}
+
+
+/* PUBLIC, the same but keys less than start are skipped without reading, NULL start means from the beginning */
+int
+spt_query2_moveFirstFrom(spt_query2_t *q, const bitKey_t *start, uint32 *coords, ItemPointerData *iptr)
+{
+	int ret;
+
+	if (!q->statTracked_ && zcurve_scan_ctx_is_opened(&q->qctx_))
+	{
+		q->statTracked_ = true;
+		q->statRelid_ = RelationGetRelid(q->qctx_.rel_);
+		INSTR_TIME_SET_CURRENT(q->statStart_);
+	}
+
+	/* heap is checked by batches, without the index page lock */
+	q->visBatch_ = zcurve_check_visibility;
+	q->visCount_ = q->visPos_ = 0;
+	q->visResume_ = false;
+	q->visDone_ = false;
+	if (q->visBatch_)
+		return spt_query2_visNext(q, start, coords, iptr);
+
+	ret = spt_query2_moveFirstFromRaw(q, start, coords, iptr);
+	while (ret && spt_query2_isKilled(q, iptr))
+		ret = spt_query2_moveNextRaw(q, coords, iptr);
+	if (ret)
+		q->stats_.rows_++;
+	return ret;
+}
+
+/* PUBLIC, main loop iteration, returns not 0 in case of cuccess, resulting data in x,y,...,iptr */
+int
+spt_query2_moveNext (spt_query2_t *q, uint32 *coords, ItemPointerData *iptr)
+{
+	int ret;
+
+	if (q->visBatch_)
+		return spt_query2_visNext(q, NULL, coords, iptr);
+
+	ret = spt_query2_moveNextRaw(q, coords, iptr);
+	while (ret && spt_query2_isKilled(q, iptr))
+		ret = spt_query2_moveNextRaw(q, coords, iptr);
+	if (ret)
+		q->stats_.rows_++;
+	return ret;
+}
+
+/* cursor start, all the index items */
+static int
+spt_query2_moveFirstFromRaw(spt_query2_t *q, const bitKey_t *start, uint32 *coords, ItemPointerData *iptr)
 {
 	Assert(q && coords && iptr);
 
+	/* compiled lookup, all the splitting is done before the index is touched */
+	if (zcurve_max_intervals > 0)
+		return spt_query2_intervalsFirst(q, start, coords, iptr);
+
 	q->queryHead_ = spt_query2_createQuery (q);
 	q->queryHead_->prevQuery_ = NULL;
 	q->queryHead_->curBitNum_ = ((32 * q->ncoords_) - 1);
@@ -197,12 +945,15 @@ spt_query2_moveFirst(spt_query2_t *q, uint32 *coords, ItemPointerData *iptr)
 
 	spt_query2_testSolidity(q->queryHead_);
 
+	if (start)
+		spt_query2_pruneBelow(q, start);
+
 	return spt_query2_findNextMatch(q, coords, iptr);
 }
 
-/* PUBLIC, main loop iteration, returns not 0 in case of cuccess, resulting data in x,y,...,iptr */
-int
-spt_query2_moveNext (spt_query2_t *q, uint32 *coords, ItemPointerData *iptr)
+/* main loop iteration, all the index items */
+static int
+spt_query2_moveNextRaw (spt_query2_t *q, uint32 *coords, ItemPointerData *iptr)
 {
 	Assert(q && coords && iptr);
 	/*if all finished just go out*/
@@ -210,6 +961,11 @@ spt_query2_moveNext (spt_query2_t *q, uint32 *coords, ItemPointerData *iptr)
 	{
 		return 0;
 	}
+	/* compiled lookup */
+	if (q->intervals_)
+	{
+		return spt_query2_intervalsMatch(q, coords, iptr, true);
+	}
 	/* current subquery is finished, let's get a new one*/
 	if (q->subQueryFinished_)
 	{
@@ -231,6 +987,7 @@ spt_query2_moveNext (spt_query2_t *q, uint32 *coords, ItemPointerData *iptr)
 			if (!spt_query2_testRawKey(q))
 				break;
 
+			spt_query2_rawCoords(q, coords);
 			*iptr = q->iptr_;
 			return 1;
 		}
@@ -301,6 +1058,27 @@ spt_query2_testRawKey(spt_query2_t *q)
 }
 
 
+/* 
+   splitting cost model.
+   Keys between the cursor and the end of subquery diapason are estimated 
+   by the keys density on the current page. If filtering them all is cheaper 
+   than the index descents that splitting leads to, subquery is just scanned through.
+ */
+static bool
+spt_query2_splitIsCheaper(spt_query2_t *q)
+{
+	double span, tuples;
+
+	if (zcurve_descent_cost <= 0.)
+		return true;
+
+	span = bitKey_distance(&q->currentKey_, &q->lastKey_) + 1.;
+	tuples = (double)(q->qctx_.max_offset_ - q->qctx_.offset_ + 1) * 
+		(bitKey_distance(&q->currentKey_, &q->queryHead_->highKey_) + 1.) / span;
+
+	return tuples * zcurve_filter_cost > zcurve_descent_cost;
+}
+
 /* 
    gets an subquery from queue, split it if necessary 
    till the full satisfaction and then test for an appropriate data
@@ -313,6 +1091,8 @@ spt_query2_findNextMatch(spt_query2_t *q, uint32 *coords, ItemPointerData *iptr)
 	while(q->queryHead_)
 	{
 		q->subQueryFinished_ = 0;
+		spt_query2_traceOpen(q, &q->queryHead_->lowKey_, &q->queryHead_->highKey_, 
+			q->queryHead_->curBitNum_, q->queryHead_->solid_);
 		/* (re)initialize cursor */
 		if(!spt_query2_queryFind(q, &q->queryHead_->lowKey_))
 		{
@@ -322,31 +1102,19 @@ spt_query2_findNextMatch(spt_query2_t *q, uint32 *coords, ItemPointerData *iptr)
 		}
 		/* while there is something to split (last value on the current page less then the upper bound of subquery diapason) */
 		while (0 == q->queryHead_->solid_ && 
-			bitKey_cmp(&q->lastKey_, &q->queryHead_->highKey_) < 0)
+			bitKey_cmp(&q->lastKey_, &q->queryHead_->highKey_) < 0 &&
+			spt_query2_splitIsCheaper(q))
 		{
 			/* let's split query */
 			spatial2Query_t *subQuery = NULL;
 
-			/* decrease curBitNum till corresponding bits are equal in both diapason numbers */
-			while ( bitKey_getBit(&q->queryHead_->lowKey_, q->queryHead_->curBitNum_) == 
-				bitKey_getBit(&q->queryHead_->highKey_, q->queryHead_->curBitNum_))
-			{
-				q->queryHead_->curBitNum_--;
-			}
-
 			/* create neq subquery */
 			subQuery = spt_query2_createQuery (q);
 			/* push it to the queue */
 			subQuery->prevQuery_ = q->queryHead_;
-			/* init diapason */
-			subQuery->lowKey_ = q->queryHead_->lowKey_;
-			subQuery->highKey_ = q->queryHead_->highKey_;
-			/* cut diapason by curBitNum for new subquery */
-			bitKey_setLowBits(&subQuery->highKey_, q->queryHead_->curBitNum_);
-			/* cut diapason by curBitNum for old subquery */
-			bitKey_clearLowBits(&q->queryHead_->lowKey_, q->queryHead_->curBitNum_);
-			/* decrease bits pointers */
-			subQuery->curBitNum_ = --q->queryHead_->curBitNum_;
+			/* the lower half goes to the new subquery */
+			spt_query2_cutQuery(q->queryHead_, subQuery);
+			q->stats_.splits_++;
 
 			spt_query2_testSolidity(subQuery);
 			spt_query2_testSolidity(q->queryHead_);
@@ -354,6 +1122,11 @@ spt_query2_findNextMatch(spt_query2_t *q, uint32 *coords, ItemPointerData *iptr)
 			q->queryHead_ = subQuery;
 			q->subQueryFinished_ = 0;
 		}
+		spt_query2_traceKeys(q, q->queryHead_);
+		if (q->queryHead_->solid_)
+			q->stats_.solid_++;
+		else
+			q->stats_.nonsolid_++;
 
 		for (;;)
 		{
@@ -362,6 +1135,7 @@ spt_query2_findNextMatch(spt_query2_t *q, uint32 *coords, ItemPointerData *iptr)
 				if (!spt_query2_testRawKey(q))
 					break;
 
+				spt_query2_rawCoords(q, coords);
 				*iptr = q->iptr_;
 				return 1;
 			}
@@ -408,7 +1182,10 @@ spt_query2_checkKey (spt_query2_t *q, uint32 *coords)
 	/* let's try our key is positioned in necessary diapason */
 	if (0 == q->queryHead_->solid_ && 
 	    0 == bitKey_between(&q->currentKey_, lKey, hKey))
+	{
+		q->stats_.rejected_++;
 		return 0;
+	}
 
 	/* OK, return data */
 	Assert(coords);
@@ -12,6 +12,35 @@
 
 #include "bitkey.h"
 #include "sp_tree.h"
+#include "sp_intervals.h"
+#include "access/xlogdefs.h"
+#include "portability/instr_time.h"
+
+/* splitting cost model defaults, see zcurve.descent_cost & zcurve.filter_cost */
+#define ZCURVE_DEFAULT_DESCENT_COST 1.0
+#define ZCURVE_DEFAULT_FILTER_COST 0.01
+
+/* 
+   the cost of an index descent for a new subquery and the cost of testing 
+   one index key against the lookup extent, subquery is split only when 
+   filtering the keys up to its end is estimated to be more expensive,
+   zero descent cost means "always split"
+*/
+extern double zcurve_descent_cost;
+extern double zcurve_filter_cost;
+
+/* 
+   when positive, lookup extent is compiled up-front to no more than 
+   zcurve.max_intervals z-curve intervals, 0 means lazy splitting while scanning
+*/
+extern int zcurve_max_intervals;
+
+/* 
+   when on, found rows are checked against the heap (unless the page is all-visible), 
+   invisible ones are skipped and index items of dead rows are marked LP_DEAD,
+   rows are checked by batches of one leaf page after the page is released
+*/
+extern bool zcurve_check_visibility;
 
 /* subquery definition */
 typedef struct spatial2Query_s {
@@ -24,14 +53,53 @@ typedef struct spatial2Query_s {
 	struct spatial2Query_s *prevQuery_; 	/* pointer to subqueries queue */
 } spatial2Query_t;
 
+/* one executed subquery (compiled interval) of the traced lookup */
+typedef struct zcurve_trace_item_s {
+	bitKey_t lowKey_;	/* the begining of index interval */
+	bitKey_t highKey_;	/* the end of index interval */
+	int splitBit_;		/* the bit the next split goes by, -1 for compiled intervals */
+	bool solid_;		/* no filtering was required */
+	int64 pages_;		/* leaf pages pinned */
+	int64 keys_;		/* index items read */
+	int64 rows_;		/* rows returned */
+} zcurve_trace_item_t;
+
+/* subqueries in execution order, collected when spt_query2_t::trace_ is set */
+typedef struct zcurve_trace_s {
+	zcurve_trace_item_t *items_;
+	int count_;
+	int size_;
+	bool open_;		/* the last item is still executed */
+	zcurve_stats_t start_;	/* lookup counters at the start of the last item */
+} zcurve_trace_t;
+
+extern void zcurve_trace_CTOR(zcurve_trace_t *trace);
+extern void zcurve_trace_DTOR(zcurve_trace_t *trace);
+
+/* zcurve.check_visibility batch item states */
+#define SPT_VIS_VISIBLE 0
+#define SPT_VIS_INVISIBLE 1
+#define SPT_VIS_DEAD 2		/* the whole HOT chain is dead, the index item is to be marked LP_DEAD */
+
+/* a row waiting for the heap visibility check */
+typedef struct spt_visItem_s {
+	ItemPointerData iptr_;			/* table row */
+	uint32 coords_[ZKEY_MAX_COORDS];	/* its coordinates */
+	BlockNumber blkno_;			/* index leaf page the row came from */
+	OffsetNumber offset_;			/* its index item */
+	XLogRecPtr lsn_;			/* leaf page LSN when the item was read */
+	int state_;				/* SPT_VIS_xxx */
+} spt_visItem_t;
+
 /* top level spatial query definition */
 typedef struct spt_query2_s {
-	uint32 min_point_[ZKEY_MAX_COORDS];	/* lookup extent left bottom corner, debug only */
-	uint32 max_point_[ZKEY_MAX_COORDS];	/* lookup extent upper right corner, debug only */
+	uint32 min_point_[ZKEY_MAX_COORDS];	/* lookup extent left bottom corner */
+	uint32 max_point_[ZKEY_MAX_COORDS];	/* lookup extent upper right corner */
 	int ncoords_;
 
 	spatial2Query_t *queryHead_;		/* subqueries queue */
 	spatial2Query_t *freeHead_;		/* finished subqueries are reused */
+	MemoryContext mcxt_;			/* subqueries memory, they survive spt_query2_reset */
 
 	zcurve_scan_ctx_t qctx_;		/* low level cursor context */
 
@@ -40,6 +108,36 @@ typedef struct spt_query2_s {
 
 	bool subQueryFinished_;			/* automata state flag */
 	ItemPointerData iptr_;			/* temporarily stored current t_tid */
+
+	bool wantCoords_;			/* coordinates are required for the keys of solid subqueries too */
+
+	zcurve_intervals_t *intervals_;		/* compiled lookup extent, NULL in lazy splitting mode */
+	int curInterval_;			/* currently scanned interval */
+	Datum dhighKey_;			/* the end of current solid interval in numeric form */
+
+	Relation heapRel_;			/* table, opened when zcurve.check_visibility is on */
+	Buffer vmBuffer_;			/* visibility map page */
+	/* 
+	   LP_DEAD index items are skipped whatever zcurve.check_visibility is, 
+	   the rows are dead for everyone, it is off in recovery only, 
+	   the hints of the primary are not reliable on a standby, as nbtree does
+	*/
+	bool ignoreKilled_;
+
+	bool visBatch_;				/* zcurve.check_visibility was on when the lookup started */
+	spt_visItem_t *visItems_;		/* checked rows of the current batch */
+	int visCount_;				/* their number */
+	int visPos_;				/* the next one to return */
+	int visSize_;				/* visItems_ capacity */
+	bool visResume_;			/* the index part is suspended after visLastKey_ */
+	bool visDone_;				/* the index part is exhausted */
+	bitKey_t visLastKey_;			/* the last key of the batch */
+
+	zcurve_stats_t stats_;			/* lookup counters, cursor ones are added when it is closed */
+	zcurve_trace_t *trace_;			/* subqueries trace, NULL if not required */
+	bool statTracked_;			/* lookup is started but not reported to shared totals yet */
+	Oid statRelid_;				/* index the totals are reported for */
+	instr_time statStart_;			/* lookup start time */
 } spt_query2_t;
 
 /* constructor */
@@ -48,6 +146,9 @@ extern void spt_query2_CTOR (spt_query2_t *ps, Relation rel, const uint32 *min_c
 /* destructor */
 extern void spt_query2_DTOR (spt_query2_t *ps);
 
+/* the same lookup definition retargeted to the new extent, subqueries memory is reused */
+extern void spt_query2_reset (spt_query2_t *ps, Relation rel, const uint32 *min_coords, const uint32 *max_coords);
+
 
 
 
@@ -56,9 +157,18 @@ extern void spt_query2_DTOR (spt_query2_t *ps);
 /* spatial cursor start, returns not 0 in case of cuccess, resulting data in x,y,iptr */
 extern int  spt_query2_moveFirst(spt_query2_t *q, uint32 *coorsd, ItemPointerData *iptr);
 
+/* the same as spt_query2_moveFirst, but the keys less than start are skipped, subqueries below it are pruned */
+extern int  spt_query2_moveFirstFrom(spt_query2_t *q, const bitKey_t *start, uint32 *coords, ItemPointerData *iptr);
+
 /* main loop iteration, returns not 0 in case of cuccess, resulting data in x,y,iptr */
 extern int  spt_query2_moveNext(spt_query2_t *q, uint32 *coords, ItemPointerData *iptr);
 
+/* 
+   releases the index page, so no locks are held between calls, the lookup goes on 
+   with spt_query2_moveFirstFrom, the counters and the timing still belong to one lookup
+*/
+extern void spt_query2_suspendQuery(spt_query2_t *q);
+
 
 
 /* private interface -------------------------------------- */
@@ -66,12 +176,21 @@ extern int  spt_query2_moveNext(spt_query2_t *q, uint32 *coords, ItemPointerData
 /* if freeHead_ is not empty gets memory there or just palloc some */
 extern spatial2Query_t *spt_query2_createQuery (spt_query2_t *q);
 
-/* closes index tree cursor */
+/* closes index tree cursor, unfinished subqueries go to the reuse list */
 extern void spt_query2_closeQuery(spt_query2_t *q);
 
 /* testing for query is solid - no additional splitting etc, just out data */
 extern void spt_query2_testSolidity (spatial2Query_t *q);
 
+/* the same test as above, returns the flag only */
+extern bool spt_query2_isSolid (const spatial2Query_t *q);
+
+/* cuts subquery by its split bit, sq keeps the upper half, the lower one goes to lower */
+extern void spt_query2_cutQuery (spatial2Query_t *sq, spatial2Query_t *lower);
+
+/* the number of points in subquery extent */
+extern double spt_query2_volume (const spatial2Query_t *q);
+
 /* push subquery to the reuse list */
 extern void spt_query2_freeQuery(spt_query2_t *q, spatial2Query_t *);
 
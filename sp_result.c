@@ -0,0 +1,212 @@
+/*
+ * contrib/zcurve/sp_result.c
+ *
+ *
+ * sp_result.c -- lookup results buffer, ordering by t_tid
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#include "postgres.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/memutils.h"
+
+#include "sp_result.h"
+
+/* radix sort digit width, t_tid is 48 bits long, so 3 passes at most */
+#define RESULT_RADIX_BITS 16
+#define RESULT_RADIX_SIZE (1 << RESULT_RADIX_BITS)
+#define RESULT_KEY_BITS 48
+
+/* smaller inputs are not worth of counting arrays */
+#define RESULT_RADIX_MIN 1024
+
+/* sorting item, t_tid as (block << 16 | offset) and insertion number */
+typedef struct result_sort_item_s {
+	uint64	key_;
+	uint32	idx_;
+} result_sort_item_t;
+
+/* constructor */
+void
+zcurve_result_CTOR(zcurve_result_t *res, int ncoords)
+{
+	Assert(res && ncoords <= ZKEY_MAX_COORDS);
+	memset(res, 0, sizeof(*res));
+	res->ncoords_ = ncoords;
+}
+
+/* destructor */
+void
+zcurve_result_DTOR(zcurve_result_t *res)
+{
+	int i, j;
+
+	Assert(res);
+	for (i = 0; i < res->nchunks_; i++)
+	{
+		pfree(res->chunks_[i].tids_);
+		for (j = 0; j < res->ncoords_; j++)
+			pfree(res->chunks_[i].coords_[j]);
+	}
+	if (res->chunks_)
+		pfree(res->chunks_);
+	if (res->order_)
+		pfree(res->order_);
+	zcurve_result_CTOR(res, res->ncoords_);
+}
+
+/* PUBLIC, appends an item */
+void
+zcurve_result_add(zcurve_result_t *res, const ItemPointerData *iptr, const uint32 *coords)
+{
+	zcurve_result_chunk_t *chunk;
+	uint32 pos = res->count_ % ZCURVE_RESULT_CHUNK;
+	int i;
+
+	Assert(res && iptr && NULL == res->order_);
+	if (0 == pos)
+	{
+		if (res->nchunks_ == res->maxchunks_)
+		{
+			res->maxchunks_ = (res->maxchunks_) ? res->maxchunks_ * 2 : 16;
+			res->chunks_ = (res->chunks_) ?
+				(zcurve_result_chunk_t *)repalloc(res->chunks_, sizeof(zcurve_result_chunk_t) * res->maxchunks_) :
+				(zcurve_result_chunk_t *)palloc(sizeof(zcurve_result_chunk_t) * res->maxchunks_);
+		}
+		chunk = &res->chunks_[res->nchunks_++];
+		chunk->tids_ = (ItemPointerData *)palloc(sizeof(ItemPointerData) * ZCURVE_RESULT_CHUNK);
+		for (i = 0; i < res->ncoords_; i++)
+			chunk->coords_[i] = (uint32 *)palloc(sizeof(uint32) * ZCURVE_RESULT_CHUNK);
+	}
+
+	chunk = &res->chunks_[res->count_ / ZCURVE_RESULT_CHUNK];
+	chunk->tids_[pos] = *iptr;
+	for (i = 0; i < res->ncoords_; i++)
+		chunk->coords_[i][pos] = coords[i];
+	res->count_++;
+}
+
+/* PUBLIC, gets item by its insertion number */
+void
+zcurve_result_get(const zcurve_result_t *res, uint32 idx, ItemPointerData *iptr, uint32 *coords)
+{
+	const zcurve_result_chunk_t *chunk;
+	uint32 pos = idx % ZCURVE_RESULT_CHUNK;
+	int i;
+
+	Assert(res && idx < res->count_);
+	chunk = &res->chunks_[idx / ZCURVE_RESULT_CHUNK];
+	*iptr = chunk->tids_[pos];
+	for (i = 0; i < res->ncoords_; i++)
+		coords[i] = chunk->coords_[i][pos];
+}
+
+/* PUBLIC, the amount of memory used by items, sorting included */
+Size
+zcurve_result_memory(const zcurve_result_t *res)
+{
+	Assert(res);
+	/* order_, sorting items and the radix buffer are allocated at once by zcurve_result_sort */
+	return (Size)res->nchunks_ * ZCURVE_RESULT_CHUNK * (sizeof(ItemPointerData) + sizeof(uint32) * res->ncoords_) +
+		(Size)res->count_ * (sizeof(uint32) + 2 * sizeof(result_sort_item_t));
+}
+
+static int
+result_sort_item_cmp(const void *a, const void *b)
+{
+	uint64 l = ((const result_sort_item_t *)a)->key_;
+	uint64 r = ((const result_sort_item_t *)b)->key_;
+	return (l < r) ? -1 : (l > r) ? 1 : 0;
+}
+
+/* LSD radix sort, the result is in *pitems, *ptmp is a buffer of the same size */
+static void
+result_radix_sort(result_sort_item_t **pitems, result_sort_item_t **ptmp, uint32 n)
+{
+	uint32 *counts = (uint32 *)palloc(sizeof(uint32) * RESULT_RADIX_SIZE);
+	int shift;
+
+	for (shift = 0; shift < RESULT_KEY_BITS; shift += RESULT_RADIX_BITS)
+	{
+		result_sort_item_t *src = *pitems;
+		result_sort_item_t *dst = *ptmp;
+		uint32 sum = 0, i;
+
+		memset(counts, 0, sizeof(uint32) * RESULT_RADIX_SIZE);
+		for (i = 0; i < n; i++)
+			counts[(src[i].key_ >> shift) & (RESULT_RADIX_SIZE - 1)]++;
+
+		/* all the items have the same digit, nothing to do (high block numbers digit usually) */
+		if (counts[(src[0].key_ >> shift) & (RESULT_RADIX_SIZE - 1)] == n)
+			continue;
+
+		for (i = 0; i < RESULT_RADIX_SIZE; i++)
+		{
+			uint32 cnt = counts[i];
+			counts[i] = sum;
+			sum += cnt;
+		}
+		for (i = 0; i < n; i++)
+			dst[counts[(src[i].key_ >> shift) & (RESULT_RADIX_SIZE - 1)]++] = src[i];
+
+		*pitems = dst;
+		*ptmp = src;
+	}
+	pfree(counts);
+}
+
+/* PUBLIC, orders items by t_tid */
+void
+zcurve_result_sort(zcurve_result_t *res)
+{
+	result_sort_item_t *items;
+	result_sort_item_t *tmp = NULL;
+	uint32 i;
+
+	Assert(res && NULL == res->order_);
+	/* huge allocations, there can be more than MaxAllocSize of them */
+	res->order_ = (uint32 *)MemoryContextAllocHuge(CurrentMemoryContext, sizeof(uint32) * Max(res->count_, 1));
+	res->cur_ = 0;
+	if (0 == res->count_)
+		return;
+
+	items = (result_sort_item_t *)MemoryContextAllocHuge(CurrentMemoryContext, sizeof(result_sort_item_t) * res->count_);
+	for (i = 0; i < res->count_; i++)
+	{
+		const ItemPointerData *iptr = &res->chunks_[i / ZCURVE_RESULT_CHUNK].tids_[i % ZCURVE_RESULT_CHUNK];
+		items[i].key_ = ((uint64)BlockIdGetBlockNumber(&iptr->ip_blkid) << 16) | iptr->ip_posid;
+		items[i].idx_ = i;
+	}
+
+	if (res->count_ < RESULT_RADIX_MIN)
+	{
+		qsort(items, res->count_, sizeof(result_sort_item_t), result_sort_item_cmp);
+	}
+	else
+	{
+		tmp = (result_sort_item_t *)MemoryContextAllocHuge(CurrentMemoryContext, sizeof(result_sort_item_t) * res->count_);
+		result_radix_sort(&items, &tmp, res->count_);
+	}
+
+	for (i = 0; i < res->count_; i++)
+		res->order_[i] = items[i].idx_;
+
+	pfree(items);
+	if (tmp)
+		pfree(tmp);
+}
+
+/* PUBLIC, the next item in t_tid order */
+bool
+zcurve_result_next(zcurve_result_t *res, ItemPointerData *iptr, uint32 *coords)
+{
+	Assert(res && res->order_);
+	if (res->cur_ >= res->count_)
+		return false;
+	zcurve_result_get(res, res->order_[res->cur_++], iptr, coords);
+	return true;
+}
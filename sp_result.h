@@ -0,0 +1,57 @@
+/*
+ * contrib/zcurve/sp_result.h
+ *
+ *
+ * sp_result.h -- lookup results buffer, ordering by t_tid
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#ifndef __ZCURVE_SP_RESULT_H
+#define __ZCURVE_SP_RESULT_H
+
+#include "storage/itemptr.h"
+#include "bitkey.h"
+
+/* the number of items in one chunk */
+#define ZCURVE_RESULT_CHUNK 4096
+
+/* items are stored column-wise, t_tid separately from every coordinate */
+typedef struct zcurve_result_chunk_s {
+	ItemPointerData	*tids_;				/* table rows */
+	uint32		*coords_[ZKEY_MAX_COORDS];	/* x y z ... */
+} zcurve_result_chunk_t;
+
+/* lookup results */
+typedef struct zcurve_result_s {
+	int		ncoords_;	/* dimension */
+	uint32		count_;		/* items number */
+	int		nchunks_;	/* chunks allocated */
+	int		maxchunks_;	/* chunks_ array size */
+	zcurve_result_chunk_t *chunks_;	/* storage */
+	uint32		*order_;	/* items order by t_tid, NULL before sorting */
+	uint32		cur_;		/* output position in order_ */
+} zcurve_result_t;
+
+/* constructor */
+extern void zcurve_result_CTOR(zcurve_result_t *res, int ncoords);
+
+/* destructor */
+extern void zcurve_result_DTOR(zcurve_result_t *res);
+
+/* appends an item */
+extern void zcurve_result_add(zcurve_result_t *res, const ItemPointerData *iptr, const uint32 *coords);
+
+/* gets item by its insertion number */
+extern void zcurve_result_get(const zcurve_result_t *res, uint32 idx, ItemPointerData *iptr, uint32 *coords);
+
+/* the amount of memory used by items and later by their sorting, to compare with work_mem */
+extern Size zcurve_result_memory(const zcurve_result_t *res);
+
+/* orders items by t_tid, LSD radix sort on (block, offset), small ones are just qsorted */
+extern void zcurve_result_sort(zcurve_result_t *res);
+
+/* gets the next item in t_tid order, returns false in the end */
+extern bool zcurve_result_next(zcurve_result_t *res, ItemPointerData *iptr, uint32 *coords);
+
+#endif /* __ZCURVE_SP_RESULT_H */
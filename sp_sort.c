@@ -0,0 +1,132 @@
+/*
+ * contrib/zcurve/sp_sort.c
+ *
+ *
+ * sp_sort.c -- SortSupport for numeric z-curve keys, index build speedup
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "utils/builtins.h"
+#include "utils/numeric.h"
+#include "utils/sortsupport.h"
+
+#include "ex_numeric.h"
+#include "sp_sort.h"
+
+/* numerics of greater weight are not less than 10000^8 > 2^96, the largest 3D key */
+#define ZKEY_MAX_WEIGHT 7
+
+/* 
+   PostgreSQL 14+ infinities share NUMERIC_NAN flag bits of ex_numeric.h (NUMERIC_SPECIAL there),
+   they differ by the next two bits, NaN is 0xC000, +Infinity 0xD000, -Infinity 0xF000
+*/
+#define ZKEY_NUMERIC_EXT_SIGN_MASK 0xF000
+#define ZKEY_NUMERIC_NINF 0xF000
+
+/* full comparison */
+static int
+zcurve_numeric_cmp(Datum x, Datum y, SortSupport ssup)
+{
+	return DatumGetInt32(DirectFunctionCall2(numeric_cmp, x, y));
+}
+
+#if PG_VERSION_NUM >= 90500 && SIZEOF_DATUM == 8
+
+/* 
+   z-curve keys are non-negative integers less than 2^96, 
+   values below 2^63 are stored as is (all the 2D keys), the bigger ones as 2^63 + (value >> 33), 
+   so the mapping keeps the order, whatever numerics are mapped to the nearest bounds,
+   special values too, the opclass is a general numeric one
+*/
+static Datum
+zcurve_abbrev_convert(Datum original, SortSupport ssup)
+{
+	Numeric		num = DatumGetNumeric(original);
+	NumericDigit	*digits = NUMERIC_DIGITS(num);
+	int		ndigits = NUMERIC_NDIGITS(num);
+	int		weight = NUMERIC_WEIGHT(num);
+	uint32		xdata[4] = {0, 0, 0, 0};	/* little endian 32-bit words */
+	uint64		res;
+	int		i, j;
+
+	if (NUMERIC_IS_NAN(num))
+	{
+		/* -Infinity is less than anything, NaN and +Infinity are greater */
+		if ((num->choice.n_header & ZKEY_NUMERIC_EXT_SIGN_MASK) == ZKEY_NUMERIC_NINF)
+			res = 0;
+		else
+			res = ~((uint64) 0);
+	}
+	else if (ndigits == 0 || weight < 0 || NUMERIC_SIGN(num) == NUMERIC_NEG)
+		res = 0;
+	else if (weight > ZKEY_MAX_WEIGHT)
+		res = ~((uint64) 0);
+	else
+	{
+		/* integer part, base 10000 digits to binary, trailing zero digits are not stored */
+		for (i = 0; i <= weight; i++)
+		{
+			uint64 carry = (i < ndigits) ? digits[i] : 0;
+
+			for (j = 0; j < 4; j++)
+			{
+				uint64 val = (uint64) xdata[j] * 10000 + carry;
+
+				xdata[j] = (uint32) val;
+				carry = val >> 32;
+			}
+		}
+
+		if (xdata[3] != 0)
+			res = ~((uint64) 0);
+		else if (xdata[2] == 0 && xdata[1] < 0x80000000U)
+			res = ((uint64) xdata[1] << 32) | xdata[0];
+		else
+			res = (UINT64CONST(1) << 63) | ((((uint64) xdata[2] << 32) | xdata[1]) >> 1);
+	}
+
+	if ((Pointer) num != DatumGetPointer(original))
+		pfree(num);
+	return UInt64GetDatum(res);
+}
+
+static int
+zcurve_abbrev_cmp(Datum x, Datum y, SortSupport ssup)
+{
+	uint64 a = DatumGetUInt64(x);
+	uint64 b = DatumGetUInt64(y);
+
+	if (a == b)
+		return 0;
+	return (a > b) ? 1 : -1;
+}
+
+/* prefixes are nearly unique for z-curve keys, there is no reason to give up */
+static bool
+zcurve_abbrev_abort(int memtupcount, SortSupport ssup)
+{
+	return false;
+}
+
+#endif
+
+/* PUBLIC, SortSupport setup */
+void
+zcurve_sortsupport_init(SortSupport ssup)
+{
+	ssup->comparator = zcurve_numeric_cmp;
+
+#if PG_VERSION_NUM >= 90500 && SIZEOF_DATUM == 8
+	if (ssup->abbreviate)
+	{
+		ssup->abbrev_full_comparator = ssup->comparator;
+		ssup->comparator = zcurve_abbrev_cmp;
+		ssup->abbrev_converter = zcurve_abbrev_convert;
+		ssup->abbrev_abort = zcurve_abbrev_abort;
+	}
+#endif
+}
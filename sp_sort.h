@@ -0,0 +1,21 @@
+/*
+ * contrib/zcurve/sp_sort.h
+ *
+ *
+ * sp_sort.h -- SortSupport for numeric z-curve keys, index build speedup
+ *		
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#ifndef __ZCURVE_SP_SORT_H
+#define __ZCURVE_SP_SORT_H
+
+#include "utils/sortsupport.h"
+
+/* 
+   fills SortSupport for numeric keys, abbreviated keys are 64-bit prefixes of the key value, 
+   exact for 2D keys, 3D ones fall back to numeric comparison on equal prefixes only
+*/
+extern void zcurve_sortsupport_init(SortSupport ssup);
+
+#endif /* __ZCURVE_SP_SORT_H */
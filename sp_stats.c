@@ -0,0 +1,316 @@
+/*
+ * contrib/zcurve/sp_stats.c
+ *
+ *
+ * sp_stats.c -- cluster-wide per-index lookup totals in shared memory
+ *
+ *   Every lookup counts its work locally (zcurve_stats_t of spt_query2_t) and
+ *   flushes it here once it is finished, with atomic increments only.
+ *   Shared entry of the index is located under the lock once, later the backend
+ *   takes it from its own cache. Entries are never removed, reset just zeroes them.
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#include "postgres.h"
+
+#include <string.h>
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#if PG_VERSION_NUM >= 90600
+#include "port/atomics.h"
+#endif
+
+#include "sp_stats.h"
+
+/* GUC parameters */
+int zcurve_stat_max_indexes = ZCURVE_DEFAULT_STAT_MAX_INDEXES;
+bool zcurve_stat_track = true;
+
+#if PG_VERSION_NUM >= 90600
+
+/* shared hash key */
+typedef struct zcurve_stat_key_s {
+	Oid	dbid_;
+	Oid	relid_;
+} zcurve_stat_key_t;
+
+/* shared hash entry */
+typedef struct zcurve_stat_entry_s {
+	zcurve_stat_key_t key_;
+	pg_atomic_uint64 lookups_;
+	pg_atomic_uint64 rows_;
+	pg_atomic_uint64 descents_;
+	pg_atomic_uint64 pages_;
+	pg_atomic_uint64 time_us_;
+	pg_atomic_uint64 hist_[ZCURVE_STAT_HIST_BUCKETS];
+} zcurve_stat_entry_t;
+
+/* backend cache entry */
+typedef struct zcurve_stat_local_s {
+	zcurve_stat_key_t key_;
+	zcurve_stat_entry_t *entry_;	/* NULL if shared hash is full */
+} zcurve_stat_local_t;
+
+/* shared header */
+typedef struct zcurve_stat_shared_s {
+	LWLock	*lock_;			/* protects the hash structure, not the counters */
+} zcurve_stat_shared_t;
+
+static zcurve_stat_shared_t *zcurve_stat_shared = NULL;
+static HTAB *zcurve_stat_hash = NULL;
+static HTAB *zcurve_stat_local = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+static Size
+zcurve_stat_memsize(void)
+{
+	return add_size(MAXALIGN(sizeof(zcurve_stat_shared_t)),
+		hash_estimate_size(zcurve_stat_max_indexes, sizeof(zcurve_stat_entry_t)));
+}
+
+static void
+zcurve_stat_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+	RequestAddinShmemSpace(zcurve_stat_memsize());
+	RequestNamedLWLockTranche("zcurve", 1);
+}
+
+static void
+zcurve_stat_shmem_startup(void)
+{
+	HASHCTL	info;
+	bool	found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	zcurve_stat_shared = ShmemInitStruct("zcurve stats", sizeof(zcurve_stat_shared_t), &found);
+	if (!found)
+		zcurve_stat_shared->lock_ = &(GetNamedLWLockTranche("zcurve"))->lock;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(zcurve_stat_key_t);
+	info.entrysize = sizeof(zcurve_stat_entry_t);
+	zcurve_stat_hash = ShmemInitHash("zcurve stats hash",
+		zcurve_stat_max_indexes, zcurve_stat_max_indexes,
+		&info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+void
+zcurve_stat_init(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = zcurve_stat_shmem_request;
+#else
+	zcurve_stat_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = zcurve_stat_shmem_startup;
+}
+
+static void
+zcurve_stat_check(void)
+{
+	if (!zcurve_stat_shared || !zcurve_stat_hash)
+		ereport(ERROR,
+			(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+			errmsg("zcurve must be loaded via shared_preload_libraries")));
+}
+
+/* shared entry of the index, created if necessary */
+static zcurve_stat_entry_t *
+zcurve_stat_entry(Oid relid)
+{
+	zcurve_stat_key_t	key;
+	zcurve_stat_local_t	*loc;
+	zcurve_stat_entry_t	*entry;
+	bool			found;
+
+	memset(&key, 0, sizeof(key));
+	key.dbid_ = MyDatabaseId;
+	key.relid_ = relid;
+
+	if (!zcurve_stat_local)
+	{
+		HASHCTL	info;
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(zcurve_stat_key_t);
+		info.entrysize = sizeof(zcurve_stat_local_t);
+		info.hcxt = TopMemoryContext;
+		zcurve_stat_local = hash_create("zcurve local stats", 64, &info, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	loc = (zcurve_stat_local_t *)hash_search(zcurve_stat_local, &key, HASH_ENTER, &found);
+	if (found && loc->entry_)
+		return loc->entry_;
+
+	LWLockAcquire(zcurve_stat_shared->lock_, LW_SHARED);
+	entry = (zcurve_stat_entry_t *)hash_search(zcurve_stat_hash, &key, HASH_FIND, NULL);
+	LWLockRelease(zcurve_stat_shared->lock_);
+
+	if (!entry)
+	{
+		LWLockAcquire(zcurve_stat_shared->lock_, LW_EXCLUSIVE);
+		entry = (zcurve_stat_entry_t *)hash_search(zcurve_stat_hash, &key, HASH_ENTER_NULL, &found);
+		if (entry && !found)
+		{
+			int i;
+			pg_atomic_init_u64(&entry->lookups_, 0);
+			pg_atomic_init_u64(&entry->rows_, 0);
+			pg_atomic_init_u64(&entry->descents_, 0);
+			pg_atomic_init_u64(&entry->pages_, 0);
+			pg_atomic_init_u64(&entry->time_us_, 0);
+			for (i = 0; i < ZCURVE_STAT_HIST_BUCKETS; i++)
+				pg_atomic_init_u64(&entry->hist_[i], 0);
+		}
+		LWLockRelease(zcurve_stat_shared->lock_);
+	}
+	/* full hash, the next lookup will try again */
+	loc->entry_ = entry;
+	return entry;
+}
+
+static int
+zcurve_stat_bucket(double elapsed_ms)
+{
+	int	i;
+	double	bound = 0.1;
+
+	for (i = 0; i < ZCURVE_STAT_HIST_BUCKETS - 1; i++, bound *= 10.)
+		if (elapsed_ms < bound)
+			return i;
+	return ZCURVE_STAT_HIST_BUCKETS - 1;
+}
+
+void
+zcurve_stat_report(Oid relid, const zcurve_stats_t *st, double elapsed_ms)
+{
+	zcurve_stat_entry_t *entry;
+
+	if (!zcurve_stat_track || !zcurve_stat_hash || !OidIsValid(relid))
+		return;
+
+	entry = zcurve_stat_entry(relid);
+	if (!entry)
+		return;
+
+	pg_atomic_fetch_add_u64(&entry->lookups_, 1);
+	pg_atomic_fetch_add_u64(&entry->rows_, st->rows_);
+	pg_atomic_fetch_add_u64(&entry->descents_, st->descents_);
+	pg_atomic_fetch_add_u64(&entry->pages_, st->pages_);
+	pg_atomic_fetch_add_u64(&entry->time_us_, (int64)(elapsed_ms * 1000.));
+	pg_atomic_fetch_add_u64(&entry->hist_[zcurve_stat_bucket(elapsed_ms)], 1);
+}
+
+int
+zcurve_stat_snapshot(zcurve_stat_row_t **rows)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	zcurve_stat_entry_t	*entry;
+	zcurve_stat_row_t	*ret;
+	long			n;
+	int			cnt = 0;
+
+	zcurve_stat_check();
+
+	LWLockAcquire(zcurve_stat_shared->lock_, LW_SHARED);
+	n = hash_get_num_entries(zcurve_stat_hash);
+	ret = (zcurve_stat_row_t *)palloc0(sizeof(zcurve_stat_row_t) * (n + 1));
+
+	hash_seq_init(&hash_seq, zcurve_stat_hash);
+	while ((entry = (zcurve_stat_entry_t *)hash_seq_search(&hash_seq)) != NULL)
+	{
+		zcurve_stat_row_t *row = &ret[cnt++];
+		int i;
+
+		row->dbid_ = entry->key_.dbid_;
+		row->relid_ = entry->key_.relid_;
+		row->lookups_ = (int64)pg_atomic_read_u64(&entry->lookups_);
+		row->rows_ = (int64)pg_atomic_read_u64(&entry->rows_);
+		row->descents_ = (int64)pg_atomic_read_u64(&entry->descents_);
+		row->pages_ = (int64)pg_atomic_read_u64(&entry->pages_);
+		row->time_ms_ = (double)pg_atomic_read_u64(&entry->time_us_) / 1000.;
+		for (i = 0; i < ZCURVE_STAT_HIST_BUCKETS; i++)
+			row->hist_[i] = (int64)pg_atomic_read_u64(&entry->hist_[i]);
+	}
+	LWLockRelease(zcurve_stat_shared->lock_);
+
+	*rows = ret;
+	return cnt;
+}
+
+void
+zcurve_stat_reset(void)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	zcurve_stat_entry_t	*entry;
+
+	zcurve_stat_check();
+
+	/* entries stay in place, backends keep pointers to them */
+	LWLockAcquire(zcurve_stat_shared->lock_, LW_SHARED);
+	hash_seq_init(&hash_seq, zcurve_stat_hash);
+	while ((entry = (zcurve_stat_entry_t *)hash_seq_search(&hash_seq)) != NULL)
+	{
+		int i;
+		pg_atomic_write_u64(&entry->lookups_, 0);
+		pg_atomic_write_u64(&entry->rows_, 0);
+		pg_atomic_write_u64(&entry->descents_, 0);
+		pg_atomic_write_u64(&entry->pages_, 0);
+		pg_atomic_write_u64(&entry->time_us_, 0);
+		for (i = 0; i < ZCURVE_STAT_HIST_BUCKETS; i++)
+			pg_atomic_write_u64(&entry->hist_[i], 0);
+	}
+	LWLockRelease(zcurve_stat_shared->lock_);
+}
+
+#else /* PG_VERSION_NUM < 90600, no named LWLock tranches & 64-bit atomics */
+
+void
+zcurve_stat_init(void)
+{
+}
+
+void
+zcurve_stat_report(Oid relid, const zcurve_stats_t *st, double elapsed_ms)
+{
+}
+
+int
+zcurve_stat_snapshot(zcurve_stat_row_t **rows)
+{
+	ereport(ERROR,
+		(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+		errmsg("zcurve index statistics require PostgreSQL 9.6 or later")));
+	return 0;
+}
+
+void
+zcurve_stat_reset(void)
+{
+	ereport(ERROR,
+		(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+		errmsg("zcurve index statistics require PostgreSQL 9.6 or later")));
+}
+
+#endif
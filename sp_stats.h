@@ -0,0 +1,52 @@
+/*
+ * contrib/zcurve/sp_stats.h
+ *
+ *
+ * sp_stats.h -- cluster-wide per-index lookup totals in shared memory
+ *
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#ifndef __ZCURVE_SP_STATS_H
+#define __ZCURVE_SP_STATS_H
+
+#include "sp_tree.h"
+
+/* latency histogram, upper bounds of the buckets are 0.1, 1, 10, 100, 1000 ms and infinity */
+#define ZCURVE_STAT_HIST_BUCKETS 6
+
+/* the number of indexes tracked, GUC parameter zcurve.stat_max_indexes */
+#define ZCURVE_DEFAULT_STAT_MAX_INDEXES 1000
+extern int zcurve_stat_max_indexes;
+
+/* lookups are accounted, GUC parameter zcurve.stat_track */
+extern bool zcurve_stat_track;
+
+/* totals of one index as they are reported */
+typedef struct zcurve_stat_row_s {
+	Oid	dbid_;				/* database */
+	Oid	relid_;				/* index */
+	int64	lookups_;			/* finished lookups */
+	int64	rows_;				/* rows returned */
+	int64	descents_;			/* index tree descents */
+	int64	pages_;				/* leaf pages read */
+	double	time_ms_;			/* lookups execution time */
+	int64	hist_[ZCURVE_STAT_HIST_BUCKETS];	/* lookups count by execution time */
+} zcurve_stat_row_t;
+
+/* shared memory request & hooks, does nothing unless loaded via shared_preload_libraries */
+extern void zcurve_stat_init(void);
+
+/*
+   adds counters of the finished lookup to the index totals,
+   atomic increments only, the entry is located under a lock once per backend and index
+*/
+extern void zcurve_stat_report(Oid relid, const zcurve_stats_t *st, double elapsed_ms);
+
+/* palloc'ed copy of all the totals, returns the number of rows */
+extern int zcurve_stat_snapshot(zcurve_stat_row_t **rows);
+
+/* all the totals are zeroed */
+extern void zcurve_stat_reset(void);
+
+#endif /* __ZCURVE_SP_STATS_H */
@@ -274,6 +274,7 @@ zcurve_search_2d(zcurve_scan_ctx_t *pctx)
 	bool nextkey = 0;
 
 	/* Get the root page to start with */
+	pctx->stats_.descents_++;
 	pctx->buf_ = _bt_getroot(rel, access);
 
 	/* If index is empty and access = BT_READ, no root page is created. */
@@ -350,6 +351,7 @@ zcurve_search_2d(zcurve_scan_ctx_t *pctx)
 		stack_in = new_stack;
 	}
 	pctx->pstack_ = stack_in;
+	pctx->stats_.pages_++;
 	return 1;
 }
 
@@ -393,6 +395,8 @@ zcurve_scan_step_forward(zcurve_scan_ctx_t *ctx, bool preserve_position, bool ra
 			break;
 
 		ctx->buf_ = _bt_relandgetbuf(ctx->rel_, ctx->buf_, opaque->btpo_next, BT_READ);
+		ctx->stats_.steps_++;
+		ctx->stats_.pages_++;
 		page = BufferGetPage(ctx->buf_);
 		opaque = (BTPageOpaque) PageGetSpecialPointer(page);
 
@@ -415,6 +419,7 @@ zcurve_scan_step_forward(zcurve_scan_ctx_t *ctx, bool preserve_position, bool ra
 			{
 				bitKey_fromLong(&ctx->cur_val_, arg);
 				ctx->next_val_ = ctx->cur_val_;
+				ctx->stats_.decoded_ += 2;
 
 				itemid = PageGetItemId(page, ctx->max_offset_);
 				itup = (IndexTuple) PageGetItem(page, itemid);
@@ -428,6 +433,7 @@ zcurve_scan_step_forward(zcurve_scan_ctx_t *ctx, bool preserve_position, bool ra
 	if (preserve_position)
 	{
 		ctx->buf_ = _bt_relandgetbuf(ctx->rel_, ctx->buf_, old_block_num, BT_READ);
+		ctx->stats_.pages_++;
 		ctx->offset_ = old_offset;
 		ctx->max_offset_ = old_max_offset;
 		ctx->cur_val_ = old_cur_val;
@@ -453,6 +459,7 @@ zcurve_scan_ctx_CTOR(zcurve_scan_ctx_t *ctx, Relation rel, int ncoords)
 	bitKey_CTOR(&ctx->last_page_val_, ncoords);
 	ctx->buf_ = 0;
 	ctx->pstack_ = NULL;
+	memset(&ctx->stats_, 0, sizeof(ctx->stats_));
 	return 1;
 }
 
@@ -476,27 +483,103 @@ zcurve_scan_ctx_DTOR(zcurve_scan_ctx_t *ctx)
 }
 
 
-/* starting cursor, it may be restorted with new value without calling destructor */
-int 
-zcurve_scan_move_first(zcurve_scan_ctx_t *ctx, const bitKey_t *start_val, bool raw)
+/* the page is unlocked & unpinned, pages stack is freed, the context stays usable for zcurve_scan_move_first */
+void
+zcurve_scan_ctx_release(zcurve_scan_ctx_t *ctx)
+{
+	Assert(ctx);
+	if (ctx->rel_ && ctx->buf_)
+	{
+		_bt_relbuf(ctx->rel_, ctx->buf_);
+		ctx->buf_ = 0;
+	}
+	if (ctx->pstack_)
+	{
+		_bt_freestack(ctx->pstack_);
+		ctx->pstack_ = NULL;
+	}
+	ctx->offset_ = 0;
+	ctx->max_offset_ = 0;
+}
+
+/* reads the item under cursor on the current page, stores the cursor position values */
+static void
+zcurve_scan_fetch(zcurve_scan_ctx_t *ctx, Page page, bool raw)
 {
-	Page 		page;
 	ItemId		itemid;
 	IndexTuple	itup;
 	Datum		arg;
 	bool		null;
 
-	/* first, let's free a page from last subquery if exists */
-	if (ctx->buf_)
-		_bt_relbuf(ctx->rel_, ctx->buf_);
+	itemid = PageGetItemId(page, ctx->offset_);
+	itup = (IndexTuple) PageGetItem(page, itemid);
+	arg = index_getattr(itup, 1, RelationGetDescr(ctx->rel_), &null);
+	ctx->iptr_ = itup->t_tid;
+	ctx->raw_val_ = arg;
+	ctx->stats_.keys_++;
+	if (!raw)
+	{
+		bitKey_fromLong(&ctx->cur_val_, arg);
+		ctx->stats_.decoded_ += 2;
+		itemid = PageGetItemId(page, ctx->max_offset_);
+		itup = (IndexTuple) PageGetItem(page, itemid);
+		arg = index_getattr(itup, 1, RelationGetDescr(ctx->rel_), &null);
+		bitKey_fromLong(&ctx->last_page_val_, arg);
+	}
+}
+
+/* 
+   when the starting value is on the currently holded leaf page, 
+   there is no need to descend from the root, just binary search on the page,
+   returns 0 if it is beyond the page, cursor stays untouched in this case 
+ */
+static int
+zcurve_scan_reseek(zcurve_scan_ctx_t *ctx, bool raw)
+{
+	Page 		page = BufferGetPage(ctx->buf_);
+	BTPageOpaque	opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+	OffsetNumber	maxoff = PageGetMaxOffsetNumber(page);
+
+	if (!P_ISLEAF(opaque) || maxoff < P_FIRSTDATAKEY(opaque))
+		return 0;
+
+	/* starting value is greater than the last page item */
+	if (zcurve_compare_2d(ctx, page, maxoff) > 0)
+		return 0;
+
+	ctx->offset_ = zcurve_binsrch_2d (ctx);
+	ctx->max_offset_ = maxoff;
+	zcurve_scan_fetch(ctx, page, raw);
+	return 1;
+}
+
+/* starting cursor, it may be restorted with new value without calling destructor */
+int 
+zcurve_scan_move_first(zcurve_scan_ctx_t *ctx, const bitKey_t *start_val, bool raw)
+{
+	Page 		page;
 
 	/* reinit starting values */
 	ctx->init_zv_ = *start_val;
 	ctx->skey_.sk_argument = bitKey_toLong(start_val);
 
+	if (ctx->buf_)
+	{
+		/* subqueries go in ascending order, the next one often starts on the same page */
+		if (zcurve_scan_reseek(ctx, raw))
+			return 1;
+
+		/* no, let's free a page from last subquery */
+		_bt_relbuf(ctx->rel_, ctx->buf_);
+		ctx->buf_ = 0;
+	}
+
 	/* let's free a pages stack from last subquery if exists */
 	if (ctx->pstack_)
+	{
 		_bt_freestack(ctx->pstack_);
+		ctx->pstack_ = NULL;
+	}
 
 	/* index tree lookup by the starting value */
 	if (0 == zcurve_search_2d(ctx))
@@ -512,19 +595,7 @@ zcurve_scan_move_first(zcurve_scan_ctx_t *ctx, const bitKey_t *start_val, bool r
 	ctx->max_offset_ = PageGetMaxOffsetNumber(page);
 	if (ctx->offset_ <= ctx->max_offset_)
 	{
-		itemid = PageGetItemId(page, ctx->offset_);
-		itup = (IndexTuple) PageGetItem(page, itemid);
-		arg = index_getattr(itup, 1, RelationGetDescr(ctx->rel_), &null);
-		ctx->iptr_ = itup->t_tid;
-		ctx->raw_val_ = arg;
-		if (!raw)
-		{
-			bitKey_fromLong(&ctx->cur_val_, arg);
-			itemid = PageGetItemId(page, ctx->max_offset_);
-			itup = (IndexTuple) PageGetItem(page, itemid);
-			arg = index_getattr(itup, 1, RelationGetDescr(ctx->rel_), &null);
-			bitKey_fromLong(&ctx->last_page_val_, arg);
-		}
+		zcurve_scan_fetch(ctx, page, raw);
 		return 1;
 	}
 	else
@@ -559,9 +630,11 @@ zcurve_scan_move_next(zcurve_scan_ctx_t *ctx, bool raw)
 		itup = (IndexTuple) PageGetItem(page, itemid);
 		arg = index_getattr(itup, 1, RelationGetDescr(ctx->rel_), &null);
 		ctx->raw_val_ = arg;
+		ctx->stats_.keys_++;
 		if (!raw)
 		{
 			bitKey_fromLong(&ctx->cur_val_, arg);
+			ctx->stats_.decoded_++;
 		}
 		ctx->iptr_ = itup->t_tid;
 		return 1;
@@ -580,6 +653,7 @@ zcurve_scan_try_move_next(zcurve_scan_ctx_t *ctx, const bitKey_t *check_val)
 		return 1;
 	}
 	/* test first item on the next page */
+	ctx->stats_.probes_++;
 	if (zcurve_scan_step_forward(ctx, true, false))
 	{
 		int ret = (bitKey_cmp(&ctx->next_val_, check_val) <= 0) ? 1 : 0;
@@ -589,6 +663,24 @@ zcurve_scan_try_move_next(zcurve_scan_ctx_t *ctx, const bitKey_t *check_val)
 	return 0;
 }
 
+/* PUBLIC, dst += src */
+void
+zcurve_stats_add(zcurve_stats_t *dst, const zcurve_stats_t *src)
+{
+	dst->subqueries_ += src->subqueries_;
+	dst->splits_ += src->splits_;
+	dst->solid_ += src->solid_;
+	dst->nonsolid_ += src->nonsolid_;
+	dst->descents_ += src->descents_;
+	dst->steps_ += src->steps_;
+	dst->probes_ += src->probes_;
+	dst->pages_ += src->pages_;
+	dst->decoded_ += src->decoded_;
+	dst->keys_ += src->keys_;
+	dst->rejected_ += src->rejected_;
+	dst->rows_ += src->rows_;
+}
+
 /* testing for cursor is active */
 int 
 zcurve_scan_ctx_is_opened(zcurve_scan_ctx_t *ctx)
@@ -12,6 +12,25 @@
 
 #include "bitkey.h"
 
+/* lookup execution counters, cheap enough to be always on */
+typedef struct zcurve_stats_s {
+	int64		subqueries_;	/* subqueries created */
+	int64		splits_;	/* subqueries split */
+	int64		solid_;		/* solid subqueries (intervals) scanned */
+	int64		nonsolid_;	/* not solid ones */
+	int64		descents_;	/* index descents from the root */
+	int64		steps_;		/* right-link steps to the next leaf page */
+	int64		probes_;	/* next leaf page probes at the subquery end */
+	int64		pages_;		/* leaf pages pinned */
+	int64		decoded_;	/* keys decoded from numeric */
+	int64		keys_;		/* index items read */
+	int64		rejected_;	/* keys out of lookup extent */
+	int64		rows_;		/* rows returned */
+} zcurve_stats_t;
+
+/* dst += src */
+extern void zcurve_stats_add(zcurve_stats_t *dst, const zcurve_stats_t *src);
+
 /* the definition struct for zcurve subqery cursor */
 typedef struct zcurve_scan_ctx_s {
 	Relation 	rel_;		/* index tree */
@@ -29,6 +48,8 @@ typedef struct zcurve_scan_ctx_s {
 	Datum		raw_val_;
 
 	BTStack		pstack_;	/* intermediate pages stack to the current page, need for possible interpages step */
+
+	zcurve_stats_t	stats_;		/* cursor counters, descents, steps, probes, pages & decoded keys */
 } zcurve_scan_ctx_t;
 
 
@@ -57,6 +78,9 @@ extern int zcurve_scan_ctx_CTOR(zcurve_scan_ctx_t *ctx, Relation rel, int ncoord
 /* context destructor */
 extern int zcurve_scan_ctx_DTOR(zcurve_scan_ctx_t *ctx);
 
+/* releases the page held, the cursor may be started again by zcurve_scan_move_first */
+extern void zcurve_scan_ctx_release(zcurve_scan_ctx_t *ctx);
+
 /* starting cursor, it may be resterted with new value without calling destructor */
 extern int zcurve_scan_move_first(zcurve_scan_ctx_t *ctx, const bitKey_t *start_val, bool raw);
 
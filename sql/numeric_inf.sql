@@ -0,0 +1,34 @@
+--
+-- zcurve_numeric_ops, abbreviated keys of numeric infinities,
+-- they exist since PostgreSQL 14, numeric_inf_1.out is the output of older servers without them
+--
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS zcurve;
+RESET client_min_messages;
+
+CREATE TABLE zcurve_numeric_inf (v numeric);
+DO $$
+BEGIN
+	INSERT INTO zcurve_numeric_inf VALUES ('-Infinity'), ('Infinity');
+EXCEPTION WHEN invalid_text_representation THEN
+	NULL;
+END
+$$;
+INSERT INTO zcurve_numeric_inf VALUES (-5), (0), (79228162514264337593543950335), ('NaN');
+INSERT INTO zcurve_numeric_inf SELECT g FROM generate_series(-1000, 1000) AS g;
+
+CREATE INDEX zcurve_numeric_inf_idx ON zcurve_numeric_inf (v zcurve_numeric_ops);
+
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+
+-- index order is the same as plain ORDER BY, -Infinity first, NaN after Infinity
+SELECT (SELECT array_agg(v) FROM (SELECT v FROM zcurve_numeric_inf WHERE v IS NOT NULL) AS idx) =
+	(SELECT array_agg(v ORDER BY v) FROM zcurve_numeric_inf) AS same_order;
+
+SELECT count(*) FROM zcurve_numeric_inf WHERE v < -1000;
+SELECT count(*) FROM zcurve_numeric_inf WHERE v > 1000;
+
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+DROP TABLE zcurve_numeric_inf;
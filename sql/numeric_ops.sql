@@ -0,0 +1,27 @@
+--
+-- zcurve_numeric_ops, abbreviated keys of the index build must agree with numeric_cmp,
+-- numeric infinities (PostgreSQL 14+) are checked by numeric_inf
+--
+CREATE EXTENSION zcurve;
+
+CREATE TABLE zcurve_numeric_sort (v numeric);
+INSERT INTO zcurve_numeric_sort VALUES
+	(-5), (-1.5), (0), (0.5), (1), (42),
+	(4294967296), (79228162514264337593543950335), ('NaN');
+INSERT INTO zcurve_numeric_sort SELECT g FROM generate_series(-1000, 1000) AS g;
+
+CREATE INDEX zcurve_numeric_sort_idx ON zcurve_numeric_sort (v zcurve_numeric_ops);
+
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+
+-- index order is the same as plain ORDER BY
+SELECT (SELECT array_agg(v) FROM (SELECT v FROM zcurve_numeric_sort WHERE v IS NOT NULL) AS idx) =
+	(SELECT array_agg(v ORDER BY v) FROM zcurve_numeric_sort) AS same_order;
+
+SELECT count(*) FROM zcurve_numeric_sort WHERE v < 0;
+SELECT count(*) FROM zcurve_numeric_sort WHERE v > 1000;
+
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+DROP TABLE zcurve_numeric_sort;
@@ -0,0 +1,21 @@
+--
+-- zcurve_2d_ranges, keys >= 2^63 wrap to negative bigints in zcurve_val_from_xy
+--
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS zcurve;
+RESET client_min_messages;
+
+-- the greatest key, x = y = 2^32-1
+SELECT zcurve_2d_ranges(-1, -1, -1, -1, 1);
+SELECT zcurve_val_from_xy(-1, -1) <@ ALL (SELECT zcurve_2d_ranges(-1, -1, -1, -1, 1)) AS covered;
+
+-- the greatest bigint key, x = 2^32-1, y = 2^31-1
+SELECT zcurve_2d_ranges(-1, 2147483647, -1, 2147483647, 1);
+SELECT zcurve_val_from_xy(-1, 2147483647) <@ ALL (SELECT zcurve_2d_ranges(-1, 2147483647, -1, 2147483647, 1)) AS covered;
+
+-- y crosses 2^31, the box keys cross 2^63
+SELECT count(*) AS missed
+FROM generate_series(0, 1) AS x, (VALUES (2147483646), (2147483647), (-2147483648), (-2147483647)) AS y(y)
+WHERE NOT EXISTS (SELECT 1 FROM zcurve_2d_ranges(0, 2147483646, 1, -2147483647, 4) AS r WHERE zcurve_val_from_xy(x, y) <@ r);
+SELECT count(*) BETWEEN 2 AND 5 AS split, bool_and(NOT isempty(r)) AS nonempty
+FROM zcurve_2d_ranges(0, 2147483646, 1, -2147483647, 4) AS r;
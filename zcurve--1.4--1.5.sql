@@ -0,0 +1,116 @@
+/* contrib/zcurve/zcurve--1.4--1.5.sql */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION zcurve UPDATE TO '1.5'" to load this file. \quit
+
+-- 3D keys: zcurve_num_from_xyz of coordinates >= 2^24
+-- (negative ones included) gave keys with corrupted bits 8..31 before 1.5,
+-- so indexes on it are to be rebuilt by REINDEX if they hold such coordinates,
+-- lookups over them may miss rows till then
+DO $$
+DECLARE
+	idx regclass;
+BEGIN
+	FOR idx IN
+		SELECT DISTINCT d.objid::regclass
+		FROM pg_depend d JOIN pg_class c ON c.oid = d.objid
+		WHERE d.classid = 'pg_class'::regclass AND c.relkind = 'i'
+			AND d.refclassid = 'pg_proc'::regclass
+			AND d.refobjid = 'zcurve_num_from_xyz(integer, integer, integer)'::regprocedure
+	LOOP
+		RAISE WARNING 'index % on zcurve_num_from_xyz needs REINDEX if it holds coordinates >= 2^24', idx;
+	END LOOP;
+END
+$$;
+
+-- no more than max_ranges z-curve key ranges covering the box, 
+-- may be used with a plain btree index on zcurve_val_from_xy as "... JOIN zcurve_2d_ranges(...) r ON z <@ r",
+-- keys outside the box are to be filtered by the caller,
+-- zcurve_val_from_xy keys >= 2^63 wrap to negative bigints, so intervals are split there and shifted,
+-- ranges are half-open, the one ending at the greatest bigint is unbounded above
+CREATE OR REPLACE FUNCTION zcurve_2d_ranges(integer, integer, integer, integer, max_ranges integer)
+RETURNS SETOF int8range
+AS $$
+SELECT r FROM zcurve_2d_intervals($1, $2, $3, $4, $5) i,
+	LATERAL (VALUES
+		(CASE WHEN i.lo < 9223372036854775808 THEN
+			int8range(i.lo::bigint, CASE WHEN i.hi < 9223372036854775807 THEN (i.hi + 1)::bigint END, '[)') END),
+		(CASE WHEN i.hi >= 9223372036854775808 THEN
+			int8range((greatest(i.lo, 9223372036854775808) - 18446744073709551616)::bigint,
+				(i.hi - 18446744073709551615)::bigint, '[)') END)) AS v(r)
+WHERE r IS NOT NULL
+$$
+LANGUAGE SQL IMMUTABLE STRICT;
+
+-- zcurve_bench takes the dimension from the index by default
+CREATE OR REPLACE FUNCTION zcurve_bench(regclass, integer, integer, integer DEFAULT 0, bigint DEFAULT 0)
+RETURNS __ret_bench
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+-- zcurve_insert_batch reports WAL of this backend, the index size growth is gone
+DROP FUNCTION zcurve_insert_batch(regclass, anyarray, text, text, text);
+-- WAL written by this backend so far, NULLs before PostgreSQL 13
+CREATE FUNCTION zcurve_wal_usage(OUT wal_records bigint, OUT wal_fpi bigint, OUT wal_bytes bigint)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+-- inserts an array of table rows in z-curve order, so consecutive index inserts hit the same leaf pages,
+-- usage: SELECT * FROM zcurve_insert_batch('table_name', array_of_table_rows, 'x', 'y'),
+-- 2D rows are ordered by zcurve_num_from_xy unless the table is indexed by zcurve_val_from_xy only,
+-- its keys >= 2^63 wrap and go first in the index,
+-- returns WAL written by the INSERT in this backend (NULLs before PostgreSQL 13):
+--   inserted    - rows inserted,
+--   wal_records - WAL records, index page splits add a record each on top of a record per index insert,
+--   wal_fpi     - full page images, pages touched for the first time after a checkpoint,
+--   wal_bytes   - WAL bytes
+CREATE FUNCTION zcurve_insert_batch(tbl regclass, rows anyarray, x_col text, y_col text, z_col text DEFAULT NULL)
+RETURNS TABLE(inserted bigint, wal_records bigint, wal_fpi bigint, wal_bytes bigint)
+AS $$
+DECLARE
+	zkey text;
+	by_val boolean;
+	w0 record;
+	w1 record;
+BEGIN
+	IF z_col IS NULL THEN
+		SELECT bool_or(d.refobjid = 'zcurve_val_from_xy(integer, integer)'::regprocedure) AND
+			NOT bool_or(d.refobjid = 'zcurve_num_from_xy(integer, integer)'::regprocedure)
+		INTO by_val
+		FROM pg_index x JOIN pg_depend d ON d.classid = 'pg_class'::regclass AND d.objid = x.indexrelid
+		WHERE x.indrelid = tbl AND d.refclassid = 'pg_proc'::regclass
+			AND d.refobjid IN ('zcurve_val_from_xy(integer, integer)'::regprocedure,
+				'zcurve_num_from_xy(integer, integer)'::regprocedure);
+		zkey := format('%s((r).%I, (r).%I)',
+			CASE WHEN by_val THEN 'zcurve_val_from_xy' ELSE 'zcurve_num_from_xy' END, x_col, y_col);
+	ELSE
+		zkey := format('zcurve_num_from_xyz((r).%I, (r).%I, (r).%I)', x_col, y_col, z_col);
+	END IF;
+
+	w0 := zcurve_wal_usage();
+	EXECUTE format('INSERT INTO %s SELECT (r).* FROM unnest($1) AS r ORDER BY %s', tbl, zkey) USING rows;
+	GET DIAGNOSTICS inserted = ROW_COUNT;
+	w1 := zcurve_wal_usage();
+
+	wal_records := w1.wal_records - w0.wal_records;
+	wal_fpi := w1.wal_fpi - w0.wal_fpi;
+	wal_bytes := w1.wal_bytes - w0.wal_bytes;
+	RETURN NEXT;
+END
+$$ LANGUAGE plpgsql;
+
+-- zcurve_cluster keeps the table readable while the rows are copied
+-- rewrites the table in z-curve order, returns the number of rows,
+-- the rows are copied in key order to a new heap under SHARE lock, so the table stays readable
+-- (writers wait) while they are copied and sorted, no index on the key is needed,
+-- then the lock is upgraded to ACCESS EXCLUSIVE for the last step of CLUSTER: 
+-- the heaps are swapped and the indexes are rebuilt, readers wait for that step only,
+-- 2D rows are ordered by zcurve_val_from_xy keys compared as unsigned, the same as zcurve_num_from_xy,
+-- no triggers fire, indexes, constraints, foreign keys and grants stay as they are,
+-- dead rows are not copied and the old heap is freed at commit, VACUUM is not required,
+-- like CLUSTER it is not MVCC-safe, tables with stored generated columns are not supported
+CREATE OR REPLACE FUNCTION zcurve_cluster(tbl regclass, x_col text, y_col text, z_col text DEFAULT NULL)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
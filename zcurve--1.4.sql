@@ -0,0 +1,406 @@
+/* contrib/zcurve/zcurve--1.4.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION zcurve" to load this file. \quit
+
+
+CREATE DOMAIN zcurve AS pg_catalog.oid;
+
+
+CREATE FUNCTION zcurve_val_from_xy(integer, integer)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_num_from_xy(integer, integer)
+RETURNS numeric
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_num_from_xyz(integer, integer, integer)
+RETURNS numeric
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE __ret_2d_lookup AS (c_tid TID, x integer, y integer);
+CREATE FUNCTION zcurve_2d_lookup(text, integer, integer, integer, integer)
+RETURNS SETOF __ret_2d_lookup
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE __ret_3d_lookup AS (c_tid TID, x integer, y integer, z integer);
+CREATE FUNCTION zcurve_3d_lookup(text, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF __ret_3d_lookup
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_2d_lookup_tidonly(text, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_lookup_tidonly(text, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- regclass overloads, lookup definition is reused between calls within a query
+-- ordering: 'tid' (default) sorts rows by t_tid, 
+-- 'zorder' and 'none' stream them in index order without materialization
+CREATE FUNCTION zcurve_2d_lookup(regclass, integer, integer, integer, integer, ordering text DEFAULT 'tid')
+RETURNS SETOF __ret_2d_lookup
+AS 'MODULE_PATHNAME', 'zcurve_2d_lookup_regclass'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_lookup(regclass, integer, integer, integer, integer, integer, integer, ordering text DEFAULT 'tid')
+RETURNS SETOF __ret_3d_lookup
+AS 'MODULE_PATHNAME', 'zcurve_3d_lookup_regclass'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_2d_lookup_tidonly(regclass, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME', 'zcurve_2d_lookup_tidonly_regclass'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_lookup_tidonly(regclass, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME', 'zcurve_3d_lookup_tidonly_regclass'
+LANGUAGE C STABLE STRICT;
+
+-- dimension-generic API, the dimension is the length of coordinates arrays,
+-- usage: SELECT * FROM zcurve_lookup('index_name', '{0,0}', '{100,100}') AS (c_tid tid, x integer, y integer)
+CREATE FUNCTION zcurve_lookup(regclass, lo integer[], hi integer[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_lookup_tidonly(regclass, lo integer[], hi integer[])
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_encode(integer[])
+RETURNS numeric
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_decode(numeric, ndim integer)
+RETURNS integer[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- t_tids in heap pages order, when the bitmap exceeds work_mem its pages become lossy
+-- and come out with all the possible offsets, so the box must be rechecked on table rows
+CREATE FUNCTION zcurve_2d_lookup_bitmap(regclass, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_lookup_bitmap(regclass, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+-- one row per heap block, offsets and coordinates of its hits go in parallel arrays
+CREATE TYPE __ret_2d_lookup_blocks AS (blkno bigint, offsets smallint[], x integer[], y integer[]);
+CREATE FUNCTION zcurve_2d_lookup_blocks(regclass, integer, integer, integer, integer)
+RETURNS SETOF __ret_2d_lookup_blocks
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE TYPE __ret_3d_lookup_blocks AS (blkno bigint, offsets smallint[], x integer[], y integer[], z integer[]);
+CREATE FUNCTION zcurve_3d_lookup_blocks(regclass, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF __ret_3d_lookup_blocks
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+-- whole table rows in heap blocks order,
+-- usage: SELECT * FROM zcurve_2d_fetch(NULL::table_name, 'index_name', x0, y0, x1, y1)
+CREATE FUNCTION zcurve_2d_fetch(anyelement, regclass, integer, integer, integer, integer)
+RETURNS SETOF anyelement
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE;
+
+CREATE FUNCTION zcurve_3d_fetch(anyelement, regclass, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF anyelement
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE;
+
+-- spatial range delete, rows go in heap blocks order, returns the number of rows deleted,
+-- extra is an optional SQL condition on the table columns, e.g. 'expires_at < now()'
+CREATE FUNCTION zcurve_2d_delete(tbl regclass, idx regclass, integer, integer, integer, integer, extra text DEFAULT NULL)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION zcurve_3d_delete(tbl regclass, idx regclass, integer, integer, integer, integer, integer, integer, extra text DEFAULT NULL)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+-- keyset pagination, rows in z-order after after_key, the last zkey is the next page after_key,
+-- a page ends on a key boundary so it may be a bit longer than page_size
+CREATE TYPE __ret_2d_lookup_page AS (c_tid TID, x integer, y integer, zkey numeric);
+CREATE FUNCTION zcurve_2d_lookup_page(regclass, integer, integer, integer, integer, after_key numeric DEFAULT NULL, page_size integer DEFAULT 500)
+RETURNS SETOF __ret_2d_lookup_page
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE;
+
+CREATE TYPE __ret_3d_lookup_page AS (c_tid TID, x integer, y integer, z integer, zkey numeric);
+CREATE FUNCTION zcurve_3d_lookup_page(regclass, integer, integer, integer, integer, integer, integer, after_key numeric DEFAULT NULL, page_size integer DEFAULT 500)
+RETURNS SETOF __ret_3d_lookup_page
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE;
+
+-- lookup execution counters, the lookup is performed to the end
+CREATE TYPE __ret_lookup_stats AS (subqueries bigint, splits bigint, solid bigint, nonsolid bigint,
+	descents bigint, steps bigint, probes bigint, pages bigint, decoded bigint, rejected bigint, rows bigint,
+	first_row_ms double precision, rest_ms double precision);
+CREATE FUNCTION zcurve_2d_lookup_stats(regclass, integer, integer, integer, integer)
+RETURNS __ret_lookup_stats
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION zcurve_3d_lookup_stats(regclass, integer, integer, integer, integer, integer, integer)
+RETURNS __ret_lookup_stats
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+-- lookup subqueries (compiled intervals, split_bit is NULL then) in execution order, the lookup is performed to the end
+CREATE TYPE __ret_lookup_explain AS (seq integer, lo_key numeric, hi_key numeric, lo integer[], hi integer[],
+	split_bit integer, solid boolean, pages bigint, keys bigint, rows bigint);
+CREATE FUNCTION zcurve_2d_explain(regclass, integer, integer, integer, integer)
+RETURNS SETOF __ret_lookup_explain
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_explain(regclass, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF __ret_lookup_explain
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+-- n random lookups of box_size side run back to back in the server, latencies are in ms,
+-- boxes are spread over the cube covering the greatest index key, the same seed gives the same boxes
+CREATE TYPE __ret_bench AS (queries bigint, rows bigint, total_ms double precision, qps double precision,
+	p50_ms double precision, p95_ms double precision, p99_ms double precision, max_ms double precision,
+	keys_per_row double precision, pages_per_row double precision);
+CREATE FUNCTION zcurve_bench(regclass, integer, integer, integer DEFAULT 2, bigint DEFAULT 0)
+RETURNS __ret_bench
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+-- cluster-wide per-index lookup totals, zcurve must be in shared_preload_libraries
+-- latency_hist buckets are bounded by 0.1, 1, 10, 100, 1000 ms and infinity
+CREATE FUNCTION zcurve_stat_indexes(OUT dbid oid, OUT indexrelid oid,
+	OUT lookups bigint, OUT rows bigint, OUT descents bigint, OUT pages bigint,
+	OUT total_time double precision, OUT latency_hist bigint[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE VIEW zcurve_stat_indexes AS
+	SELECT s.indexrelid, s.indexrelid::regclass AS indexname,
+		s.lookups, s.rows, s.descents, s.pages, s.total_time, s.latency_hist
+	FROM zcurve_stat_indexes() s
+	JOIN pg_database d ON d.oid = s.dbid
+	WHERE d.datname = current_database();
+
+CREATE FUNCTION zcurve_stat_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'zcurve_stat_reset_fn'
+LANGUAGE C VOLATILE STRICT;
+
+REVOKE ALL ON FUNCTION zcurve_stat_reset() FROM PUBLIC;
+
+CREATE TYPE __ret_2d_estimate AS (estimate bigint, margin bigint, pages integer);
+CREATE FUNCTION zcurve_2d_estimate(regclass, integer, integer, integer, integer, integer DEFAULT 64)
+RETURNS __ret_2d_estimate
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE TYPE __ret_zcurve_interval AS (lo numeric, hi numeric, solid boolean);
+CREATE FUNCTION zcurve_2d_intervals(integer, integer, integer, integer, integer)
+RETURNS SETOF __ret_zcurve_interval
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_intervals(integer, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF __ret_zcurve_interval
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- no more than max_ranges z-curve key ranges covering the box, 
+-- may be used with a plain btree index as "... JOIN zcurve_2d_ranges(...) r ON z >= lower(r) AND z < upper(r)",
+-- keys outside the box are to be filtered by the caller
+CREATE FUNCTION zcurve_2d_ranges(integer, integer, integer, integer, max_ranges integer)
+RETURNS SETOF int8range
+AS $$ SELECT int8range(lo::bigint, hi::bigint, '[]') FROM zcurve_2d_intervals($1, $2, $3, $4, $5) $$
+LANGUAGE SQL IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_2d_numranges(integer, integer, integer, integer, max_ranges integer)
+RETURNS SETOF numrange
+AS $$ SELECT numrange(lo, hi, '[]') FROM zcurve_2d_intervals($1, $2, $3, $4, $5) $$
+LANGUAGE SQL IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_ranges(integer, integer, integer, integer, integer, integer, max_ranges integer)
+RETURNS SETOF numrange
+AS $$ SELECT numrange(lo, hi, '[]') FROM zcurve_3d_intervals($1, $2, $3, $4, $5, $6, $7) $$
+LANGUAGE SQL IMMUTABLE STRICT;
+
+-- numeric btree opclass with abbreviated keys, speeds up z-curve index build,
+-- usage: CREATE INDEX ... ON table (zcurve_num_from_xy(x, y) zcurve_numeric_ops)
+CREATE FUNCTION zcurve_numeric_sortsupport(internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS zcurve_numeric_ops
+FOR TYPE numeric USING btree AS
+	OPERATOR	1	< ,
+	OPERATOR	2	<= ,
+	OPERATOR	3	= ,
+	OPERATOR	4	>= ,
+	OPERATOR	5	> ,
+	FUNCTION	1	numeric_cmp(numeric, numeric),
+	FUNCTION	2	zcurve_numeric_sortsupport(internal);
+
+-- builds z-curve index on 2 or 3 table columns with zcurve_numeric_ops
+CREATE FUNCTION zcurve_build_index(tbl regclass, index_name text, VARIADIC cols text[])
+RETURNS void
+AS $$
+DECLARE
+	keyfunc text;
+BEGIN
+	CASE array_length(cols, 1)
+		WHEN 2 THEN keyfunc := 'zcurve_num_from_xy';
+		WHEN 3 THEN keyfunc := 'zcurve_num_from_xyz';
+		ELSE RAISE EXCEPTION 'z-curve index may be built on 2 or 3 columns, not %', array_length(cols, 1);
+	END CASE;
+	EXECUTE format('CREATE INDEX %I ON %s (%s(%s) zcurve_numeric_ops)', index_name, tbl, keyfunc,
+		(SELECT string_agg(quote_ident(c), ', ') FROM unnest(cols) AS c));
+END
+$$ LANGUAGE plpgsql STRICT;
+
+-- rewrites the table in z-curve order by CLUSTER on the z-curve key, returns the number of rows,
+-- a btree index on the key is built for it and dropped afterwards, the clustered index mark is restored,
+-- the table is locked ACCESS EXCLUSIVE till the end of transaction, so it is neither readable nor writable meanwhile,
+-- no triggers fire, indexes, constraints, foreign keys and grants stay as they are,
+-- dead rows are not copied and the old heap is freed at commit, VACUUM is not required
+CREATE FUNCTION zcurve_cluster(tbl regclass, x_col text, y_col text, z_col text DEFAULT NULL)
+RETURNS bigint
+AS $$
+DECLARE
+	zkey text;
+	idxname text;
+	prev_clustered regclass;
+	cnt bigint;
+BEGIN
+	-- 2D keys fit in bigint which is sorted much faster than numeric
+	IF z_col IS NULL THEN
+		zkey := format('zcurve_val_from_xy(%I, %I)', x_col, y_col);
+	ELSE
+		zkey := format('zcurve_num_from_xyz(%I, %I, %I) zcurve_numeric_ops', x_col, y_col, z_col);
+	END IF;
+
+	-- CLUSTER takes this lock anyway, taking it first keeps the index build from waiting in between
+	EXECUTE format('LOCK TABLE %s IN ACCESS EXCLUSIVE MODE', tbl);
+	SELECT indexrelid::regclass INTO prev_clustered FROM pg_index WHERE indrelid = tbl AND indisclustered;
+
+	idxname := format('zcurve_cluster_%s', tbl::oid);
+	EXECUTE format('CREATE INDEX %I ON %s (%s)', idxname, tbl, zkey);
+	EXECUTE format('CLUSTER %s USING %I', tbl, idxname);
+	EXECUTE format('DROP INDEX %I.%I', (SELECT nspname FROM pg_namespace n JOIN pg_class c ON c.relnamespace = n.oid
+		WHERE c.oid = tbl), idxname);
+	IF prev_clustered IS NOT NULL THEN
+		EXECUTE format('ALTER TABLE %s CLUSTER ON %I', tbl,
+			(SELECT relname FROM pg_class WHERE oid = prev_clustered));
+	END IF;
+
+	-- CLUSTER sets reltuples to the number of live rows copied
+	SELECT reltuples::bigint INTO cnt FROM pg_class WHERE oid = tbl;
+	RETURN cnt;
+END
+$$ LANGUAGE plpgsql;
+
+-- inserts an array of table rows in z-curve order, so consecutive index inserts hit the same leaf pages,
+-- usage: SELECT * FROM zcurve_insert_batch('table_name', array_of_table_rows, 'x', 'y'),
+-- returns a row per index of the table (one row with NULL index if there are none):
+--   pages_grown   - the index size growth in pages, splits reuse free pages first, so it is not the number of splits,
+--   inserted      - rows inserted,
+--   wal_bytes_max - WAL written while inserting, an upper bound, WAL of concurrent sessions is counted too
+CREATE FUNCTION zcurve_insert_batch(tbl regclass, rows anyarray, x_col text, y_col text, z_col text DEFAULT NULL)
+RETURNS TABLE(index_name regclass, pages_grown bigint, inserted bigint, wal_bytes_max numeric)
+AS $$
+DECLARE
+	zkey text;
+	lsnfunc text;
+	difffunc text;
+	lsn0 text;
+	lsn1 text;
+	idxs regclass[];
+	pages0 bigint[];
+	i integer;
+BEGIN
+	IF z_col IS NULL THEN
+		zkey := format('zcurve_val_from_xy((r).%I, (r).%I)', x_col, y_col);
+	ELSE
+		zkey := format('zcurve_num_from_xyz((r).%I, (r).%I, (r).%I)', x_col, y_col, z_col);
+	END IF;
+	IF current_setting('server_version_num')::integer >= 100000 THEN
+		lsnfunc := 'pg_current_wal_insert_lsn';
+		difffunc := 'pg_wal_lsn_diff';
+	ELSE
+		lsnfunc := 'pg_current_xlog_insert_location';
+		difffunc := 'pg_xlog_location_diff';
+	END IF;
+
+	SELECT array_agg(x.indexrelid::regclass ORDER BY x.indexrelid),
+		array_agg(pg_relation_size(x.indexrelid) / current_setting('block_size')::bigint ORDER BY x.indexrelid)
+	INTO idxs, pages0 FROM pg_index x WHERE x.indrelid = tbl;
+	EXECUTE format('SELECT %s()::text', lsnfunc) INTO lsn0;
+
+	EXECUTE format('INSERT INTO %s SELECT (r).* FROM unnest($1) AS r ORDER BY %s', tbl, zkey) USING rows;
+	GET DIAGNOSTICS inserted = ROW_COUNT;
+
+	EXECUTE format('SELECT %s()::text', lsnfunc) INTO lsn1;
+	EXECUTE format('SELECT %s(%L, %L)', difffunc, lsn1, lsn0) INTO wal_bytes_max;
+
+	IF idxs IS NULL THEN
+		RETURN NEXT;
+		RETURN;
+	END IF;
+	FOR i IN 1 .. array_length(idxs, 1) LOOP
+		index_name := idxs[i];
+		pages_grown := pg_relation_size(idxs[i]) / current_setting('block_size')::bigint - pages0[i];
+		RETURN NEXT;
+	END LOOP;
+END
+$$ LANGUAGE plpgsql;
+
+-- planner support functions are available since PostgreSQL 12
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::integer >= 120000 THEN
+		EXECUTE 'CREATE FUNCTION zcurve_2d_lookup_support(internal) RETURNS internal '
+			'AS ''MODULE_PATHNAME'' LANGUAGE C STRICT';
+		EXECUTE 'CREATE FUNCTION zcurve_3d_lookup_support(internal) RETURNS internal '
+			'AS ''MODULE_PATHNAME'' LANGUAGE C STRICT';
+		EXECUTE 'ALTER FUNCTION zcurve_2d_lookup(text, integer, integer, integer, integer) '
+			'SUPPORT zcurve_2d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_2d_lookup_tidonly(text, integer, integer, integer, integer) '
+			'SUPPORT zcurve_2d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_3d_lookup(text, integer, integer, integer, integer, integer, integer) '
+			'SUPPORT zcurve_3d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_3d_lookup_tidonly(text, integer, integer, integer, integer, integer, integer) '
+			'SUPPORT zcurve_3d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_2d_lookup(regclass, integer, integer, integer, integer, text) '
+			'SUPPORT zcurve_2d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_2d_lookup_tidonly(regclass, integer, integer, integer, integer) '
+			'SUPPORT zcurve_2d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_3d_lookup(regclass, integer, integer, integer, integer, integer, integer, text) '
+			'SUPPORT zcurve_3d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_3d_lookup_tidonly(regclass, integer, integer, integer, integer, integer, integer) '
+			'SUPPORT zcurve_3d_lookup_support';
+	END IF;
+END
+$$;
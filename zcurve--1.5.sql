@@ -0,0 +1,388 @@
+/* contrib/zcurve/zcurve--1.5.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION zcurve" to load this file. \quit
+
+
+CREATE DOMAIN zcurve AS pg_catalog.oid;
+
+
+CREATE FUNCTION zcurve_val_from_xy(integer, integer)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_num_from_xy(integer, integer)
+RETURNS numeric
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- 3D keys of coordinates >= 2^24 (negative ones included) differ from the ones of 1.4 and earlier,
+-- the old encoder corrupted their bits 8..31, indexes on zcurve_num_from_xyz holding them need REINDEX
+CREATE FUNCTION zcurve_num_from_xyz(integer, integer, integer)
+RETURNS numeric
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE __ret_2d_lookup AS (c_tid TID, x integer, y integer);
+CREATE FUNCTION zcurve_2d_lookup(text, integer, integer, integer, integer)
+RETURNS SETOF __ret_2d_lookup
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE __ret_3d_lookup AS (c_tid TID, x integer, y integer, z integer);
+CREATE FUNCTION zcurve_3d_lookup(text, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF __ret_3d_lookup
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_2d_lookup_tidonly(text, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_lookup_tidonly(text, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- regclass overloads, lookup definition is reused between calls within a query
+-- ordering: 'tid' (default) sorts rows by t_tid, 
+-- 'zorder' and 'none' stream them in index order without materialization
+CREATE FUNCTION zcurve_2d_lookup(regclass, integer, integer, integer, integer, ordering text DEFAULT 'tid')
+RETURNS SETOF __ret_2d_lookup
+AS 'MODULE_PATHNAME', 'zcurve_2d_lookup_regclass'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_lookup(regclass, integer, integer, integer, integer, integer, integer, ordering text DEFAULT 'tid')
+RETURNS SETOF __ret_3d_lookup
+AS 'MODULE_PATHNAME', 'zcurve_3d_lookup_regclass'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_2d_lookup_tidonly(regclass, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME', 'zcurve_2d_lookup_tidonly_regclass'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_lookup_tidonly(regclass, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME', 'zcurve_3d_lookup_tidonly_regclass'
+LANGUAGE C STABLE STRICT;
+
+-- dimension-generic API, the dimension is the length of coordinates arrays,
+-- usage: SELECT * FROM zcurve_lookup('index_name', '{0,0}', '{100,100}') AS (c_tid tid, x integer, y integer)
+CREATE FUNCTION zcurve_lookup(regclass, lo integer[], hi integer[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_lookup_tidonly(regclass, lo integer[], hi integer[])
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_encode(integer[])
+RETURNS numeric
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_decode(numeric, ndim integer)
+RETURNS integer[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- t_tids in heap pages order, when the bitmap exceeds work_mem its pages become lossy
+-- and come out with all the possible offsets, so the box must be rechecked on table rows
+CREATE FUNCTION zcurve_2d_lookup_bitmap(regclass, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_lookup_bitmap(regclass, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF TID
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+-- one row per heap block, offsets and coordinates of its hits go in parallel arrays
+CREATE TYPE __ret_2d_lookup_blocks AS (blkno bigint, offsets smallint[], x integer[], y integer[]);
+CREATE FUNCTION zcurve_2d_lookup_blocks(regclass, integer, integer, integer, integer)
+RETURNS SETOF __ret_2d_lookup_blocks
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE TYPE __ret_3d_lookup_blocks AS (blkno bigint, offsets smallint[], x integer[], y integer[], z integer[]);
+CREATE FUNCTION zcurve_3d_lookup_blocks(regclass, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF __ret_3d_lookup_blocks
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+-- whole table rows in heap blocks order,
+-- usage: SELECT * FROM zcurve_2d_fetch(NULL::table_name, 'index_name', x0, y0, x1, y1)
+CREATE FUNCTION zcurve_2d_fetch(anyelement, regclass, integer, integer, integer, integer)
+RETURNS SETOF anyelement
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE;
+
+CREATE FUNCTION zcurve_3d_fetch(anyelement, regclass, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF anyelement
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE;
+
+-- spatial range delete, rows go in heap blocks order, returns the number of rows deleted,
+-- extra is an optional SQL condition on the table columns, e.g. 'expires_at < now()'
+CREATE FUNCTION zcurve_2d_delete(tbl regclass, idx regclass, integer, integer, integer, integer, extra text DEFAULT NULL)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION zcurve_3d_delete(tbl regclass, idx regclass, integer, integer, integer, integer, integer, integer, extra text DEFAULT NULL)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+-- keyset pagination, rows in z-order after after_key, the last zkey is the next page after_key,
+-- a page ends on a key boundary so it may be a bit longer than page_size
+CREATE TYPE __ret_2d_lookup_page AS (c_tid TID, x integer, y integer, zkey numeric);
+CREATE FUNCTION zcurve_2d_lookup_page(regclass, integer, integer, integer, integer, after_key numeric DEFAULT NULL, page_size integer DEFAULT 500)
+RETURNS SETOF __ret_2d_lookup_page
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE;
+
+CREATE TYPE __ret_3d_lookup_page AS (c_tid TID, x integer, y integer, z integer, zkey numeric);
+CREATE FUNCTION zcurve_3d_lookup_page(regclass, integer, integer, integer, integer, integer, integer, after_key numeric DEFAULT NULL, page_size integer DEFAULT 500)
+RETURNS SETOF __ret_3d_lookup_page
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE;
+
+-- lookup execution counters, the lookup is performed to the end
+CREATE TYPE __ret_lookup_stats AS (subqueries bigint, splits bigint, solid bigint, nonsolid bigint,
+	descents bigint, steps bigint, probes bigint, pages bigint, decoded bigint, rejected bigint, rows bigint,
+	first_row_ms double precision, rest_ms double precision);
+CREATE FUNCTION zcurve_2d_lookup_stats(regclass, integer, integer, integer, integer)
+RETURNS __ret_lookup_stats
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION zcurve_3d_lookup_stats(regclass, integer, integer, integer, integer, integer, integer)
+RETURNS __ret_lookup_stats
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+-- lookup subqueries (compiled intervals, split_bit is NULL then) in execution order, the lookup is performed to the end
+CREATE TYPE __ret_lookup_explain AS (seq integer, lo_key numeric, hi_key numeric, lo integer[], hi integer[],
+	split_bit integer, solid boolean, pages bigint, keys bigint, rows bigint);
+CREATE FUNCTION zcurve_2d_explain(regclass, integer, integer, integer, integer)
+RETURNS SETOF __ret_lookup_explain
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_explain(regclass, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF __ret_lookup_explain
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+-- n random lookups of box_size side run back to back in the server, latencies are in ms,
+-- boxes are spread over the cube covering the greatest index key, the same seed gives the same boxes,
+-- the dimension (2 or 3) is taken from the index key expression unless given, it must match the index
+CREATE TYPE __ret_bench AS (queries bigint, rows bigint, total_ms double precision, qps double precision,
+	p50_ms double precision, p95_ms double precision, p99_ms double precision, max_ms double precision,
+	keys_per_row double precision, pages_per_row double precision);
+CREATE FUNCTION zcurve_bench(regclass, integer, integer, integer DEFAULT 0, bigint DEFAULT 0)
+RETURNS __ret_bench
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+-- cluster-wide per-index lookup totals, zcurve must be in shared_preload_libraries
+-- latency_hist buckets are bounded by 0.1, 1, 10, 100, 1000 ms and infinity
+CREATE FUNCTION zcurve_stat_indexes(OUT dbid oid, OUT indexrelid oid,
+	OUT lookups bigint, OUT rows bigint, OUT descents bigint, OUT pages bigint,
+	OUT total_time double precision, OUT latency_hist bigint[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE VIEW zcurve_stat_indexes AS
+	SELECT s.indexrelid, s.indexrelid::regclass AS indexname,
+		s.lookups, s.rows, s.descents, s.pages, s.total_time, s.latency_hist
+	FROM zcurve_stat_indexes() s
+	JOIN pg_database d ON d.oid = s.dbid
+	WHERE d.datname = current_database();
+
+CREATE FUNCTION zcurve_stat_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'zcurve_stat_reset_fn'
+LANGUAGE C VOLATILE STRICT;
+
+REVOKE ALL ON FUNCTION zcurve_stat_reset() FROM PUBLIC;
+
+CREATE TYPE __ret_2d_estimate AS (estimate bigint, margin bigint, pages integer);
+CREATE FUNCTION zcurve_2d_estimate(regclass, integer, integer, integer, integer, integer DEFAULT 64)
+RETURNS __ret_2d_estimate
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+CREATE TYPE __ret_zcurve_interval AS (lo numeric, hi numeric, solid boolean);
+CREATE FUNCTION zcurve_2d_intervals(integer, integer, integer, integer, integer)
+RETURNS SETOF __ret_zcurve_interval
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_intervals(integer, integer, integer, integer, integer, integer, integer)
+RETURNS SETOF __ret_zcurve_interval
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- no more than max_ranges z-curve key ranges covering the box, 
+-- may be used with a plain btree index on zcurve_val_from_xy as "... JOIN zcurve_2d_ranges(...) r ON z <@ r",
+-- keys outside the box are to be filtered by the caller,
+-- zcurve_val_from_xy keys >= 2^63 wrap to negative bigints, so intervals are split there and shifted,
+-- ranges are half-open, the one ending at the greatest bigint is unbounded above
+CREATE FUNCTION zcurve_2d_ranges(integer, integer, integer, integer, max_ranges integer)
+RETURNS SETOF int8range
+AS $$
+SELECT r FROM zcurve_2d_intervals($1, $2, $3, $4, $5) i,
+	LATERAL (VALUES
+		(CASE WHEN i.lo < 9223372036854775808 THEN
+			int8range(i.lo::bigint, CASE WHEN i.hi < 9223372036854775807 THEN (i.hi + 1)::bigint END, '[)') END),
+		(CASE WHEN i.hi >= 9223372036854775808 THEN
+			int8range((greatest(i.lo, 9223372036854775808) - 18446744073709551616)::bigint,
+				(i.hi - 18446744073709551615)::bigint, '[)') END)) AS v(r)
+WHERE r IS NOT NULL
+$$
+LANGUAGE SQL IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_2d_numranges(integer, integer, integer, integer, max_ranges integer)
+RETURNS SETOF numrange
+AS $$ SELECT numrange(lo, hi, '[]') FROM zcurve_2d_intervals($1, $2, $3, $4, $5) $$
+LANGUAGE SQL IMMUTABLE STRICT;
+
+CREATE FUNCTION zcurve_3d_ranges(integer, integer, integer, integer, integer, integer, max_ranges integer)
+RETURNS SETOF numrange
+AS $$ SELECT numrange(lo, hi, '[]') FROM zcurve_3d_intervals($1, $2, $3, $4, $5, $6, $7) $$
+LANGUAGE SQL IMMUTABLE STRICT;
+
+-- numeric btree opclass with abbreviated keys, speeds up z-curve index build,
+-- usage: CREATE INDEX ... ON table (zcurve_num_from_xy(x, y) zcurve_numeric_ops)
+CREATE FUNCTION zcurve_numeric_sortsupport(internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS zcurve_numeric_ops
+FOR TYPE numeric USING btree AS
+	OPERATOR	1	< ,
+	OPERATOR	2	<= ,
+	OPERATOR	3	= ,
+	OPERATOR	4	>= ,
+	OPERATOR	5	> ,
+	FUNCTION	1	numeric_cmp(numeric, numeric),
+	FUNCTION	2	zcurve_numeric_sortsupport(internal);
+
+-- builds z-curve index on 2 or 3 table columns with zcurve_numeric_ops
+CREATE FUNCTION zcurve_build_index(tbl regclass, index_name text, VARIADIC cols text[])
+RETURNS void
+AS $$
+DECLARE
+	keyfunc text;
+BEGIN
+	CASE array_length(cols, 1)
+		WHEN 2 THEN keyfunc := 'zcurve_num_from_xy';
+		WHEN 3 THEN keyfunc := 'zcurve_num_from_xyz';
+		ELSE RAISE EXCEPTION 'z-curve index may be built on 2 or 3 columns, not %', array_length(cols, 1);
+	END CASE;
+	EXECUTE format('CREATE INDEX %I ON %s (%s(%s) zcurve_numeric_ops)', index_name, tbl, keyfunc,
+		(SELECT string_agg(quote_ident(c), ', ') FROM unnest(cols) AS c));
+END
+$$ LANGUAGE plpgsql STRICT;
+
+-- rewrites the table in z-curve order, returns the number of rows,
+-- the rows are copied in key order to a new heap under SHARE lock, so the table stays readable
+-- (writers wait) while they are copied and sorted, no index on the key is needed,
+-- then the lock is upgraded to ACCESS EXCLUSIVE for the last step of CLUSTER: 
+-- the heaps are swapped and the indexes are rebuilt, readers wait for that step only,
+-- 2D rows are ordered by zcurve_val_from_xy keys compared as unsigned, the same as zcurve_num_from_xy,
+-- no triggers fire, indexes, constraints, foreign keys and grants stay as they are,
+-- dead rows are not copied and the old heap is freed at commit, VACUUM is not required,
+-- like CLUSTER it is not MVCC-safe, tables with stored generated columns are not supported
+CREATE FUNCTION zcurve_cluster(tbl regclass, x_col text, y_col text, z_col text DEFAULT NULL)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+-- WAL written by this backend so far, NULLs before PostgreSQL 13
+CREATE FUNCTION zcurve_wal_usage(OUT wal_records bigint, OUT wal_fpi bigint, OUT wal_bytes bigint)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+-- inserts an array of table rows in z-curve order, so consecutive index inserts hit the same leaf pages,
+-- usage: SELECT * FROM zcurve_insert_batch('table_name', array_of_table_rows, 'x', 'y'),
+-- 2D rows are ordered by zcurve_num_from_xy unless the table is indexed by zcurve_val_from_xy only,
+-- its keys >= 2^63 wrap and go first in the index,
+-- returns WAL written by the INSERT in this backend (NULLs before PostgreSQL 13):
+--   inserted    - rows inserted,
+--   wal_records - WAL records, index page splits add a record each on top of a record per index insert,
+--   wal_fpi     - full page images, pages touched for the first time after a checkpoint,
+--   wal_bytes   - WAL bytes
+CREATE FUNCTION zcurve_insert_batch(tbl regclass, rows anyarray, x_col text, y_col text, z_col text DEFAULT NULL)
+RETURNS TABLE(inserted bigint, wal_records bigint, wal_fpi bigint, wal_bytes bigint)
+AS $$
+DECLARE
+	zkey text;
+	by_val boolean;
+	w0 record;
+	w1 record;
+BEGIN
+	IF z_col IS NULL THEN
+		SELECT bool_or(d.refobjid = 'zcurve_val_from_xy(integer, integer)'::regprocedure) AND
+			NOT bool_or(d.refobjid = 'zcurve_num_from_xy(integer, integer)'::regprocedure)
+		INTO by_val
+		FROM pg_index x JOIN pg_depend d ON d.classid = 'pg_class'::regclass AND d.objid = x.indexrelid
+		WHERE x.indrelid = tbl AND d.refclassid = 'pg_proc'::regclass
+			AND d.refobjid IN ('zcurve_val_from_xy(integer, integer)'::regprocedure,
+				'zcurve_num_from_xy(integer, integer)'::regprocedure);
+		zkey := format('%s((r).%I, (r).%I)',
+			CASE WHEN by_val THEN 'zcurve_val_from_xy' ELSE 'zcurve_num_from_xy' END, x_col, y_col);
+	ELSE
+		zkey := format('zcurve_num_from_xyz((r).%I, (r).%I, (r).%I)', x_col, y_col, z_col);
+	END IF;
+
+	w0 := zcurve_wal_usage();
+	EXECUTE format('INSERT INTO %s SELECT (r).* FROM unnest($1) AS r ORDER BY %s', tbl, zkey) USING rows;
+	GET DIAGNOSTICS inserted = ROW_COUNT;
+	w1 := zcurve_wal_usage();
+
+	wal_records := w1.wal_records - w0.wal_records;
+	wal_fpi := w1.wal_fpi - w0.wal_fpi;
+	wal_bytes := w1.wal_bytes - w0.wal_bytes;
+	RETURN NEXT;
+END
+$$ LANGUAGE plpgsql;
+
+-- planner support functions are available since PostgreSQL 12
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::integer >= 120000 THEN
+		EXECUTE 'CREATE FUNCTION zcurve_2d_lookup_support(internal) RETURNS internal '
+			'AS ''MODULE_PATHNAME'' LANGUAGE C STRICT';
+		EXECUTE 'CREATE FUNCTION zcurve_3d_lookup_support(internal) RETURNS internal '
+			'AS ''MODULE_PATHNAME'' LANGUAGE C STRICT';
+		EXECUTE 'ALTER FUNCTION zcurve_2d_lookup(text, integer, integer, integer, integer) '
+			'SUPPORT zcurve_2d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_2d_lookup_tidonly(text, integer, integer, integer, integer) '
+			'SUPPORT zcurve_2d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_3d_lookup(text, integer, integer, integer, integer, integer, integer) '
+			'SUPPORT zcurve_3d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_3d_lookup_tidonly(text, integer, integer, integer, integer, integer, integer) '
+			'SUPPORT zcurve_3d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_2d_lookup(regclass, integer, integer, integer, integer, text) '
+			'SUPPORT zcurve_2d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_2d_lookup_tidonly(regclass, integer, integer, integer, integer) '
+			'SUPPORT zcurve_2d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_3d_lookup(regclass, integer, integer, integer, integer, integer, integer, text) '
+			'SUPPORT zcurve_3d_lookup_support';
+		EXECUTE 'ALTER FUNCTION zcurve_3d_lookup_tidonly(regclass, integer, integer, integer, integer, integer, integer) '
+			'SUPPORT zcurve_3d_lookup_support';
+	END IF;
+END
+$$;
@@ -0,0 +1,59 @@
+/* contrib/zcurve/zcurve--unpackaged--1.4.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION zcurve FROM unpackaged" to load this file. \quit
+
+ALTER EXTENSION zcurve ADD domain zcurve;
+ALTER EXTENSION zcurve ADD function zcurve_val_from_xy(integer, integer);
+ALTER EXTENSION zcurve ADD function zcurve_num_from_xy(integer, integer);
+ALTER EXTENSION zcurve ADD function zcurve_num_from_xyz(integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_lookup(text, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_lookup(text, integer, integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_lookup_tidonly(text, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_lookup_tidonly(text, integer, integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_lookup(regclass, integer, integer, integer, integer, text);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_lookup(regclass, integer, integer, integer, integer, integer, integer, text);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_lookup_tidonly(regclass, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_lookup_tidonly(regclass, integer, integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_lookup(regclass, integer[], integer[]);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_lookup_tidonly(regclass, integer[], integer[]);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_encode(integer[]);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_decode(numeric, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_lookup_bitmap(regclass, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_lookup_bitmap(regclass, integer, integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_lookup_blocks(regclass, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_lookup_blocks(regclass, integer, integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_fetch(anyelement, regclass, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_fetch(anyelement, regclass, integer, integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_delete(regclass, regclass, integer, integer, integer, integer, text);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_delete(regclass, regclass, integer, integer, integer, integer, integer, integer, text);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_lookup_page(regclass, integer, integer, integer, integer, numeric, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_lookup_page(regclass, integer, integer, integer, integer, integer, integer, numeric, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_lookup_stats(regclass, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_lookup_stats(regclass, integer, integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_explain(regclass, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_explain(regclass, integer, integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_bench(regclass, integer, integer, integer, bigint);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_stat_indexes();
+ALTER EXTENSION zcurve ADD VIEW zcurve_stat_indexes;
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_stat_reset();
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_estimate(regclass, integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_intervals(integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_intervals(integer, integer, integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_ranges(integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_numranges(integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_ranges(integer, integer, integer, integer, integer, integer, integer);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_numeric_sortsupport(internal);
+ALTER EXTENSION zcurve ADD OPERATOR CLASS zcurve_numeric_ops USING btree;
+ALTER EXTENSION zcurve ADD OPERATOR FAMILY zcurve_numeric_ops USING btree;
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_build_index(regclass, text, text[]);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_cluster(regclass, text, text, text);
+ALTER EXTENSION zcurve ADD FUNCTION zcurve_insert_batch(regclass, anyarray, text, text, text);
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::integer >= 120000 THEN
+		ALTER EXTENSION zcurve ADD FUNCTION zcurve_2d_lookup_support(internal);
+		ALTER EXTENSION zcurve ADD FUNCTION zcurve_3d_lookup_support(internal);
+	END IF;
+END
+$$;
@@ -8,36 +8,157 @@
 #include "postgres.h"
 #include "catalog/pg_type.h"
 #include "fmgr.h"
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
 #include "executor/spi.h"
 #include "utils/builtins.h"
 
 #include "funcapi.h"
 #include "utils/rel.h"
+#include "utils/relcache.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
 #include "utils/builtins.h"
 #include "utils/numeric.h"
 #include "utils/lsyscache.h"
+#include "utils/guc.h"
+#include "utils/tuplestore.h"
+#include "utils/tuplesort.h"
+#include "utils/array.h"
+#include "lib/stringinfo.h"
+#include "portability/instr_time.h"
+#include "executor/tuptable.h"
+#include "catalog/pg_operator.h"
+#include "miscadmin.h"
 #include "catalog/namespace.h"
 #if PG_VERSION_NUM >= 90600
 #include "catalog/pg_am.h"
 #endif
 #include "access/nbtree.h"
 #include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/catalog.h"
+#include "catalog/indexing.h"
+#include "commands/cluster.h"
+#include "commands/tablecmds.h"
+#include "storage/lmgr.h"
+#include "utils/acl.h"
+#include "utils/syscache.h"
+#if PG_VERSION_NUM >= 130000
+#include "access/table.h"
+#include "executor/instrument.h"
+#endif
+#if PG_VERSION_NUM >= 120000
+#include "nodes/supportnodes.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/cost.h"
+#endif
 
 #include "sp_tree.h"
 #include "sp_query.h"
-#include "gen_list.h"
-#include "list_sort.h"
+#include "sp_estimate.h"
+#include "sp_result.h"
+#include "sp_bitmap.h"
+#include "sp_fetch.h"
+#include "sp_sort.h"
+#include "sp_stats.h"
 #include "bitkey.h"
 
 #if PG_VERSION_NUM >= 90600
 #define heap_formtuple heap_form_tuple
 #endif
+#if PG_VERSION_NUM >= 120000
+#define CreateTemplateTupleDesc(natts, hasoid) CreateTemplateTupleDesc(natts)
+#endif
+#if PG_VERSION_NUM >= 130000
+#define heap_open table_open
+#define heap_close table_close
+#endif
 
 PG_MODULE_MAGIC;
 
+void _PG_init(void);
+
+/* module load, GUC parameters */
+void
+_PG_init(void)
+{
+	DefineCustomRealVariable("zcurve.descent_cost",
+		"Sets the estimated cost of an index descent for a new lookup subquery.",
+		"Subquery is split only when filtering keys up to its end is estimated to be more expensive. "
+		"Zero means subqueries are always split.",
+		&zcurve_descent_cost,
+		ZCURVE_DEFAULT_DESCENT_COST, 0.0, DBL_MAX,
+		PGC_USERSET, 0,
+		NULL, NULL, NULL);
+
+	DefineCustomRealVariable("zcurve.filter_cost",
+		"Sets the estimated cost of testing one index key against lookup extent.",
+		NULL,
+		&zcurve_filter_cost,
+		ZCURVE_DEFAULT_FILTER_COST, 0.0, DBL_MAX,
+		PGC_USERSET, 0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable("zcurve.max_intervals",
+		"Sets the maximum number of z-curve intervals lookup extent is compiled to before scanning.",
+		"Zero means lookup subqueries are split lazily while scanning.",
+		&zcurve_max_intervals,
+		0, 0, INT_MAX / 2,
+		PGC_USERSET, 0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("zcurve.check_visibility",
+		"Checks found rows against the heap, invisible ones are skipped.",
+		"Rows of a leaf page are checked after the page is released, index items of dead rows are marked LP_DEAD then, "
+		"so the following lookups skip them without heap access. "
+		"LP_DEAD items are skipped by every lookup outside of recovery, whether this is on or off.",
+		&zcurve_check_visibility,
+		false,
+		PGC_USERSET, 0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable("zcurve.intervals_cache_size",
+		"Sets the maximum number of compiled lookups cached in backend.",
+		"Zero disables caching.",
+		&zcurve_intervals_cache_size,
+		ZCURVE_DEFAULT_INTERVALS_CACHE_SIZE, 0, INT_MAX / 2,
+		PGC_USERSET, 0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable("zcurve.prefetch_pages",
+		"Sets the number of heap pages prefetched ahead by zcurve fetch functions.",
+		"Zero disables prefetching.",
+		&zcurve_prefetch_pages,
+		ZCURVE_DEFAULT_PREFETCH_PAGES, 0, 1024,
+		PGC_USERSET, 0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("zcurve.stat_track",
+		"Accumulates per-index lookup totals shown in zcurve_stat_indexes view.",
+		"Takes effect only when zcurve is loaded via shared_preload_libraries.",
+		&zcurve_stat_track,
+		true,
+		PGC_SUSET, 0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable("zcurve.stat_max_indexes",
+		"Sets the maximum number of indexes tracked in zcurve_stat_indexes view.",
+		NULL,
+		&zcurve_stat_max_indexes,
+		ZCURVE_DEFAULT_STAT_MAX_INDEXES, 100, INT_MAX / 2,
+		PGC_POSTMASTER, 0,
+		NULL, NULL, NULL);
+
+	EmitWarningsOnPlaceholders("zcurve");
+
+	/* shared memory is requested here, so after zcurve.stat_max_indexes is known */
+	zcurve_stat_init();
+}
+
 
 PG_FUNCTION_INFO_V1(zcurve_val_from_xy);
 
@@ -113,45 +234,31 @@ indexClose(Relation r)
 	index_close((r), AccessShareLock);
 }
 
-/* resulting item temporarily storing for sorting */
-typedef struct res_item_s {
-	ItemPointerData iptr_;	/* pointer to rable row */
-	uint32		coords_[ZKEY_MAX_COORDS]; /* x y z ... */
-	gen_list_t	link_;  /* next one */
-} res_item_t;
-
-/* in the end we need to sort found index items by t_tid*/
-static int  
-res_item_compare_proc(const void *a, const void *b, const void *arg)
-{
-	const res_item_t *l = (const res_item_t *)a;
-	const res_item_t *r = (const res_item_t *)b;
-
-	if (l->iptr_.ip_blkid.bi_hi != r->iptr_.ip_blkid.bi_hi)
-		return l->iptr_.ip_blkid.bi_hi - r->iptr_.ip_blkid.bi_hi;
-
-	if (l->iptr_.ip_blkid.bi_lo != r->iptr_.ip_blkid.bi_lo)
-		return l->iptr_.ip_blkid.bi_lo - r->iptr_.ip_blkid.bi_lo;
-
-	if (l->iptr_.ip_posid != r->iptr_.ip_posid)
-		return l->iptr_.ip_posid - r->iptr_.ip_posid;
-
-	return 0;
-}
-
 /* SRF-resistent context */
 typedef struct p2d_ctx_s {
 	Relation    	relation_;	/* index tree */
 	spt_query2_t 	qdef_;		/* spatial query definition */
-	gen_list_t 	*result_;	/* head og resulting list */
-	gen_list_t 	*cur_;		/* current item for out */
+	zcurve_result_t	result_;	/* found items, ordered by t_tid before out */
 	int 		cnt_;		/* resulting list length */
 
-	res_item_t	cur_item_;	/* current item in a non-sorting mode */
+	ItemPointerData	cur_iptr_;	/* current item */
 	int 		ret_;		/* the result of the last zcurve call */
 } p2d_ctx_t;
 
 
+/* constructor, index is already opened */
+static void 
+p2d_ctx_t_CTOR_rel(p2d_ctx_t *ptr, Relation rel, const uint32 *min_coords, const uint32 *max_coords, unsigned ncoords)
+{
+	Assert(ptr && rel);
+
+	ptr->relation_ = rel;
+	ptr->cnt_ = 0;
+	zcurve_result_CTOR(&ptr->result_, ncoords);
+
+	spt_query2_CTOR (&ptr->qdef_, ptr->relation_, min_coords, max_coords, ncoords);
+}
+
 /* constructor */
 static void 
 p2d_ctx_t_CTOR(p2d_ctx_t *ptr, const char *relname, const uint32 *min_coords, const uint32 *max_coords, unsigned ncoords)
@@ -163,12 +270,7 @@ p2d_ctx_t_CTOR(p2d_ctx_t *ptr, const char *relname, const uint32 *min_coords, co
 
 	relname_list = stringToQualifiedNameList(relname);
 	relvar = makeRangeVarFromNameList(relname_list);
-	ptr->relation_ = indexOpen(relvar);
-	ptr->cnt_ = 0;
-	ptr->result_ = NULL;
-	ptr->cur_ = NULL;
-
-	spt_query2_CTOR (&ptr->qdef_, ptr->relation_, min_coords, max_coords, ncoords);
+	p2d_ctx_t_CTOR_rel(ptr, indexOpen(relvar), min_coords, max_coords, ncoords);
 }
 
 /* destructor */
@@ -178,11 +280,33 @@ p2d_ctx_t_DTOR(p2d_ctx_t *ptr)
 	Assert(ptr);
 	indexClose(ptr->relation_);
 	ptr->relation_ = NULL;
-	ptr->result_ = NULL;
-	ptr->cur_ = NULL;
+	zcurve_result_DTOR(&ptr->result_);
 	spt_query2_DTOR (&ptr->qdef_);
 }
 
+/* streaming SRF is not read to the end (LIMIT etc), but index cursor must be released anyway */
+static void
+p2d_ctx_t_shutdown(Datum arg)
+{
+	p2d_ctx_t_DTOR((p2d_ctx_t *) DatumGetPointer(arg));
+}
+
+static void
+p2d_ctx_t_register_shutdown(FunctionCallInfo fcinfo, p2d_ctx_t *ptr)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	if (rsinfo && IsA(rsinfo, ReturnSetInfo))
+		RegisterExprContextCallback(rsinfo->econtext, p2d_ctx_t_shutdown, PointerGetDatum(ptr));
+}
+
+static void
+p2d_ctx_t_unregister_shutdown(FunctionCallInfo fcinfo, p2d_ctx_t *ptr)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	if (rsinfo && IsA(rsinfo, ReturnSetInfo))
+		UnregisterExprContextCallback(rsinfo->econtext, p2d_ctx_t_shutdown, PointerGetDatum(ptr));
+}
+
 static Datum
 zcurve_Xd_lookup_tidonly(FunctionCallInfo fcinfo, char *relname, int ndim, uint32 *left_bottom, uint32 *right_upper)
 {
@@ -190,37 +314,31 @@ zcurve_Xd_lookup_tidonly(FunctionCallInfo fcinfo, char *relname, int ndim, uint3
 	FuncCallContext     *funcctx = NULL;
 	p2d_ctx_t 	    *pctx = NULL;
 
-	/* params */
-  	uint32 x0  = left_bottom[0];
-	uint32 y0  = left_bottom[1];
-	uint32 z0  = left_bottom[2];
-	uint32 x1  = right_upper[0];
-	uint32 y1  = right_upper[1];
-	uint32 z1  = right_upper[2];
 	MemoryContext   oldcontext;
 
 	if (SRF_IS_FIRSTCALL())
 	{
-		uint32 coords[ZKEY_MAX_COORDS] = {x0, y0, z0};
-		uint32 coords2[ZKEY_MAX_COORDS] = {x1, y1, z1};
+		uint32 coords[ZKEY_MAX_COORDS];
 		ItemPointerData iptr;
 
 		funcctx = SRF_FIRSTCALL_INIT();
-		funcctx->max_calls = 10000000;
 
 		/* lets start lookup, storing intermediate data in context list */
 		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
 
 		/* prepare lookup context */
 		pctx = (p2d_ctx_t*)palloc(sizeof(p2d_ctx_t));
-		p2d_ctx_t_CTOR(pctx, relname, coords, coords2, 3);
+		p2d_ctx_t_CTOR(pctx, relname, left_bottom, right_upper, ndim);
+		/* only TIDs are returned */
+		pctx->qdef_.wantCoords_ = false;
 
 		funcctx->user_fctx = pctx;
+		p2d_ctx_t_register_shutdown(fcinfo, pctx);
 		/* performing spatial cursor forwarding */
 		pctx->ret_ = spt_query2_moveFirst(&pctx->qdef_, coords, &iptr);
 		if (pctx->ret_)
 		{
-			pctx->cur_item_.iptr_ = iptr;
+			pctx->cur_iptr_ = iptr;
 			pctx->cnt_++;
 		}
 	}
@@ -236,7 +354,7 @@ zcurve_Xd_lookup_tidonly(FunctionCallInfo fcinfo, char *relname, int ndim, uint3
 		pctx->ret_ = spt_query2_moveNext(&pctx->qdef_, coords, &iptr);
 		if (pctx->ret_)
 		{
-			pctx->cur_item_.iptr_ = iptr;
+			pctx->cur_iptr_ = iptr;
 			pctx->cnt_++;
 		}
 	}
@@ -248,11 +366,12 @@ zcurve_Xd_lookup_tidonly(FunctionCallInfo fcinfo, char *relname, int ndim, uint3
 		if (pctx->ret_)
 		{
 			MemoryContextSwitchTo(oldcontext);
-			SRF_RETURN_NEXT(funcctx, PointerGetDatum(&pctx->cur_item_.iptr_));
+			SRF_RETURN_NEXT(funcctx, PointerGetDatum(&pctx->cur_iptr_));
 		}
 		else
 		{
 			/* no more data, free resources and stop lookup */
+			p2d_ctx_t_unregister_shutdown(fcinfo, pctx);
 			p2d_ctx_t_DTOR(pctx);
 		}	
 	}
@@ -261,36 +380,175 @@ zcurve_Xd_lookup_tidonly(FunctionCallInfo fcinfo, char *relname, int ndim, uint3
 	SRF_RETURN_DONE(funcctx);
 }
 
-PG_FUNCTION_INFO_V1(zcurve_2d_lookup);
-Datum
-zcurve_2d_lookup(PG_FUNCTION_ARGS)
+/* 
+   regclass lookups state, lives in fn_extra while the query is running, 
+   so repeated calls (LATERAL joins etc) reuse lookup definition and subqueries memory
+*/
+typedef struct lookup_reuse_s {
+	Oid		relid_;		/* index */
+	int		ncoords_;	/* dimension */
+	bool		inited_;	/* qdef_ is constructed */
+	spt_query2_t 	qdef_;		/* spatial query definition */
+
+	/* streaming ('zorder') output state, value-per-call, funcapi is not used since fn_extra is ours */
+	bool		streaming_;	/* rows are being returned */
+	bool		resumed_;	/* the lookup was suspended at least once */
+	bool		finished_;	/* the lookup is exhausted, the batch is the last one */
+	bool		continued_;	/* the batch ended with the lookup's own one, it goes on with spt_query2_moveNext */
+	Relation	streamRel_;	/* index, open till the end of streaming */
+	TupleDesc	streamDesc_;	/* result row */
+	bitKey_t	lastKey_;	/* the last key of the batch, the lookup resumes after it */
+	int		count_;		/* rows in the batch */
+	int		pos_;		/* the next row to return */
+	int		size_;		/* batch arrays capacity */
+	ItemPointerData	*tids_;		/* batch rows */
+	uint32		*coords_;	/* their coordinates, ncoords_ per row */
+} lookup_reuse_t;
+
+/* the rest of streaming is not required (LIMIT, rescan etc) or it is done, the index is released */
+static void
+lookup_stream_end(lookup_reuse_t *pr)
 {
-	/* SRF stuff */
-	FuncCallContext     *funcctx = NULL;
-	TupleDesc            tupdesc;
-	AttInMetadata       *attinmeta;
-	p2d_ctx_t 	    *pctx = NULL;
+	if (!pr->streaming_)
+		return;
+	spt_query2_closeQuery(&pr->qdef_);
+	index_close(pr->streamRel_, AccessShareLock);
+	pr->streamRel_ = NULL;
+	pr->streaming_ = false;
+}
 
-	/* params */
-	char *relname = text_to_cstring(PG_GETARG_TEXT_PP(0)); 
-  	uint64 x0  = PG_GETARG_INT64(1);
-	uint64 y0  = PG_GETARG_INT64(2);
-	uint64 x1  = PG_GETARG_INT64(3);
-	uint64 y1  = PG_GETARG_INT64(4);
+static void
+lookup_stream_shutdown(Datum arg)
+{
+	lookup_stream_end((lookup_reuse_t *) DatumGetPointer(arg));
+}
 
-	if (SRF_IS_FIRSTCALL())
+/* constructs lookup definition at the first call or just retargets it */
+static spt_query2_t *
+lookup_reuse_prepare(FunctionCallInfo fcinfo, Relation rel, const uint32 *min_coords, const uint32 *max_coords, int ncoords)
+{
+	lookup_reuse_t *pr = (lookup_reuse_t *)fcinfo->flinfo->fn_extra;
+	MemoryContext oldcontext;
+
+	if (NULL == pr)
 	{
-		MemoryContext   oldcontext;
-		funcctx = SRF_FIRSTCALL_INIT();
+		pr = (lookup_reuse_t *)MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt, sizeof(lookup_reuse_t));
+		fcinfo->flinfo->fn_extra = pr;
+	}
+	/* any other lookup at the same call site finishes the unfinished streaming */
+	lookup_stream_end(pr);
+
+	if (pr->inited_ && pr->relid_ == RelationGetRelid(rel) && pr->ncoords_ == ncoords)
+	{
+		spt_query2_reset(&pr->qdef_, rel, min_coords, max_coords);
+		return &pr->qdef_;
+	}
 
-		/* recordset cosists of 3 columns - t_tid & coordinates */
-		tupdesc = CreateTemplateTupleDesc(3, false);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "ctid", TIDOID, -1, 0);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 2, "x", INT4OID, -1, 0);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 3, "y", INT4OID, -1, 0);
+	if (pr->inited_)
+		spt_query2_DTOR(&pr->qdef_);
 
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
-		funcctx->max_calls = 1000000;
+	oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+	spt_query2_CTOR(&pr->qdef_, rel, min_coords, max_coords, ncoords);
+	MemoryContextSwitchTo(oldcontext);
+
+	pr->relid_ = RelationGetRelid(rel);
+	pr->ncoords_ = ncoords;
+	pr->inited_ = true;
+	return &pr->qdef_;
+}
+
+/* 
+   the next batch, matching rows of one index leaf page, 
+   the batch ends on a key boundary, so the rows of a key are never divided between batches,
+   then the page is released and the lookup is suspended till the next batch
+*/
+static void
+lookup_stream_fill(lookup_reuse_t *pr)
+{
+	spt_query2_t	*q = &pr->qdef_;
+	uint32		coords[ZKEY_MAX_COORDS];
+	ItemPointerData iptr;
+	BlockNumber	blkno = InvalidBlockNumber;
+	bitKey_t	key;
+	bool		skip = pr->resumed_ && !pr->continued_;
+	int		ret;
+
+	pr->count_ = pr->pos_ = 0;
+	bitKey_CTOR(&key, pr->ncoords_);
+
+	if (pr->continued_)
+		ret = spt_query2_moveNext(q, coords, &iptr);
+	else
+		ret = pr->resumed_ ? spt_query2_moveFirstFrom(q, &pr->lastKey_, coords, &iptr) : spt_query2_moveFirst(q, coords, &iptr);
+	pr->continued_ = false;
+	while (ret)
+	{
+		BlockNumber curblk = BufferIsValid(q->qctx_.buf_) ? BufferGetBlockNumber(q->qctx_.buf_) : InvalidBlockNumber;
+
+		bitKey_fromCoords(&key, coords, pr->ncoords_);
+		/* rows of the last key went out with the previous batch */
+		if (0 == pr->count_ && skip && bitKey_cmp(&key, &pr->lastKey_) <= 0)
+		{
+			ret = spt_query2_moveNext(q, coords, &iptr);
+			continue;
+		}
+		/* the next leaf page, but the last key may have some more rows */
+		if (pr->count_ > 0 && curblk != blkno && 0 != bitKey_cmp(&key, &pr->lastKey_))
+			break;
+
+		if (pr->count_ == pr->size_)
+		{
+			pr->size_ *= 2;
+			pr->tids_ = (ItemPointerData *)repalloc(pr->tids_, sizeof(ItemPointerData) * pr->size_);
+			pr->coords_ = (uint32 *)repalloc(pr->coords_, sizeof(uint32) * pr->ncoords_ * pr->size_);
+		}
+		pr->tids_[pr->count_] = iptr;
+		memcpy(pr->coords_ + pr->count_ * pr->ncoords_, coords, sizeof(uint32) * pr->ncoords_);
+		if (0 == pr->count_)
+			blkno = curblk;
+		pr->count_++;
+		pr->lastKey_ = key;
+		/* zcurve.check_visibility, the lookup has released the leaf page itself, its batch is used up */
+		if (q->visBatch_ && q->visPos_ >= q->visCount_)
+		{
+			pr->continued_ = true;
+			return;
+		}
+		ret = spt_query2_moveNext(q, coords, &iptr);
+	}
+
+	if (ret)
+	{
+		/* no locks are held while the rows are returned */
+		spt_query2_suspendQuery(q);
+		pr->resumed_ = true;
+	}
+	else
+		pr->finished_ = true;
+}
+
+/* 
+   streaming output, rows come in index (z-curve) order straight from the lookup, 
+   constant memory and the first row without waiting for the rest,
+   matching rows of a leaf page are copied out and the page is released before they are returned
+*/
+static Datum
+zcurve_Xd_lookup_stream(FunctionCallInfo fcinfo, int ndim, uint32 *left_bottom, uint32 *right_upper)
+{
+	ReturnSetInfo	*rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	lookup_reuse_t	*pr;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg("set-valued function called in context that cannot accept a set")));
+
+	pr = (lookup_reuse_t *)fcinfo->flinfo->fn_extra;
+	if (NULL == pr || !pr->streaming_)
+	{
+		MemoryContext	oldcontext;
+		TupleDesc	tupdesc;
+		Relation	rel;
 
 		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
 			ereport(ERROR,
@@ -298,157 +556,346 @@ zcurve_2d_lookup(PG_FUNCTION_ARGS)
 				errmsg("function returning record called in context "
 				"that cannot accept type record")));
 
-		attinmeta = TupleDescGetAttInMetadata(tupdesc);
-		funcctx->attinmeta = attinmeta;
-		/* lets start lookup, storing intermediate data in context list */
+		rel = index_open(PG_GETARG_OID(0), AccessShareLock);
+		lookup_reuse_prepare(fcinfo, rel, left_bottom, right_upper, ndim)->wantCoords_ = true;
+		pr = (lookup_reuse_t *)fcinfo->flinfo->fn_extra;
+
+		oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+		if (pr->streamDesc_)
+			FreeTupleDesc(pr->streamDesc_);
+		pr->streamDesc_ = BlessTupleDesc(CreateTupleDescCopy(tupdesc));
+		if (NULL == pr->tids_)
 		{
-			int 		ret;
-			uint32 coords[ZKEY_MAX_COORDS] = {x0, y0};
-			uint32 coords2[ZKEY_MAX_COORDS] = {x1, y1};
-			ItemPointerData iptr;
+			pr->size_ = 256;
+			pr->tids_ = (ItemPointerData *)palloc(sizeof(ItemPointerData) * pr->size_);
+			pr->coords_ = (uint32 *)palloc(sizeof(uint32) * ZKEY_MAX_COORDS * pr->size_);
+		}
+		MemoryContextSwitchTo(oldcontext);
 
-			/* prepare lookup context */
-			pctx = (p2d_ctx_t*)palloc(sizeof(p2d_ctx_t));
-			p2d_ctx_t_CTOR(pctx, relname, coords, coords2, 2);
+		pr->streamRel_ = rel;
+		pr->streaming_ = true;
+		pr->resumed_ = false;
+		pr->finished_ = false;
+		pr->continued_ = false;
+		pr->count_ = pr->pos_ = 0;
+		RegisterExprContextCallback(rsinfo->econtext, lookup_stream_shutdown, PointerGetDatum(pr));
+	}
 
-			funcctx->user_fctx = pctx;
+	if (pr->pos_ >= pr->count_ && !pr->finished_)
+		lookup_stream_fill(pr);
 
-			/* performing spatial cursor forwarding */
-			ret = spt_query2_moveFirst(&pctx->qdef_, coords, &iptr);
-			while (ret)
-			{
-				res_item_t *pit = (res_item_t *)palloc(sizeof(res_item_t));
-				pit->coords_[0] = coords[0];
-				pit->coords_[1] = coords[1];
-				pit->iptr_ = iptr;
-				pit->link_.data = pit;
-				pit->link_.next = pctx->result_;
-				pctx->result_ = &pit->link_;
-
-				pctx->cnt_++;
-				ret = spt_query2_moveNext(&pctx->qdef_, coords, &iptr);
-			}
-			/* sort temporary data */
-			pctx->result_ = list_sort (pctx->result_,  res_item_compare_proc, NULL);
-			pctx->cur_ = pctx->result_;
-		}
-		MemoryContextSwitchTo(oldcontext);
+	if (pr->pos_ < pr->count_)
+	{
+		Datum	datums[1 + ZKEY_MAX_COORDS];
+		bool	nulls[1 + ZKEY_MAX_COORDS];
+		int	i;
+
+		memset(nulls, 0, sizeof(nulls));
+		datums[0] = PointerGetDatum(&pr->tids_[pr->pos_]);
+		for (i = 0; i < ndim; i++)
+			datums[1 + i] = Int32GetDatum(pr->coords_[pr->pos_ * ndim + i]);
+		pr->pos_++;
+		rsinfo->isDone = ExprMultipleResult;
+		return HeapTupleGetDatum(heap_formtuple(pr->streamDesc_, datums, nulls));
 	}
 
-	PG_FREE_IF_COPY(relname, 0);
-	funcctx = SRF_PERCALL_SETUP();
-	pctx = (p2d_ctx_t *) funcctx->user_fctx;
+	/* no more data, free resources and stop lookup */
+	UnregisterExprContextCallback(rsinfo->econtext, lookup_stream_shutdown, PointerGetDatum(pr));
+	lookup_stream_end(pr);
+	rsinfo->isDone = ExprEndResult;
+	PG_RETURN_NULL();
+}
+
+/* 
+   SFRM_Materialize output preparing, fn_extra is not used by funcapi in this mode, 
+   tupdesc is the result type when not NULL, otherwise it comes from the function definition
+*/
+static Tuplestorestate *
+lookup_materialize_begin_desc(FunctionCallInfo fcinfo, TupleDesc tupdesc)
+{
+	ReturnSetInfo	*rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *tupstore;
+	MemoryContext	oldcontext;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg("materialize mode required, but it is not allowed in this context")));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	/* SETOF TID or composite */
+	if (tupdesc)
+		tupdesc = CreateTupleDescCopy(tupdesc);
+	else if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		tupdesc = CreateTemplateTupleDesc(1, false);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "c_tid", TIDOID, -1, 0);
+	}
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random, false, work_mem);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+	return tupstore;
+}
+
+static Tuplestorestate *
+lookup_materialize_begin(FunctionCallInfo fcinfo, TupleDesc *ptupdesc)
+{
+	ReturnSetInfo	*rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *tupstore = lookup_materialize_begin_desc(fcinfo, NULL);
+
+	*ptupdesc = rsinfo->setDesc;
+	return tupstore;
+}
+
+/* caller accepts SFRM_Materialize output */
+static bool
+lookup_materialize_allowed(FunctionCallInfo fcinfo)
+{
+	ReturnSetInfo	*rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	return (rsinfo && IsA(rsinfo, ReturnSetInfo) && (rsinfo->allowedModes & SFRM_Materialize));
+}
+
+/* external sort of lookup rows by t_tid */
+static Tuplesortstate *
+lookup_sort_begin(TupleDesc tupdesc)
+{
+	AttrNumber	attno = 1;
+	Oid		sortop = TIDLessOperator;
+	Oid		collation = InvalidOid;
+	bool		nullsFirst = false;
+
+#if PG_VERSION_NUM >= 150000
+	return tuplesort_begin_heap(tupdesc, 1, &attno, &sortop, &collation, &nullsFirst, work_mem, NULL, TUPLESORT_NONE);
+#elif PG_VERSION_NUM >= 110000
+	return tuplesort_begin_heap(tupdesc, 1, &attno, &sortop, &collation, &nullsFirst, work_mem, NULL, false);
+#else
+	return tuplesort_begin_heap(tupdesc, 1, &attno, &sortop, &collation, &nullsFirst, work_mem, false);
+#endif
+}
+
+static bool
+lookup_sort_next(Tuplesortstate *sortstate, TupleTableSlot *slot)
+{
+#if PG_VERSION_NUM >= 100000
+	return tuplesort_gettupleslot(sortstate, true, false, slot, NULL);
+#elif PG_VERSION_NUM >= 90600
+	return tuplesort_gettupleslot(sortstate, true, slot, NULL);
+#else
+	return tuplesort_gettupleslot(sortstate, true, slot);
+#endif
+}
 
-	attinmeta = funcctx->attinmeta;
+/* external sort input */
+static void
+lookup_sort_put(Tuplesortstate *sortstate, TupleTableSlot *slot, ItemPointerData *iptr, const uint32 *coords, int ndim)
+{
+	int i;
 
+	ExecClearTuple(slot);
+	slot->tts_values[0] = PointerGetDatum(iptr);
+	slot->tts_isnull[0] = false;
+	for (i = 0; i < ndim; i++)
 	{
-		Datum		datums[3];
-		bool		nulls[3];
-	        HeapTuple    	htuple;
-	        Datum        	result;
-		/* while the end of result list is not reached */
-		if (pctx->cur_)
+		slot->tts_values[1 + i] = Int32GetDatum(coords[i]);
+		slot->tts_isnull[1 + i] = false;
+	}
+	ExecStoreVirtualTuple(slot);
+	tuplesort_puttupleslot(sortstate, slot);
+}
+
+/* 
+   lookup output to tuplestore, rows are ordered by t_tid (tidonly ones are not).
+   Rows are sorted in memory while they fit in work_mem, otherwise external sort takes them, 
+   tuplestore spills to disk beyond work_mem too
+*/
+static void
+lookup_materialize_rows(FunctionCallInfo fcinfo, spt_query2_t *q, int ndim, bool tidonly, TupleDesc rowdesc)
+{
+	ReturnSetInfo	*rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *tupstore = lookup_materialize_begin_desc(fcinfo, rowdesc);
+	TupleDesc	tupdesc = rsinfo->setDesc;
+	Tuplesortstate	*sortstate = NULL;
+	TupleTableSlot	*slot = NULL;
+	zcurve_result_t	res;
+	uint32		coords[ZKEY_MAX_COORDS];
+	ItemPointerData iptr;
+	Datum		datums[1 + ZKEY_MAX_COORDS];
+	bool		nulls[1 + ZKEY_MAX_COORDS];
+	int		ret, i;
+
+	memset(nulls, 0, sizeof(nulls));
+	zcurve_result_CTOR(&res, ndim);
+	q->wantCoords_ = !tidonly;
+
+	/* performing spatial cursor forwarding */
+	ret = spt_query2_moveFirst(q, coords, &iptr);
+	while (ret)
+	{
+		if (tidonly)
+		{
+			datums[0] = PointerGetDatum(&iptr);
+			tuplestore_putvalues(tupstore, tupdesc, datums, nulls);
+		}
+		else if (sortstate)
 		{
-			res_item_t *pit = (res_item_t *)(pctx->cur_->data);
-			datums[0] = PointerGetDatum(&pit->iptr_);
-			datums[1] = Int32GetDatum(pit->coords_[0]);
-			datums[2] = Int32GetDatum(pit->coords_[1]);
-			pctx->cur_ = pctx->cur_->next;
-
-			nulls[0] = false;
-			nulls[1] = false;
-			nulls[2] = false;
-
-			htuple = heap_formtuple(attinmeta->tupdesc, datums, nulls);
-			result = TupleGetDatum(funcctx, htuple);
-			SRF_RETURN_NEXT(funcctx, result);
+			lookup_sort_put(sortstate, slot, &iptr, coords, ndim);
 		}
 		else
 		{
-			/* no more data, free resources and stop lookup */
-			p2d_ctx_t_DTOR(pctx);
-		}	
+			zcurve_result_add(&res, &iptr, coords);
+			if (zcurve_result_memory(&res) > (Size)work_mem * 1024L)
+			{
+				/* too much for in-memory sort, all the rest goes to external one */
+				uint32 idx;
+
+				sortstate = lookup_sort_begin(tupdesc);
+#if PG_VERSION_NUM >= 120000
+				slot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsMinimalTuple);
+#else
+				slot = MakeSingleTupleTableSlot(tupdesc);
+#endif
+				for (idx = 0; idx < res.count_; idx++)
+				{
+					ItemPointerData tid;
+					uint32 c[ZKEY_MAX_COORDS];
+
+					zcurve_result_get(&res, idx, &tid, c);
+					lookup_sort_put(sortstate, slot, &tid, c, ndim);
+				}
+				zcurve_result_DTOR(&res);
+			}
+		}
+		ret = spt_query2_moveNext(q, coords, &iptr);
 	}
-	pfree(pctx);
-	SRF_RETURN_DONE(funcctx);
+
+	if (sortstate)
+	{
+		tuplesort_performsort(sortstate);
+		while (lookup_sort_next(sortstate, slot))
+			tuplestore_puttupleslot(tupstore, slot);
+		tuplesort_end(sortstate);
+		ExecDropSingleTupleTableSlot(slot);
+	}
+	else if (!tidonly)
+	{
+		/* rows go out directly from the buffer */
+		zcurve_result_sort(&res);
+		while (zcurve_result_next(&res, &iptr, coords))
+		{
+			datums[0] = PointerGetDatum(&iptr);
+			for (i = 0; i < ndim; i++)
+				datums[1 + i] = Int32GetDatum(coords[i]);
+			tuplestore_putvalues(tupstore, tupdesc, datums, nulls);
+		}
+	}
+	zcurve_result_DTOR(&res);
+}
+
+/* text lookups when the caller accepts SFRM_Materialize */
+static Datum
+zcurve_Xd_lookup_materialize(FunctionCallInfo fcinfo, char *relname, int ndim, uint32 *left_bottom, uint32 *right_upper)
+{
+	p2d_ctx_t ctx;
+
+	p2d_ctx_t_CTOR(&ctx, relname, left_bottom, right_upper, ndim);
+	lookup_materialize_rows(fcinfo, &ctx.qdef_, ndim, false, NULL);
+	p2d_ctx_t_DTOR(&ctx);
+	return (Datum) 0;
 }
 
+/* regclass lookups */
+static Datum
+zcurve_Xd_lookup_regclass(FunctionCallInfo fcinfo, int ndim, uint32 *left_bottom, uint32 *right_upper, bool tidonly)
+{
+	Oid		relid = PG_GETARG_OID(0);
+	Relation	rel;
 
-PG_FUNCTION_INFO_V1(zcurve_3d_lookup);
-Datum
-zcurve_3d_lookup(PG_FUNCTION_ARGS)
+	/* output order, the rows are sorted by t_tid by default */
+	if (!tidonly)
+	{
+		char *order = text_to_cstring(PG_GETARG_TEXT_PP(1 + 2 * ndim));
+
+		if (0 == strcmp(order, "zorder") || 0 == strcmp(order, "none"))
+			return zcurve_Xd_lookup_stream(fcinfo, ndim, left_bottom, right_upper);
+		if (0 != strcmp(order, "tid"))
+			ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("unknown lookup order \"%s\"", order),
+				errhint("Valid values are \"tid\", \"zorder\" and \"none\".")));
+	}
+
+	rel = index_open(relid, AccessShareLock);
+	lookup_materialize_rows(fcinfo, lookup_reuse_prepare(fcinfo, rel, left_bottom, right_upper, ndim), ndim, tidonly, NULL);
+	index_close(rel, AccessShareLock);
+	return (Datum) 0;
+}
+
+/* text lookups, value-per-call output when the caller does not accept SFRM_Materialize */
+static Datum
+zcurve_Xd_lookup_text(FunctionCallInfo fcinfo, int ndim)
 {
 	/* SRF stuff */
 	FuncCallContext     *funcctx = NULL;
-	TupleDesc            tupdesc;
-	AttInMetadata       *attinmeta;
 	p2d_ctx_t 	    *pctx = NULL;
 
 	/* params */
 	char *relname = text_to_cstring(PG_GETARG_TEXT_PP(0)); 
-  	uint64 x0  = PG_GETARG_INT64(1);
-	uint64 y0  = PG_GETARG_INT64(2);
-	uint64 z0  = PG_GETARG_INT64(3);
-	uint64 x1  = PG_GETARG_INT64(4);
-	uint64 y1  = PG_GETARG_INT64(5);
-	uint64 z1  = PG_GETARG_INT64(6);
+	uint32 coords[ZKEY_MAX_COORDS];
+	uint32 coords2[ZKEY_MAX_COORDS];
+	int i;
+
+	for (i = 0; i < ndim; i++)
+	{
+		coords[i] = PG_GETARG_INT64(1 + i);
+		coords2[i] = PG_GETARG_INT64(1 + ndim + i);
+	}
+
+	/* the whole result at once, when the caller accepts it */
+	if (SRF_IS_FIRSTCALL() && lookup_materialize_allowed(fcinfo))
+		return zcurve_Xd_lookup_materialize(fcinfo, relname, ndim, coords, coords2);
 
 	if (SRF_IS_FIRSTCALL())
 	{
 		MemoryContext   oldcontext;
-		funcctx = SRF_FIRSTCALL_INIT();
-
-		/* recordset cosists of 3 columns - t_tid & coordinates */
-		tupdesc = CreateTemplateTupleDesc(4, false);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "ctid", TIDOID, -1, 0);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 2, "x", INT4OID, -1, 0);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 3, "y", INT4OID, -1, 0);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 4, "z", INT4OID, -1, 0);
+		TupleDesc	tupdesc;
+		int 		ret;
+		ItemPointerData iptr;
 
+		funcctx = SRF_FIRSTCALL_INIT();
 		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
-		funcctx->max_calls = 1000000;
 
+		/* recordset consists of t_tid & coordinates */
 		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
 			ereport(ERROR,
 				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 				errmsg("function returning record called in context "
 				"that cannot accept type record")));
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
 
-		attinmeta = TupleDescGetAttInMetadata(tupdesc);
-		funcctx->attinmeta = attinmeta;
-		/* lets start lookup, storing intermediate data in context list */
-		{
-			int 		ret;
-			uint32 coords[ZKEY_MAX_COORDS] = {x0, y0, z0};
-			uint32 coords2[ZKEY_MAX_COORDS] = {x1, y1, z1};
-			ItemPointerData iptr;
-
-			/* prepare lookup context */
-			pctx = (p2d_ctx_t*)palloc(sizeof(p2d_ctx_t));
-			p2d_ctx_t_CTOR(pctx, relname, coords, coords2, 3);
-
-			funcctx->user_fctx = pctx;
+		/* prepare lookup context */
+		pctx = (p2d_ctx_t*)palloc(sizeof(p2d_ctx_t));
+		p2d_ctx_t_CTOR(pctx, relname, coords, coords2, ndim);
+		funcctx->user_fctx = pctx;
 
-			/* performing spatial cursor forwarding */
-			ret = spt_query2_moveFirst(&pctx->qdef_, coords, &iptr);
-			while (ret)
-			{
-				res_item_t *pit = (res_item_t *)palloc(sizeof(res_item_t));
-				pit->coords_[0] = coords[0];
-				pit->coords_[1] = coords[1];
-				pit->coords_[2] = coords[2];
-				pit->iptr_ = iptr;
-				pit->link_.data = pit;
-				pit->link_.next = pctx->result_;
-				pctx->result_ = &pit->link_;
-
-				pctx->cnt_++;
-				ret = spt_query2_moveNext(&pctx->qdef_, coords, &iptr);
-			}
-			/* sort temporary data */
-			pctx->result_ = list_sort (pctx->result_,  res_item_compare_proc, NULL);
-			pctx->cur_ = pctx->result_;
+		/* lets start lookup, storing intermediate data in the result buffer */
+		ret = spt_query2_moveFirst(&pctx->qdef_, coords, &iptr);
+		while (ret)
+		{
+			zcurve_result_add(&pctx->result_, &iptr, coords);
+			pctx->cnt_++;
+			ret = spt_query2_moveNext(&pctx->qdef_, coords, &iptr);
 		}
+		/* sort temporary data */
+		zcurve_result_sort(&pctx->result_);
 		MemoryContextSwitchTo(oldcontext);
 	}
 
@@ -456,42 +903,39 @@ zcurve_3d_lookup(PG_FUNCTION_ARGS)
 	funcctx = SRF_PERCALL_SETUP();
 	pctx = (p2d_ctx_t *) funcctx->user_fctx;
 
-	attinmeta = funcctx->attinmeta;
-
+	/* while the end of result list is not reached */
+	if (zcurve_result_next(&pctx->result_, &pctx->cur_iptr_, coords))
 	{
-		Datum		datums[4];
-		bool		nulls[4];
-	        HeapTuple    	htuple;
-	        Datum        	result;
-		/* while the end of result list is not reached */
-		if (pctx->cur_)
-		{
-			res_item_t *pit = (res_item_t *)(pctx->cur_->data);
-			datums[0] = PointerGetDatum(&pit->iptr_);
-			datums[1] = Int32GetDatum(pit->coords_[0]);
-			datums[2] = Int32GetDatum(pit->coords_[1]);
-			datums[3] = Int32GetDatum(pit->coords_[2]);
-			pctx->cur_ = pctx->cur_->next;
-
-			nulls[0] = false;
-			nulls[1] = false;
-			nulls[2] = false;
-			nulls[3] = false;
-
-			htuple = heap_formtuple(attinmeta->tupdesc, datums, nulls);
-			result = TupleGetDatum(funcctx, htuple);
-			SRF_RETURN_NEXT(funcctx, result);
-		}
-		else
-		{
-			/* no more data, free resources and stop lookup */
-			p2d_ctx_t_DTOR(pctx);
-		}	
+		Datum		datums[1 + ZKEY_MAX_COORDS];
+		bool		nulls[1 + ZKEY_MAX_COORDS];
+
+		memset(nulls, 0, sizeof(nulls));
+		datums[0] = PointerGetDatum(&pctx->cur_iptr_);
+		for (i = 0; i < ndim; i++)
+			datums[1 + i] = Int32GetDatum(coords[i]);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_formtuple(funcctx->tuple_desc, datums, nulls)));
 	}
+
+	/* no more data, free resources and stop lookup */
+	p2d_ctx_t_DTOR(pctx);
 	pfree(pctx);
 	SRF_RETURN_DONE(funcctx);
 }
 
+PG_FUNCTION_INFO_V1(zcurve_2d_lookup);
+Datum
+zcurve_2d_lookup(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_lookup_text(fcinfo, 2);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_lookup);
+Datum
+zcurve_3d_lookup(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_lookup_text(fcinfo, 3);
+}
+
 PG_FUNCTION_INFO_V1(zcurve_2d_lookup_tidonly);
 Datum
 zcurve_2d_lookup_tidonly(PG_FUNCTION_ARGS)
@@ -527,4 +971,1440 @@ zcurve_3d_lookup_tidonly(PG_FUNCTION_ARGS)
 
 }
 
+PG_FUNCTION_INFO_V1(zcurve_2d_lookup_regclass);
+Datum
+zcurve_2d_lookup_regclass(PG_FUNCTION_ARGS)
+{
+	uint32 coords[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(1), PG_GETARG_INT32(2)};
+	uint32 coords2[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(3), PG_GETARG_INT32(4)};
+
+	return zcurve_Xd_lookup_regclass(fcinfo, 2, coords, coords2, false);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_lookup_regclass);
+Datum
+zcurve_3d_lookup_regclass(PG_FUNCTION_ARGS)
+{
+	uint32 coords[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(1), PG_GETARG_INT32(2), PG_GETARG_INT32(3)};
+	uint32 coords2[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(4), PG_GETARG_INT32(5), PG_GETARG_INT32(6)};
+
+	return zcurve_Xd_lookup_regclass(fcinfo, 3, coords, coords2, false);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_2d_lookup_tidonly_regclass);
+Datum
+zcurve_2d_lookup_tidonly_regclass(PG_FUNCTION_ARGS)
+{
+	uint32 coords[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(1), PG_GETARG_INT32(2)};
+	uint32 coords2[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(3), PG_GETARG_INT32(4)};
+
+	return zcurve_Xd_lookup_regclass(fcinfo, 2, coords, coords2, true);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_lookup_tidonly_regclass);
+Datum
+zcurve_3d_lookup_tidonly_regclass(PG_FUNCTION_ARGS)
+{
+	uint32 coords[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(1), PG_GETARG_INT32(2), PG_GETARG_INT32(3)};
+	uint32 coords2[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(4), PG_GETARG_INT32(5), PG_GETARG_INT32(6)};
+
+	return zcurve_Xd_lookup_regclass(fcinfo, 3, coords, coords2, true);
+}
+
+/* 
+   dimension-generic API, the dimension comes from the coordinates arrays length 
+*/
+static int
+coords_from_array(ArrayType *arr, uint32 *coords)
+{
+	Datum	*elems;
+	bool	*nulls;
+	int	n, i;
+
+	if (ARR_NDIM(arr) > 1)
+		ereport(ERROR,
+			(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+			errmsg("coordinates must be a one-dimensional array")));
+	deconstruct_array(arr, INT4OID, sizeof(int32), true, 'i', &elems, &nulls, &n);
+	if (n < 2 || n > ZKEY_MAX_DIMS)
+		ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("the number of coordinates must be between 2 and %d, not %d", ZKEY_MAX_DIMS, n)));
+	for (i = 0; i < n; i++)
+	{
+		if (nulls[i])
+			ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				errmsg("coordinates must not be NULL")));
+		coords[i] = DatumGetInt32(elems[i]);
+	}
+	pfree(elems);
+	pfree(nulls);
+	return n;
+}
 
+/* lookup box from lo & hi arrays, returns the dimension */
+static int
+box_from_arrays(FunctionCallInfo fcinfo, int argno, uint32 *left_bottom, uint32 *right_upper)
+{
+	int ndim = coords_from_array(PG_GETARG_ARRAYTYPE_P(argno), left_bottom);
+
+	if (coords_from_array(PG_GETARG_ARRAYTYPE_P(argno + 1), right_upper) != ndim)
+		ereport(ERROR,
+			(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+			errmsg("lo and hi must have the same number of coordinates")));
+	return ndim;
+}
+
+/* (c_tid, x, y, z, c4 ...) */
+static TupleDesc
+lookup_row_tupdesc(int ndim)
+{
+	static const char *names[] = {"x", "y", "z"};
+	TupleDesc	tupdesc = CreateTemplateTupleDesc(1 + ndim, false);
+	char		buf[16];
+	int		i;
+
+	TupleDescInitEntry(tupdesc, (AttrNumber) 1, "c_tid", TIDOID, -1, 0);
+	for (i = 0; i < ndim; i++)
+	{
+		if (i < lengthof(names))
+			strcpy(buf, names[i]);
+		else
+			snprintf(buf, sizeof(buf), "c%d", i + 1);
+		TupleDescInitEntry(tupdesc, (AttrNumber) (2 + i), buf, INT4OID, -1, 0);
+	}
+	return BlessTupleDesc(tupdesc);
+}
+
+static Datum
+zcurve_Nd_lookup(FunctionCallInfo fcinfo, bool tidonly)
+{
+	uint32		coords[ZKEY_MAX_COORDS];
+	uint32		coords2[ZKEY_MAX_COORDS];
+	int		ndim = box_from_arrays(fcinfo, 1, coords, coords2);
+	Relation	rel;
+
+	rel = index_open(PG_GETARG_OID(0), AccessShareLock);
+	lookup_materialize_rows(fcinfo, lookup_reuse_prepare(fcinfo, rel, coords, coords2, ndim), ndim, tidonly, 
+				tidonly ? NULL : lookup_row_tupdesc(ndim));
+	index_close(rel, AccessShareLock);
+	return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(zcurve_lookup);
+Datum
+zcurve_lookup(PG_FUNCTION_ARGS)
+{
+	return zcurve_Nd_lookup(fcinfo, false);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_lookup_tidonly);
+Datum
+zcurve_lookup_tidonly(PG_FUNCTION_ARGS)
+{
+	return zcurve_Nd_lookup(fcinfo, true);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_encode);
+Datum
+zcurve_encode(PG_FUNCTION_ARGS)
+{
+	uint32		coords[ZKEY_MAX_COORDS];
+	int		ndim = coords_from_array(PG_GETARG_ARRAYTYPE_P(0), coords);
+	bitKey_t	key;
+
+	bitKey_CTOR(&key, ndim);
+	bitKey_fromCoords(&key, coords, ndim);
+	return bitKey_toLong(&key);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_decode);
+Datum
+zcurve_decode(PG_FUNCTION_ARGS)
+{
+	int		ndim = PG_GETARG_INT32(1);
+	uint32		coords[ZKEY_MAX_COORDS];
+	Datum		elems[ZKEY_MAX_COORDS];
+	bitKey_t	key;
+	int		i;
+
+	if (ndim < 2 || ndim > ZKEY_MAX_DIMS)
+		ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("the number of coordinates must be between 2 and %d, not %d", ZKEY_MAX_DIMS, ndim)));
+
+	bitKey_CTOR(&key, ndim);
+	bitKey_fromLong(&key, PG_GETARG_DATUM(0));
+	bitKey_toCoords(&key, coords, ndim);
+	for (i = 0; i < ndim; i++)
+		elems[i] = Int32GetDatum(coords[i]);
+	PG_RETURN_ARRAYTYPE_P(construct_array(elems, ndim, INT4OID, sizeof(int32), true, 'i'));
+}
+
+/* 
+   regclass lookups in heap pages order through TIDBitmap, 
+   lossy pages (bitmap exceeds work_mem) come out with all the possible offsets, 
+   so the box condition must be rechecked on table rows
+*/
+static Datum
+zcurve_Xd_lookup_bitmap(FunctionCallInfo fcinfo, int ndim, uint32 *left_bottom, uint32 *right_upper)
+{
+	Oid		relid = PG_GETARG_OID(0);
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore = lookup_materialize_begin(fcinfo, &tupdesc);
+	Relation	rel;
+	TIDBitmap	*tbm = zcurve_bitmap_create();
+	TBMIterator	*iterator;
+	TBMIterateResult *tbmres;
+	Datum		datums[1];
+	bool		nulls[1] = {false};
+
+	rel = index_open(relid, AccessShareLock);
+	zcurve_lookup_bitmap(lookup_reuse_prepare(fcinfo, rel, left_bottom, right_upper, ndim), tbm);
+	index_close(rel, AccessShareLock);
+
+	iterator = tbm_begin_iterate(tbm);
+	while ((tbmres = tbm_iterate(iterator)) != NULL)
+	{
+		ItemPointerData iptr;
+		bool	lossy = (tbmres->ntuples < 0);
+		int	n = lossy ? MaxHeapTuplesPerPage : tbmres->ntuples;
+		int	i;
+
+		for (i = 0; i < n; i++)
+		{
+			ItemPointerSet(&iptr, tbmres->blockno, lossy ? (OffsetNumber)(i + 1) : tbmres->offsets[i]);
+			datums[0] = PointerGetDatum(&iptr);
+			tuplestore_putvalues(tupstore, tupdesc, datums, nulls);
+		}
+	}
+	tbm_end_iterate(iterator);
+	tbm_free(tbm);
+	return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(zcurve_2d_lookup_bitmap);
+Datum
+zcurve_2d_lookup_bitmap(PG_FUNCTION_ARGS)
+{
+	uint32 coords[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(1), PG_GETARG_INT32(2)};
+	uint32 coords2[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(3), PG_GETARG_INT32(4)};
+
+	return zcurve_Xd_lookup_bitmap(fcinfo, 2, coords, coords2);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_lookup_bitmap);
+Datum
+zcurve_3d_lookup_bitmap(PG_FUNCTION_ARGS)
+{
+	uint32 coords[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(1), PG_GETARG_INT32(2), PG_GETARG_INT32(3)};
+	uint32 coords2[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(4), PG_GETARG_INT32(5), PG_GETARG_INT32(6)};
+
+	return zcurve_Xd_lookup_bitmap(fcinfo, 3, coords, coords2);
+}
+
+/* 
+   regclass lookups grouped by heap blocks, one row per block with offsets and coordinates arrays, 
+   a block with more than MaxHeapTuplesPerPage hits (duplicate index entries) comes out in several rows
+*/
+static void
+lookup_blocks_put(Tuplestorestate *tupstore, TupleDesc tupdesc, BlockNumber blkno, Datum **arrays, int n, int ndim)
+{
+	Datum	datums[2 + ZKEY_MAX_COORDS];
+	bool	nulls[2 + ZKEY_MAX_COORDS];
+	int	i;
+
+	memset(nulls, 0, sizeof(nulls));
+	datums[0] = Int64GetDatum((int64) blkno);
+	datums[1] = PointerGetDatum(construct_array(arrays[0], n, INT2OID, sizeof(int16), true, 's'));
+	for (i = 0; i < ndim; i++)
+		datums[2 + i] = PointerGetDatum(construct_array(arrays[1 + i], n, INT4OID, sizeof(int32), true, 'i'));
+	tuplestore_putvalues(tupstore, tupdesc, datums, nulls);
+}
+
+static Datum
+zcurve_Xd_lookup_blocks(FunctionCallInfo fcinfo, int ndim, uint32 *left_bottom, uint32 *right_upper)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore = lookup_materialize_begin(fcinfo, &tupdesc);
+	Relation	rel;
+	spt_query2_t	*q;
+	zcurve_result_t	res;
+	ItemPointerData iptr;
+	uint32		coords[ZKEY_MAX_COORDS];
+	Datum		*arrays[1 + ZKEY_MAX_COORDS];
+	BlockNumber	blkno = InvalidBlockNumber;
+	int		n = 0;
+	int		ret, i;
+
+	for (i = 0; i < 1 + ndim; i++)
+		arrays[i] = (Datum *)palloc(MaxHeapTuplesPerPage * sizeof(Datum));
+
+	zcurve_result_CTOR(&res, ndim);
+	rel = index_open(PG_GETARG_OID(0), AccessShareLock);
+	q = lookup_reuse_prepare(fcinfo, rel, left_bottom, right_upper, ndim);
+	q->wantCoords_ = true;
+
+	ret = spt_query2_moveFirst(q, coords, &iptr);
+	while (ret)
+	{
+		zcurve_result_add(&res, &iptr, coords);
+		ret = spt_query2_moveNext(q, coords, &iptr);
+	}
+	index_close(rel, AccessShareLock);
+
+	/* sorted items are just cut by block boundaries */
+	zcurve_result_sort(&res);
+	while (zcurve_result_next(&res, &iptr, coords))
+	{
+		if (n > 0 && (ItemPointerGetBlockNumber(&iptr) != blkno || n == MaxHeapTuplesPerPage))
+		{
+			lookup_blocks_put(tupstore, tupdesc, blkno, arrays, n, ndim);
+			n = 0;
+		}
+		blkno = ItemPointerGetBlockNumber(&iptr);
+		arrays[0][n] = Int16GetDatum((int16) ItemPointerGetOffsetNumber(&iptr));
+		for (i = 0; i < ndim; i++)
+			arrays[1 + i][n] = Int32GetDatum(coords[i]);
+		n++;
+	}
+	if (n > 0)
+		lookup_blocks_put(tupstore, tupdesc, blkno, arrays, n, ndim);
+
+	zcurve_result_DTOR(&res);
+	for (i = 0; i < 1 + ndim; i++)
+		pfree(arrays[i]);
+	return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(zcurve_2d_lookup_blocks);
+Datum
+zcurve_2d_lookup_blocks(PG_FUNCTION_ARGS)
+{
+	uint32 coords[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(1), PG_GETARG_INT32(2)};
+	uint32 coords2[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(3), PG_GETARG_INT32(4)};
+
+	return zcurve_Xd_lookup_blocks(fcinfo, 2, coords, coords2);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_lookup_blocks);
+Datum
+zcurve_3d_lookup_blocks(PG_FUNCTION_ARGS)
+{
+	uint32 coords[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(1), PG_GETARG_INT32(2), PG_GETARG_INT32(3)};
+	uint32 coords2[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(4), PG_GETARG_INT32(5), PG_GETARG_INT32(6)};
+
+	return zcurve_Xd_lookup_blocks(fcinfo, 3, coords, coords2);
+}
+
+/* 
+   whole table rows in heap blocks order, 
+   the first argument is a row of the table (NULL::table) to define the result type
+*/
+static Datum
+zcurve_Xd_fetch(FunctionCallInfo fcinfo, int ndim)
+{
+	Oid		relid = get_typ_typrelid(get_fn_expr_argtype(fcinfo->flinfo, 0));
+	uint32		coords[ZKEY_MAX_COORDS];
+	uint32		coords2[ZKEY_MAX_COORDS];
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	Relation	heapRel, indexRel;
+	TIDBitmap	*tbm;
+	int		i;
+
+	/* the first argument is NULL usually, so function is not strict */
+	for (i = 1; i < 2 + 2 * ndim; i++)
+	{
+		if (PG_ARGISNULL(i))
+			ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				errmsg("index and lookup extent must not be NULL")));
+	}
+	if (!OidIsValid(relid))
+		ereport(ERROR,
+			(errcode(ERRCODE_DATATYPE_MISMATCH),
+			errmsg("the first argument must be of a table row type")));
+
+	for (i = 0; i < ndim; i++)
+	{
+		coords[i] = PG_GETARG_INT32(2 + i);
+		coords2[i] = PG_GETARG_INT32(2 + ndim + i);
+	}
+
+	tupstore = lookup_materialize_begin(fcinfo, &tupdesc);
+	heapRel = heap_open(relid, AccessShareLock);
+	indexRel = index_open(PG_GETARG_OID(1), AccessShareLock);
+	if (indexRel->rd_index->indrelid != relid)
+		ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("index \"%s\" does not belong to table \"%s\"",
+				RelationGetRelationName(indexRel), RelationGetRelationName(heapRel))));
+
+	/* index hits grouped by heap blocks */
+	tbm = zcurve_bitmap_create();
+	zcurve_lookup_bitmap(lookup_reuse_prepare(fcinfo, indexRel, coords, coords2, ndim), tbm);
+	zcurve_fetch_bitmap(heapRel, indexRel, tbm, coords, coords2, ndim, tupstore);
+	tbm_free(tbm);
+
+	index_close(indexRel, AccessShareLock);
+	heap_close(heapRel, AccessShareLock);
+	return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(zcurve_2d_fetch);
+Datum
+zcurve_2d_fetch(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_fetch(fcinfo, 2);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_fetch);
+Datum
+zcurve_3d_fetch(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_fetch(fcinfo, 3);
+}
+
+/* visible rows found for deletion, heap blocks order */
+typedef struct delete_tids_s {
+	ItemPointerData	*tids_;		/* the current batch */
+	int		count_;
+	SPIPlanPtr	plan_;		/* DELETE ... WHERE ctid = ANY($1) */
+	const char	*query_;	/* its text, for error messages */
+	int64		deleted_;	/* rows deleted so far */
+} delete_tids_t;
+
+/* the number of rows deleted by one statement */
+#define ZCURVE_DELETE_BATCH 10000
+
+/* TidScan fetches the batch in t_tid order */
+static void
+delete_tids_flush(delete_tids_t *dt)
+{
+	Datum		*elems;
+	ArrayType	*arr;
+	Datum		values[1];
+	int		j, ret;
+
+	if (0 == dt->count_)
+		return;
+
+	CHECK_FOR_INTERRUPTS();
+	elems = (Datum *) palloc(dt->count_ * sizeof(Datum));
+	for (j = 0; j < dt->count_; j++)
+		elems[j] = PointerGetDatum(&dt->tids_[j]);
+	arr = construct_array(elems, dt->count_, TIDOID, sizeof(ItemPointerData), false, 's');
+	values[0] = PointerGetDatum(arr);
+
+	ret = SPI_execute_plan(dt->plan_, values, NULL, false, 0);
+	if (ret != SPI_OK_DELETE)
+		elog(ERROR, "SPI_execute_plan(\"%s\") failed: %s", dt->query_, SPI_result_code_string(ret));
+	dt->deleted_ += SPI_processed;
+	dt->count_ = 0;
+
+	pfree(arr);
+	pfree(elems);
+}
+
+/* the heap page is not locked here, so the batch is deleted as soon as it is full */
+static void
+delete_tids_add(HeapTuple tuple, void *arg)
+{
+	delete_tids_t *dt = (delete_tids_t *) arg;
+
+	dt->tids_[dt->count_++] = tuple->t_self;
+	if (dt->count_ >= ZCURVE_DELETE_BATCH)
+		delete_tids_flush(dt);
+}
+
+/* 
+   spatial range delete, rows are found by the lookup bitmap in heap blocks order, 
+   HOT chains are resolved to the visible versions under one buffer lock per block,
+   then rows are deleted by batches of t_tids with usual DELETE while the bitmap is still scanned,
+   so triggers & constraints are in effect and memory does not depend on the number of rows,
+   the scan snapshot does not see the deletions, so every row is met once,
+   extra is an optional SQL condition on the table columns
+*/
+static Datum
+zcurve_Xd_delete(FunctionCallInfo fcinfo, int ndim)
+{
+	int		extra_arg = 2 + 2 * ndim;
+	uint32		coords[ZKEY_MAX_COORDS];
+	uint32		coords2[ZKEY_MAX_COORDS];
+	Relation	heapRel, indexRel;
+	TIDBitmap	*tbm;
+	delete_tids_t	dt;
+	StringInfoData	query;
+	Oid		argtype = get_array_type(TIDOID);
+	int		i, ret;
+
+	for (i = 0; i < extra_arg; i++)
+	{
+		if (PG_ARGISNULL(i))
+			ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				errmsg("table, index and lookup extent must not be NULL")));
+	}
+	for (i = 0; i < ndim; i++)
+	{
+		coords[i] = PG_GETARG_INT32(2 + i);
+		coords2[i] = PG_GETARG_INT32(2 + ndim + i);
+	}
+
+	heapRel = heap_open(PG_GETARG_OID(0), RowExclusiveLock);
+	indexRel = index_open(PG_GETARG_OID(1), AccessShareLock);
+	if (indexRel->rd_index->indrelid != RelationGetRelid(heapRel))
+		ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("index \"%s\" does not belong to table \"%s\"",
+				RelationGetRelationName(indexRel), RelationGetRelationName(heapRel))));
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "DELETE FROM %s WHERE ctid = ANY($1)",
+		quote_qualified_identifier(get_namespace_name(RelationGetNamespace(heapRel)), RelationGetRelationName(heapRel)));
+	if (!PG_ARGISNULL(extra_arg))
+		appendStringInfo(&query, " AND (%s)", text_to_cstring(PG_GETARG_TEXT_PP(extra_arg)));
+
+	/* index hits grouped by heap blocks */
+	tbm = zcurve_bitmap_create();
+	zcurve_lookup_bitmap(lookup_reuse_prepare(fcinfo, indexRel, coords, coords2, ndim), tbm);
+
+	dt.tids_ = (ItemPointerData *) palloc(ZCURVE_DELETE_BATCH * sizeof(ItemPointerData));
+	dt.count_ = 0;
+	dt.query_ = query.data;
+	dt.deleted_ = 0;
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed: %s", SPI_result_code_string(ret));
+	dt.plan_ = SPI_prepare(query.data, 1, &argtype);
+	if (NULL == dt.plan_)
+		elog(ERROR, "SPI_prepare(\"%s\") failed", query.data);
+
+	/* visible rows only */
+	zcurve_scan_bitmap(heapRel, indexRel, tbm, coords, coords2, ndim, delete_tids_add, &dt);
+	delete_tids_flush(&dt);
+	SPI_finish();
+	tbm_free(tbm);
+
+	index_close(indexRel, AccessShareLock);
+	/* the lock is kept till the end of transaction */
+	heap_close(heapRel, NoLock);
+
+	pfree(dt.tids_);
+	pfree(query.data);
+	PG_RETURN_INT64(dt.deleted_);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_2d_delete);
+Datum
+zcurve_2d_delete(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_delete(fcinfo, 2);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_delete);
+Datum
+zcurve_3d_delete(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_delete(fcinfo, 3);
+}
+
+/* 
+   rewrites the table in z-curve order, the rows are copied in key order to a new heap under SHARE lock,
+   so the table stays readable (but not writable) while they are copied and sorted,
+   then the lock is upgraded to ACCESS EXCLUSIVE for the last step of CLUSTER: 
+   the heaps are swapped and the indexes are rebuilt, no extra index is needed for the order,
+   like CLUSTER it is not MVCC-safe, returns the number of rows
+*/
+PG_FUNCTION_INFO_V1(zcurve_cluster);
+Datum
+zcurve_cluster(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 90500
+	Oid		relid;
+	Oid		newrelid;
+	Oid		tablespace;
+	char		relpersistence;
+	Relation	rel;
+	Relation	newrel;
+	Relation	classRel;
+	HeapTuple	reltup;
+	Form_pg_class	relform;
+	TransactionId	frozenXid;
+	MultiXactId	cutoffMulti;
+	StringInfoData	query;
+	const char	*fnsp;
+	int64		rows;
+	int		ret, i;
+
+	for (i = 0; i < 3; i++)
+	{
+		if (PG_ARGISNULL(i))
+			ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				errmsg("table and x, y columns must not be NULL")));
+	}
+	relid = PG_GETARG_OID(0);
+
+	/* writers wait till the end of transaction, readers do not */
+	rel = heap_open(relid, ShareLock);
+	if (rel->rd_rel->relkind != RELKIND_RELATION)
+		ereport(ERROR,
+			(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+			errmsg("\"%s\" is not a table", RelationGetRelationName(rel))));
+	if (IsSystemRelation(rel) || RELATION_IS_OTHER_TEMP(rel))
+		ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg("cannot rewrite system catalogs or temporary tables of other sessions")));
+#if PG_VERSION_NUM >= 160000
+	if (!object_ownercheck(RelationRelationId, relid, GetUserId()))
+#else
+	if (!pg_class_ownercheck(relid, GetUserId()))
+#endif
+		ereport(ERROR,
+			(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+			errmsg("must be owner of table %s", RelationGetRelationName(rel))));
+#if PG_VERSION_NUM >= 120000
+	/* stored generated columns can not be copied by INSERT */
+	if (rel->rd_att->constr && rel->rd_att->constr->has_generated_stored)
+		ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg("tables with generated columns are not supported")));
+#endif
+	CheckTableNotInUse(rel, "zcurve_cluster");
+	relpersistence = rel->rd_rel->relpersistence;
+	tablespace = rel->rd_rel->reltablespace;
+
+	/* the same columns, no indexes, constraints or triggers */
+#if PG_VERSION_NUM >= 150000
+	newrelid = make_new_heap(relid, tablespace, rel->rd_rel->relam, relpersistence, ShareLock);
+#else
+	newrelid = make_new_heap(relid, tablespace, relpersistence, ShareLock);
+#endif
+	CommandCounterIncrement();
+
+	/* the functions are taken from the schema of the extension, 2D keys are sorted as unsigned bigint */
+	fnsp = quote_identifier(get_namespace_name(get_func_namespace(fcinfo->flinfo->fn_oid)));
+	initStringInfo(&query);
+	appendStringInfo(&query, "INSERT INTO %s ",
+		quote_qualified_identifier(get_namespace_name(get_rel_namespace(newrelid)), get_rel_name(newrelid)));
+#if PG_VERSION_NUM >= 100000
+	appendStringInfoString(&query, "OVERRIDING SYSTEM VALUE ");
+#endif
+	appendStringInfo(&query, "SELECT * FROM ONLY %s ORDER BY ",
+		quote_qualified_identifier(get_namespace_name(RelationGetNamespace(rel)), RelationGetRelationName(rel)));
+	if (PG_ARGISNULL(3))
+		appendStringInfo(&query, "%s.zcurve_val_from_xy(%s, %s) # (1::bigint << 63)", fnsp,
+			quote_identifier(text_to_cstring(PG_GETARG_TEXT_PP(1))),
+			quote_identifier(text_to_cstring(PG_GETARG_TEXT_PP(2))));
+	else
+		appendStringInfo(&query, "%s.zcurve_num_from_xyz(%s, %s, %s)", fnsp,
+			quote_identifier(text_to_cstring(PG_GETARG_TEXT_PP(1))),
+			quote_identifier(text_to_cstring(PG_GETARG_TEXT_PP(2))),
+			quote_identifier(text_to_cstring(PG_GETARG_TEXT_PP(3))));
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed: %s", SPI_result_code_string(ret));
+	if ((ret = SPI_execute(query.data, false, 0)) != SPI_OK_INSERT)
+		elog(ERROR, "SPI_execute(\"%s\") failed: %s", query.data, SPI_result_code_string(ret));
+	rows = (int64) SPI_processed;
+	SPI_finish();
+
+	/* the new heap statistics go to the table with the swap, as CLUSTER does */
+	newrel = heap_open(newrelid, NoLock);
+	frozenXid = newrel->rd_rel->relfrozenxid;
+	cutoffMulti = newrel->rd_rel->relminmxid;
+	classRel = heap_open(RelationRelationId, RowExclusiveLock);
+	reltup = SearchSysCacheCopy1(RELOID, ObjectIdGetDatum(newrelid));
+	if (!HeapTupleIsValid(reltup))
+		elog(ERROR, "cache lookup failed for relation %u", newrelid);
+	relform = (Form_pg_class) GETSTRUCT(reltup);
+	relform->relpages = RelationGetNumberOfBlocks(newrel);
+	relform->reltuples = (float4) rows;
+#if PG_VERSION_NUM >= 100000
+	CatalogTupleUpdate(classRel, &reltup->t_self, reltup);
+#else
+	simple_heap_update(classRel, &reltup->t_self, reltup);
+	CatalogUpdateIndexes(classRel, reltup);
+#endif
+	heap_freetuple(reltup);
+	heap_close(classRel, RowExclusiveLock);
+	heap_close(newrel, NoLock);
+	CommandCounterIncrement();
+
+	/* readers wait from here till the end of transaction */
+	heap_close(rel, NoLock);
+	LockRelationOid(relid, AccessExclusiveLock);
+	finish_heap_swap(relid, newrelid, false, false, false, true, frozenXid, cutoffMulti, relpersistence);
+
+	pfree(query.data);
+	PG_RETURN_INT64(rows);
+#else
+	ereport(ERROR,
+		(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+		errmsg("zcurve_cluster requires PostgreSQL 9.5 or later")));
+	PG_RETURN_NULL();
+#endif
+}
+
+/* 
+   keyset pagination, rows in z-order starting after after_key (NULL means from the beginning), 
+   a page is not shorter than page_size and ends on a key boundary, 
+   so the last row key is the continuation token for the next page
+*/
+static Datum
+zcurve_Xd_lookup_page(FunctionCallInfo fcinfo, int ndim)
+{
+	int		after_arg = 1 + 2 * ndim;
+	uint32		coords[ZKEY_MAX_COORDS];
+	uint32		coords2[ZKEY_MAX_COORDS];
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	Relation	rel;
+	spt_query2_t	*q;
+	bitKey_t	key, start;
+	Datum		after = (Datum) 0;
+	Datum		last = (Datum) 0;
+	Datum		datums[2 + ZKEY_MAX_COORDS];
+	bool		nulls[2 + ZKEY_MAX_COORDS];
+	ItemPointerData iptr;
+	int64		page_size, cnt = 0;
+	int		ret, i;
+
+	for (i = 0; i < 2 + 2 * ndim; i++)
+	{
+		if (i != after_arg && PG_ARGISNULL(i))
+			ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				errmsg("index, lookup extent and page size must not be NULL")));
+	}
+	for (i = 0; i < ndim; i++)
+	{
+		coords[i] = PG_GETARG_INT32(1 + i);
+		coords2[i] = PG_GETARG_INT32(1 + ndim + i);
+	}
+	page_size = PG_GETARG_INT32(after_arg + 1);
+	if (page_size <= 0)
+		ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("page size must be positive")));
+
+	bitKey_CTOR(&key, ndim);
+	bitKey_CTOR(&start, ndim);
+	if (!PG_ARGISNULL(after_arg))
+	{
+		after = PG_GETARG_DATUM(after_arg);
+		bitKey_fromLong(&start, after);
+	}
+
+	tupstore = lookup_materialize_begin(fcinfo, &tupdesc);
+	memset(nulls, 0, sizeof(nulls));
+
+	rel = index_open(PG_GETARG_OID(0), AccessShareLock);
+	q = lookup_reuse_prepare(fcinfo, rel, coords, coords2, ndim);
+	q->wantCoords_ = true;
+
+	ret = spt_query2_moveFirstFrom(q, PG_ARGISNULL(after_arg) ? NULL : &start, coords, &iptr);
+	while (ret)
+	{
+		Datum	cur;
+
+		bitKey_fromCoords(&key, coords, ndim);
+		cur = bitKey_toLong(&key);
+
+		/* rows of after_key were returned with the previous page */
+		if (!PG_ARGISNULL(after_arg) && 0 == DatumGetInt32(DirectFunctionCall2(numeric_cmp, cur, after)))
+		{
+			ret = spt_query2_moveNext(q, coords, &iptr);
+			continue;
+		}
+		/* the page is full, but the last key may have some more rows */
+		if (cnt >= page_size && 0 != DatumGetInt32(DirectFunctionCall2(numeric_cmp, cur, last)))
+			break;
+
+		datums[0] = PointerGetDatum(&iptr);
+		for (i = 0; i < ndim; i++)
+			datums[1 + i] = Int32GetDatum(coords[i]);
+		datums[1 + ndim] = cur;
+		tuplestore_putvalues(tupstore, tupdesc, datums, nulls);
+
+		last = cur;
+		cnt++;
+		ret = spt_query2_moveNext(q, coords, &iptr);
+	}
+	/* the rest of lookup is not required */
+	spt_query2_closeQuery(q);
+	index_close(rel, AccessShareLock);
+	return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(zcurve_2d_lookup_page);
+Datum
+zcurve_2d_lookup_page(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_lookup_page(fcinfo, 2);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_lookup_page);
+Datum
+zcurve_3d_lookup_page(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_lookup_page(fcinfo, 3);
+}
+
+/* btree opclass zcurve_numeric_ops, abbreviated keys for index build */
+PG_FUNCTION_INFO_V1(zcurve_numeric_sortsupport);
+Datum
+zcurve_numeric_sortsupport(PG_FUNCTION_ARGS)
+{
+	zcurve_sortsupport_init((SortSupport) PG_GETARG_POINTER(0));
+	PG_RETURN_VOID();
+}
+
+/* 
+   runs the lookup to the end and returns its counters, 
+   time is split to the first row (splitting or intervals compiling & the first descent) and the rest
+*/
+static Datum
+zcurve_Xd_lookup_stats(FunctionCallInfo fcinfo, int ndim)
+{
+	uint32		coords[ZKEY_MAX_COORDS];
+	uint32		coords2[ZKEY_MAX_COORDS];
+	TupleDesc	tupdesc;
+	Relation	rel;
+	spt_query2_t	*q;
+	ItemPointerData iptr;
+	instr_time	start, first, end;
+	Datum		values[13];
+	bool		nulls[13];
+	int		ret, i;
+
+	for (i = 0; i < ndim; i++)
+	{
+		coords[i] = PG_GETARG_INT32(1 + i);
+		coords2[i] = PG_GETARG_INT32(1 + ndim + i);
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg("function returning record called in context "
+			"that cannot accept type record")));
+
+	rel = index_open(PG_GETARG_OID(0), AccessShareLock);
+	q = lookup_reuse_prepare(fcinfo, rel, coords, coords2, ndim);
+	q->wantCoords_ = true;
+
+	INSTR_TIME_SET_CURRENT(start);
+	ret = spt_query2_moveFirst(q, coords, &iptr);
+	INSTR_TIME_SET_CURRENT(first);
+	while (ret)
+		ret = spt_query2_moveNext(q, coords, &iptr);
+	INSTR_TIME_SET_CURRENT(end);
+	index_close(rel, AccessShareLock);
+
+	INSTR_TIME_SUBTRACT(end, first);
+	INSTR_TIME_SUBTRACT(first, start);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum(q->stats_.subqueries_);
+	values[1] = Int64GetDatum(q->stats_.splits_);
+	values[2] = Int64GetDatum(q->stats_.solid_);
+	values[3] = Int64GetDatum(q->stats_.nonsolid_);
+	values[4] = Int64GetDatum(q->stats_.descents_);
+	values[5] = Int64GetDatum(q->stats_.steps_);
+	values[6] = Int64GetDatum(q->stats_.probes_);
+	values[7] = Int64GetDatum(q->stats_.pages_);
+	values[8] = Int64GetDatum(q->stats_.decoded_);
+	values[9] = Int64GetDatum(q->stats_.rejected_);
+	values[10] = Int64GetDatum(q->stats_.rows_);
+	values[11] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(first));
+	values[12] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(end));
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_formtuple(BlessTupleDesc(tupdesc), values, nulls)));
+}
+
+PG_FUNCTION_INFO_V1(zcurve_2d_lookup_stats);
+Datum
+zcurve_2d_lookup_stats(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_lookup_stats(fcinfo, 2);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_lookup_stats);
+Datum
+zcurve_3d_lookup_stats(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_lookup_stats(fcinfo, 3);
+}
+
+/* 
+   runs the lookup to the end and returns its subqueries (compiled intervals) in execution order 
+   with the work done for each one
+*/
+static Datum
+zcurve_Xd_explain(FunctionCallInfo fcinfo, int ndim)
+{
+	uint32		coords[ZKEY_MAX_COORDS];
+	uint32		coords2[ZKEY_MAX_COORDS];
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore = lookup_materialize_begin(fcinfo, &tupdesc);
+	Relation	rel;
+	spt_query2_t	q;
+	zcurve_trace_t	trace;
+	ItemPointerData iptr;
+	int		ret, i, j;
+
+	for (i = 0; i < ndim; i++)
+	{
+		coords[i] = PG_GETARG_INT32(1 + i);
+		coords2[i] = PG_GETARG_INT32(1 + ndim + i);
+	}
+
+	rel = index_open(PG_GETARG_OID(0), AccessShareLock);
+	spt_query2_CTOR(&q, rel, coords, coords2, ndim);
+	zcurve_trace_CTOR(&trace);
+	q.trace_ = &trace;
+
+	ret = spt_query2_moveFirst(&q, coords, &iptr);
+	while (ret)
+		ret = spt_query2_moveNext(&q, coords, &iptr);
+
+	spt_query2_DTOR(&q);
+	index_close(rel, AccessShareLock);
+
+	for (i = 0; i < trace.count_; i++)
+	{
+		const zcurve_trace_item_t *item = &trace.items_[i];
+		Datum	lo[ZKEY_MAX_COORDS];
+		Datum	hi[ZKEY_MAX_COORDS];
+		Datum	datums[10];
+		bool	nulls[10] = {false, false, false, false, false, false, false, false, false, false};
+
+		bitKey_toCoords(&item->lowKey_, coords, ZKEY_MAX_COORDS);
+		bitKey_toCoords(&item->highKey_, coords2, ZKEY_MAX_COORDS);
+		for (j = 0; j < ndim; j++)
+		{
+			lo[j] = Int32GetDatum((int32)coords[j]);
+			hi[j] = Int32GetDatum((int32)coords2[j]);
+		}
+
+		datums[0] = Int32GetDatum(i + 1);
+		datums[1] = bitKey_toLong(&item->lowKey_);
+		datums[2] = bitKey_toLong(&item->highKey_);
+		datums[3] = PointerGetDatum(construct_array(lo, ndim, INT4OID, sizeof(int32), true, 'i'));
+		datums[4] = PointerGetDatum(construct_array(hi, ndim, INT4OID, sizeof(int32), true, 'i'));
+		datums[5] = Int32GetDatum(item->splitBit_);
+		nulls[5] = (item->splitBit_ < 0);
+		datums[6] = BoolGetDatum(item->solid_);
+		datums[7] = Int64GetDatum(item->pages_);
+		datums[8] = Int64GetDatum(item->keys_);
+		datums[9] = Int64GetDatum(item->rows_);
+		tuplestore_putvalues(tupstore, tupdesc, datums, nulls);
+	}
+	zcurve_trace_DTOR(&trace);
+	return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(zcurve_2d_explain);
+Datum
+zcurve_2d_explain(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_explain(fcinfo, 2);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_explain);
+Datum
+zcurve_3d_explain(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_explain(fcinfo, 3);
+}
+
+/* splitmix64, the same boxes for the same seed on every server version */
+static uint64
+bench_random(uint64 *state)
+{
+	uint64 z = (*state += UINT64CONST(0x9E3779B97F4A7C15));
+	z = (z ^ (z >> 30)) * UINT64CONST(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64CONST(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
+
+/* random box of box_size side inside [0, side) cube */
+static void
+bench_box(uint64 *state, uint64 side, uint32 box_size, int ndim, uint32 *lo, uint32 *hi)
+{
+	uint64	span = (side > box_size) ? side - box_size : 0;
+	int	i;
+
+	for (i = 0; i < ndim; i++)
+	{
+		lo[i] = (uint32)(bench_random(state) % (span + 1));
+		hi[i] = lo[i] + box_size - 1;
+	}
+}
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+	return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+/* nearest rank percentile of sorted values */
+static double
+bench_percentile(const double *vals, int n, double p)
+{
+	int i = (int)ceil(p * n) - 1;
+	return vals[(i < 0) ? 0 : i];
+}
+
+/* 
+   index dimension by its key expression, the number of zcurve_xxx_from_xxx arguments,
+   0 if it can not be told (a plain column holding keys)
+*/
+static int
+zcurve_index_ndim(Relation rel)
+{
+	List	*exprs;
+	Node	*expr;
+	int	ndim;
+
+	if (rel->rd_index->indnatts < 1 || 0 != rel->rd_index->indkey.values[0])
+		return 0;
+	exprs = RelationGetIndexExpressions(rel);
+	if (NIL == exprs)
+		return 0;
+	expr = (Node *) linitial(exprs);
+	if (!IsA(expr, FuncExpr))
+		return 0;
+	ndim = list_length(((FuncExpr *) expr)->args);
+	return (ndim >= 2 && ndim <= ZKEY_MAX_DIMS) ? ndim : 0;
+}
+
+/* 
+   runs n random lookups of box_size side back to back, 
+   boxes are spread over the cube covering the greatest index key,
+   zero ndim means the dimension of the index key expression
+*/
+PG_FUNCTION_INFO_V1(zcurve_bench);
+Datum
+zcurve_bench(PG_FUNCTION_ARGS)
+{
+	int32		nqueries = PG_GETARG_INT32(1);
+	int32		box_size = PG_GETARG_INT32(2);
+	int32		ndim = PG_GETARG_INT32(3);
+	int		idxdim;
+	uint64		state = (uint64)PG_GETARG_INT64(4);
+	uint32		lo[ZKEY_MAX_COORDS];
+	uint32		hi[ZKEY_MAX_COORDS];
+	uint32		coords[ZKEY_MAX_COORDS];
+	uint64		side = UINT64CONST(1) << 31;
+	TupleDesc	tupdesc;
+	Relation	rel;
+	spt_query2_t	q;
+	ItemPointerData iptr;
+	MemoryContext	benchcxt, oldcontext;
+	double		*lat;
+	double		total = 0.;
+	int64		rows = 0, keys = 0, pages = 0;
+	Datum		values[10];
+	bool		nulls[10];
+	int		ret, i;
+
+	if (nqueries <= 0 || box_size <= 0)
+		ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("the number of queries and box size must be positive")));
+	if (0 != ndim && (ndim < 2 || ndim > ZKEY_MAX_DIMS))
+		ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("the number of coordinates must be between 2 and %d, not %d", ZKEY_MAX_DIMS, ndim)));
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg("function returning record called in context "
+			"that cannot accept type record")));
+
+	rel = index_open(PG_GETARG_OID(0), AccessShareLock);
+
+	/* keys of another dimension would be decoded the wrong way */
+	idxdim = zcurve_index_ndim(rel);
+	if (0 == ndim && 0 == idxdim)
+		ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("the dimension of index \"%s\" can not be told by its key, pass it explicitly",
+				RelationGetRelationName(rel))));
+	if (0 != idxdim && 0 != ndim && idxdim != ndim)
+		ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("index \"%s\" is %dD, not %dD", RelationGetRelationName(rel), idxdim, ndim)));
+	if (0 == ndim)
+		ndim = idxdim;
+
+	/* the smallest power of 2 cube holding the greatest key */
+	if (zcurve_estimate_domain(rel, ndim, coords))
+	{
+		uint32 maxc = 0;
+		for (i = 0; i < ndim; i++)
+			maxc = Max(maxc, coords[i]);
+		for (side = 1; side <= maxc && side < (UINT64CONST(1) << 31); side <<= 1)
+			;
+	}
+
+	lat = (double *)palloc(sizeof(double) * nqueries);
+	benchcxt = AllocSetContextCreate(CurrentMemoryContext,
+		"zcurve bench",
+		ALLOCSET_DEFAULT_MINSIZE,
+		ALLOCSET_DEFAULT_INITSIZE,
+		ALLOCSET_DEFAULT_MAXSIZE);
+
+	bench_box(&state, side, box_size, ndim, lo, hi);
+	spt_query2_CTOR(&q, rel, lo, hi, ndim);
+	q.wantCoords_ = true;
+
+	for (i = 0; i < nqueries; i++)
+	{
+		instr_time start, end;
+
+		if (i > 0)
+		{
+			bench_box(&state, side, box_size, ndim, lo, hi);
+			spt_query2_reset(&q, rel, lo, hi);
+		}
+
+		oldcontext = MemoryContextSwitchTo(benchcxt);
+		INSTR_TIME_SET_CURRENT(start);
+		ret = spt_query2_moveFirst(&q, coords, &iptr);
+		while (ret)
+			ret = spt_query2_moveNext(&q, coords, &iptr);
+		INSTR_TIME_SET_CURRENT(end);
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(benchcxt);
+
+		INSTR_TIME_SUBTRACT(end, start);
+		lat[i] = INSTR_TIME_GET_MILLISEC(end);
+		total += lat[i];
+		rows += q.stats_.rows_;
+		keys += q.stats_.keys_;
+		pages += q.stats_.pages_;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	spt_query2_DTOR(&q);
+	MemoryContextDelete(benchcxt);
+	index_close(rel, AccessShareLock);
+
+	qsort(lat, nqueries, sizeof(double), bench_cmp);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum(nqueries);
+	values[1] = Int64GetDatum(rows);
+	values[2] = Float8GetDatum(total);
+	values[3] = Float8GetDatum((total > 0.) ? nqueries * 1000. / total : 0.);
+	values[4] = Float8GetDatum(bench_percentile(lat, nqueries, 0.50));
+	values[5] = Float8GetDatum(bench_percentile(lat, nqueries, 0.95));
+	values[6] = Float8GetDatum(bench_percentile(lat, nqueries, 0.99));
+	values[7] = Float8GetDatum(lat[nqueries - 1]);
+	values[8] = Float8GetDatum(rows ? (double)keys / rows : 0.);
+	values[9] = Float8GetDatum(rows ? (double)pages / rows : 0.);
+	nulls[8] = nulls[9] = (0 == rows);
+	pfree(lat);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_formtuple(BlessTupleDesc(tupdesc), values, nulls)));
+}
+
+/* cluster-wide per-index totals, see sp_stats.c */
+PG_FUNCTION_INFO_V1(zcurve_stat_indexes);
+Datum
+zcurve_stat_indexes(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore = lookup_materialize_begin(fcinfo, &tupdesc);
+	zcurve_stat_row_t *rows = NULL;
+	int		n = zcurve_stat_snapshot(&rows);
+	int		i, j;
+
+	for (i = 0; i < n; i++)
+	{
+		Datum	datums[8];
+		bool	nulls[8] = {false, false, false, false, false, false, false, false};
+		Datum	hist[ZCURVE_STAT_HIST_BUCKETS];
+
+		for (j = 0; j < ZCURVE_STAT_HIST_BUCKETS; j++)
+			hist[j] = Int64GetDatum(rows[i].hist_[j]);
+
+		datums[0] = ObjectIdGetDatum(rows[i].dbid_);
+		datums[1] = ObjectIdGetDatum(rows[i].relid_);
+		datums[2] = Int64GetDatum(rows[i].lookups_);
+		datums[3] = Int64GetDatum(rows[i].rows_);
+		datums[4] = Int64GetDatum(rows[i].descents_);
+		datums[5] = Int64GetDatum(rows[i].pages_);
+		datums[6] = Float8GetDatum(rows[i].time_ms_);
+		datums[7] = PointerGetDatum(construct_array(hist, ZCURVE_STAT_HIST_BUCKETS, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, 'd'));
+		tuplestore_putvalues(tupstore, tupdesc, datums, nulls);
+	}
+	pfree(rows);
+	return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(zcurve_stat_reset_fn);
+Datum
+zcurve_stat_reset_fn(PG_FUNCTION_ARGS)
+{
+	zcurve_stat_reset();
+	PG_RETURN_VOID();
+}
+
+/* WAL written by this backend so far: records, full page images, bytes, NULLs before PostgreSQL 13 */
+PG_FUNCTION_INFO_V1(zcurve_wal_usage);
+Datum
+zcurve_wal_usage(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		datums[3];
+	bool		nulls[3] = {false, false, false};
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg("function returning record called in context "
+			"that cannot accept type record")));
+#if PG_VERSION_NUM >= 130000
+	datums[0] = Int64GetDatum(pgWalUsage.wal_records);
+	datums[1] = Int64GetDatum(pgWalUsage.wal_fpi);
+	datums[2] = Int64GetDatum((int64) pgWalUsage.wal_bytes);
+#else
+	datums[0] = datums[1] = datums[2] = (Datum) 0;
+	nulls[0] = nulls[1] = nulls[2] = true;
+#endif
+	tupdesc = BlessTupleDesc(tupdesc);
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_formtuple(tupdesc, datums, nulls)));
+}
+
+PG_FUNCTION_INFO_V1(zcurve_2d_estimate);
+Datum
+zcurve_2d_estimate(PG_FUNCTION_ARGS)
+{
+	/* params */
+	Oid	relid = PG_GETARG_OID(0);
+	uint32 coords[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(1), PG_GETARG_INT32(2)};
+	uint32 coords2[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(3), PG_GETARG_INT32(4)};
+	int	max_pages = PG_GETARG_INT32(5);
+
+	Relation	rel;
+	TupleDesc	tupdesc;
+	zcurve_estimate_t est;
+	Datum		datums[3];
+	bool		nulls[3] = {false, false, false};
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg("function returning record called in context "
+			"that cannot accept type record")));
+
+	rel = index_open(relid, AccessShareLock);
+	zcurve_estimate_extent(rel, coords, coords2, 2, max_pages, &est);
+	index_close(rel, AccessShareLock);
+
+	datums[0] = Int64GetDatum((int64)(est.rows_ + 0.5));
+	datums[1] = Int64GetDatum((int64)(est.margin_ + 0.5));
+	datums[2] = Int32GetDatum(est.pages_);
+
+	tupdesc = BlessTupleDesc(tupdesc);
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_formtuple(tupdesc, datums, nulls)));
+}
+
+/* lookup extent compiled to z-curve intervals, the same way zcurve.max_intervals does it */
+static Datum
+zcurve_Xd_intervals(FunctionCallInfo fcinfo, int ndim, uint32 *left_bottom, uint32 *right_upper, int max_intervals)
+{
+	FuncCallContext     *funcctx = NULL;
+	zcurve_intervals_t  *pivs = NULL;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext   oldcontext;
+		TupleDesc	tupdesc;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				errmsg("function returning record called in context "
+				"that cannot accept type record")));
+		if (max_intervals <= 0)
+			ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("the number of intervals must be positive")));
+
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		pivs = (zcurve_intervals_t *)palloc(sizeof(zcurve_intervals_t));
+		zcurve_intervals_compile(pivs, left_bottom, right_upper, ndim, max_intervals);
+		funcctx->max_calls = pivs->count_;
+		funcctx->user_fctx = pivs;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	pivs = (zcurve_intervals_t *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		const zcurve_interval_t *iv = &pivs->items_[funcctx->call_cntr];
+		Datum	datums[3];
+		bool	nulls[3] = {false, false, false};
+
+		datums[0] = bitKey_toLong(&iv->lowKey_);
+		datums[1] = bitKey_toLong(&iv->highKey_);
+		datums[2] = BoolGetDatum(iv->solid_);
+
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_formtuple(funcctx->tuple_desc, datums, nulls)));
+	}
+
+	zcurve_intervals_free(pivs);
+	SRF_RETURN_DONE(funcctx);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_2d_intervals);
+Datum
+zcurve_2d_intervals(PG_FUNCTION_ARGS)
+{
+	uint32 coords[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(0), PG_GETARG_INT32(1)};
+	uint32 coords2[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(2), PG_GETARG_INT32(3)};
+
+	return zcurve_Xd_intervals(fcinfo, 2, coords, coords2, PG_GETARG_INT32(4));
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_intervals);
+Datum
+zcurve_3d_intervals(PG_FUNCTION_ARGS)
+{
+	uint32 coords[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(0), PG_GETARG_INT32(1), PG_GETARG_INT32(2)};
+	uint32 coords2[ZKEY_MAX_COORDS] = {PG_GETARG_INT32(3), PG_GETARG_INT32(4), PG_GETARG_INT32(5)};
+
+	return zcurve_Xd_intervals(fcinfo, 3, coords, coords2, PG_GETARG_INT32(6));
+}
+
+#if PG_VERSION_NUM >= 120000
+/* 
+   planner support stuff,
+   when the index and lookup extent are known at planning time, 
+   extent cardinality is estimated by the upper levels of index tree 
+*/
+static bool
+zcurve_support_estimate(PlannerInfo *root, Node *node, int ncoords, zcurve_estimate_t *pest, double *pleaf_pages)
+{
+	FuncExpr	*expr = NULL;
+	Const		*args[1 + 2 * ZKEY_MAX_COORDS];
+	uint32		coords[ZKEY_MAX_COORDS];
+	uint32		coords2[ZKEY_MAX_COORDS];
+	ListCell	*lc;
+	Relation	rel;
+	Oid		relid = InvalidOid;
+	int		i = 0;
+
+	if (NULL == node || !IsA(node, FuncExpr))
+		return false;
+	expr = (FuncExpr *) node;
+
+	/* index and extent coordinates, all of them must be constants */
+	foreach(lc, expr->args)
+	{
+		Node *arg = estimate_expression_value(root, (Node *) lfirst(lc));
+		if (!IsA(arg, Const) || ((Const *) arg)->constisnull)
+			return false;
+		args[i++] = (Const *) arg;
+		if (i > 2 * ncoords)
+			break;
+	}
+	if (i <= 2 * ncoords)
+		return false;
+
+	if (args[0]->consttype == TEXTOID)
+	{
+		char *relname = TextDatumGetCString(args[0]->constvalue);
+		relid = RangeVarGetRelid(makeRangeVarFromNameList(stringToQualifiedNameList(relname)), NoLock, true);
+	}
+	else
+	{
+		relid = DatumGetObjectId(args[0]->constvalue);
+	}
+	if (!OidIsValid(relid) || get_rel_relkind(relid) != RELKIND_INDEX)
+		return false;
+
+	for (i = 0; i < ncoords; i++)
+	{
+		coords[i] = DatumGetInt32(args[1 + i]->constvalue);
+		coords2[i] = DatumGetInt32(args[1 + ncoords + i]->constvalue);
+	}
+
+	rel = index_open(relid, AccessShareLock);
+	zcurve_estimate_extent(rel, coords, coords2, ncoords, ZCURVE_PLANNER_ESTIMATE_PAGES, pest);
+	/* leaf pages to be read, pages are supposed to be filled like the average */
+	*pleaf_pages = (rel->rd_rel->reltuples > 0 && rel->rd_rel->relpages > 0) ?
+		ceil(pest->rows_ * rel->rd_rel->relpages / rel->rd_rel->reltuples) : 1.;
+	index_close(rel, AccessShareLock);
+	return true;
+}
+
+/* handles planner requests: rows and cost of lookup */
+static Datum
+zcurve_Xd_lookup_support(FunctionCallInfo fcinfo, int ncoords)
+{
+	Node	*rawreq = (Node *) PG_GETARG_POINTER(0);
+	Node	*ret = NULL;
+	zcurve_estimate_t est;
+	double	leaf_pages = 0.;
+
+	if (IsA(rawreq, SupportRequestRows))
+	{
+		SupportRequestRows *req = (SupportRequestRows *) rawreq;
+
+		if (zcurve_support_estimate(req->root, req->node, ncoords, &est, &leaf_pages))
+		{
+			req->rows = clamp_row_est(est.rows_);
+			ret = (Node *) req;
+		}
+	}
+	else if (IsA(rawreq, SupportRequestCost))
+	{
+		SupportRequestCost *req = (SupportRequestCost *) rawreq;
+
+		if (zcurve_support_estimate(req->root, req->node, ncoords, &est, &leaf_pages))
+		{
+			/* 
+			   function scan evaluates lookup once, so everything is charged per evaluation:
+			   index descents and leaf pages, then decoding and testing of every found key 
+			 */
+			req->startup = 0.;
+			req->per_tuple = (est.pages_ + leaf_pages) * random_page_cost + 
+				est.rows_ * (cpu_index_tuple_cost + cpu_operator_cost);
+			ret = (Node *) req;
+		}
+	}
+	PG_RETURN_POINTER(ret);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_2d_lookup_support);
+Datum
+zcurve_2d_lookup_support(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_lookup_support(fcinfo, 2);
+}
+
+PG_FUNCTION_INFO_V1(zcurve_3d_lookup_support);
+Datum
+zcurve_3d_lookup_support(PG_FUNCTION_ARGS)
+{
+	return zcurve_Xd_lookup_support(fcinfo, 3);
+}
+#endif
@@ -0,0 +1,397 @@
+/*
+ * contrib/zcurve/zkey.c
+ *
+ *
+ * zkey.c -- z-curve key core, bit interleaving without PostgreSQL dependencies
+ *
+ *   Two encoding kernels, BMI2 PDEP/PEXT when the compiler targets it (-mbmi2, -march=native)
+ *   and shift-and-mask "magic bits" otherwise, both give the same keys,
+ *   -DZKEY_NO_BMI2 forces the latter (make zkey-check builds both).
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#include <string.h>
+#include "zkey.h"
+
+#if defined(__BMI2__) && !defined(ZKEY_NO_BMI2)
+#include <immintrin.h>
+#define ZKEY_BMI2
+#endif
+
+/* 3D masks of every third bit, by coordinate offset, z is 0, y is 1, x is 2 */
+static const uint64_t smasks[3] = {
+	0x9249249249249249ULL,
+	0x2492492492492492ULL,
+	0x4924924924924924ULL,
+};
+
+const char *
+zkey_kernel(void)
+{
+#ifdef ZKEY_BMI2
+	return "bmi2";
+#else
+	return "magic";
+#endif
+}
+
+/* 2D -------------------------------------------------------------------------------------------------------- */
+
+#ifndef ZKEY_BMI2
+/* 32 bits to the even bits of 64 */
+static uint64_t
+spread2(uint32_t v)
+{
+	uint64_t x = v;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x << 8))  & 0x00FF00FF00FF00FFULL;
+	x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x << 2))  & 0x3333333333333333ULL;
+	x = (x | (x << 1))  & 0x5555555555555555ULL;
+	return x;
+}
+
+/* even bits of 64 to 32 */
+static uint32_t
+compact2(uint64_t x)
+{
+	x &= 0x5555555555555555ULL;
+	x = (x | (x >> 1))  & 0x3333333333333333ULL;
+	x = (x | (x >> 2))  & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x >> 4))  & 0x00FF00FF00FF00FFULL;
+	x = (x | (x >> 8))  & 0x0000FFFF0000FFFFULL;
+	x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+	return (uint32_t)x;
+}
+#endif
+
+void
+zkey_encode2(const uint32_t *coords, uint64_t *key)
+{
+#ifdef ZKEY_BMI2
+	key[0] = _pdep_u64(coords[0], 0x5555555555555555ULL) | _pdep_u64(coords[1], 0xAAAAAAAAAAAAAAAAULL);
+#else
+	key[0] = spread2(coords[0]) | (spread2(coords[1]) << 1);
+#endif
+}
+
+void
+zkey_decode2(const uint64_t *key, uint32_t *coords)
+{
+#ifdef ZKEY_BMI2
+	coords[0] = (uint32_t)_pext_u64(key[0], 0x5555555555555555ULL);
+	coords[1] = (uint32_t)_pext_u64(key[0], 0xAAAAAAAAAAAAAAAAULL);
+#else
+	coords[0] = compact2(key[0]);
+	coords[1] = compact2(key[0] >> 1);
+#endif
+}
+
+int
+zkey_cmp2(const uint64_t *l, const uint64_t *r)
+{
+	return (l[0] == r[0]) ? 0 : ((l[0] > r[0]) ? 1 : -1);
+}
+
+int
+zkey_between2(const uint64_t *key, const uint64_t *lo, const uint64_t *hi)
+{
+	/* bit over bit */
+	uint64_t bitMask = 0xAAAAAAAAAAAAAAAAULL;
+	int i;
+
+	/* by X & Y */
+	for (i = 0; i < 2; i++, bitMask >>= 1)
+	{
+		uint64_t k = key[0] & bitMask;
+		if (k < (lo[0] & bitMask) || k > (hi[0] & bitMask))
+			return 0;
+	}
+	return 1;
+}
+
+void
+zkey_setLowBits2(uint64_t *key, int idx)
+{
+	uint64_t bitMask = 0xAAAAAAAAAAAAAAAAULL >> (63 - idx);
+	uint64_t bit = ((uint64_t) 1) << ((uint64_t) (idx & 0x3f));
+	key[0] |= bitMask;
+	key[0] -= bit;
+}
+
+void
+zkey_clearLowBits2(uint64_t *key, int idx)
+{
+	uint64_t bitMask = 0xAAAAAAAAAAAAAAAAULL >> (63 - idx);
+	uint64_t bit = ((uint64_t) 1) << ((uint64_t) (idx & 0x3f));
+	key[0] &= ~bitMask;
+	key[0] |= bit;
+}
+
+/* 3D -------------------------------------------------------------------------------------------------------- */
+
+/*
+   coordinate bits go to 3j + offset of 96, the lower 64 are in key[0],
+   so the lower 21 bits of coordinate are always there, the upper 11 start from the bit 63
+*/
+#ifdef ZKEY_BMI2
+/* upper word masks by coordinate offset */
+static const uint64_t hmasks[3] = {
+	0x24924924ULL,
+	0x49249249ULL,
+	0x92492492ULL,
+};
+/* the number of coordinate bits in the lower word by offset */
+static const int lbits[3] = {22, 21, 21};
+#else
+/* lower 21 bits to every third of 63 */
+static uint64_t
+spread3(uint32_t v)
+{
+	uint64_t x = v & 0x1fffff;
+	x = (x | (x << 32)) & 0x001f00000000ffffULL;
+	x = (x | (x << 16)) & 0x001f0000ff0000ffULL;
+	x = (x | (x << 8))  & 0x100f00f00f00f00fULL;
+	x = (x | (x << 4))  & 0x10c30c30c30c30c3ULL;
+	x = (x | (x << 2))  & 0x1249249249249249ULL;
+	return x;
+}
+
+/* every third bit of 63 to 21 */
+static uint32_t
+compact3(uint64_t x)
+{
+	x &= 0x1249249249249249ULL;
+	x = (x | (x >> 2))  & 0x10c30c30c30c30c3ULL;
+	x = (x | (x >> 4))  & 0x100f00f00f00f00fULL;
+	x = (x | (x >> 8))  & 0x001f0000ff0000ffULL;
+	x = (x | (x >> 16)) & 0x001f00000000ffffULL;
+	x = (x | (x >> 32)) & 0x00000000001fffffULL;
+	return (uint32_t)x;
+}
+#endif
+
+void
+zkey_encode3(const uint32_t *coords, uint64_t *key)
+{
+#ifdef ZKEY_BMI2
+	int i;
+	key[0] = key[1] = 0;
+	for (i = 0; i < 3; i++)
+	{
+		/* x has the highest offset */
+		int off = 2 - i;
+		key[0] |= _pdep_u64(coords[i], smasks[off]);
+		key[1] |= _pdep_u64(coords[i] >> lbits[off], hmasks[off]);
+	}
+#else
+	uint64_t lo = (spread3(coords[0]) << 2) | (spread3(coords[1]) << 1) | spread3(coords[2]);
+	uint64_t hi = (spread3(coords[0] >> 21) << 2) | (spread3(coords[1] >> 21) << 1) | spread3(coords[2] >> 21);
+
+	/* hi starts from the bit 63 */
+	key[0] = lo | (hi << 63);
+	key[1] = hi >> 1;
+#endif
+}
+
+void
+zkey_decode3(const uint64_t *key, uint32_t *coords)
+{
+	int i;
+#ifdef ZKEY_BMI2
+	for (i = 0; i < 3; i++)
+	{
+		int off = 2 - i;
+		coords[i] = (uint32_t)(_pext_u64(key[0], smasks[off]) | (_pext_u64(key[1], hmasks[off]) << lbits[off]));
+	}
+#else
+	uint64_t hi = (key[0] >> 63) | (key[1] << 1);
+
+	for (i = 0; i < 3; i++)
+	{
+		int off = 2 - i;
+		coords[i] = compact3(key[0] >> off) | (compact3(hi >> off) << 21);
+	}
+#endif
+}
+
+int
+zkey_cmp3(const uint64_t *l, const uint64_t *r)
+{
+	if (l[1] != r[1])
+		return (l[1] > r[1]) ? 1 : -1;
+	if (l[0] != r[0])
+		return (l[0] > r[0]) ? 1 : -1;
+	return 0;
+}
+
+int
+zkey_between3(const uint64_t *key, const uint64_t *lo, const uint64_t *hi)
+{
+	int i;
+
+	/* coordinate by coordinate, the upper word first */
+	for (i = 0; i < 3; i++)
+	{
+		uint64_t m0 = smasks[i];
+		uint64_t m1 = smasks[(i + 2) % 3];	/* 64 = 1 mod 3 */
+		uint64_t k1 = key[1] & m1, k0 = key[0] & m0;
+		uint64_t l1 = lo[1] & m1, l0 = lo[0] & m0;
+		uint64_t h1 = hi[1] & m1, h0 = hi[0] & m0;
+
+		if (k1 < l1 || (k1 == l1 && k0 < l0))
+			return 0;
+		if (k1 > h1 || (k1 == h1 && k0 > h0))
+			return 0;
+	}
+	return 1;
+}
+
+void
+zkey_setLowBits3(uint64_t *key, int idx)
+{
+	if (idx >= 64)
+	{
+		unsigned lidx = (idx - 64) & 0x3ff;
+		key[1] |= (smasks[0] >> (63 - lidx));
+		key[1] -= (1ULL << lidx);
+		key[0] |= smasks[idx % 3];
+	}
+	else
+	{
+		key[0] |= (smasks[0] >> (63 - idx));
+		key[0] -= (1ULL << idx);
+	}
+}
+
+void
+zkey_clearLowBits3(uint64_t *key, int idx)
+{
+	if (idx >= 64)
+	{
+		unsigned lidx = (idx - 64) & 0x3ff;
+		key[1] &= ~(smasks[0] >> (63 - lidx));
+		key[1] |= (1ULL << lidx);
+		key[0] &= ~smasks[idx % 3];
+	}
+	else
+	{
+		key[0] &= ~(smasks[0] >> (63 - idx));
+		key[0] |= (1ULL << idx);
+	}
+}
+
+/* text ------------------------------------------------------------------------------------------------------ */
+
+static const char digits2[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/* 64-bit value, two digits a step */
+static int
+format64(uint64_t v, char *buf)
+{
+	char	tmp[24];
+	int	n = sizeof(tmp), len;
+
+	while (v >= 100)
+	{
+		int i = (int)(v % 100) * 2;
+		v /= 100;
+		tmp[--n] = digits2[i + 1];
+		tmp[--n] = digits2[i];
+	}
+	if (v >= 10)
+	{
+		tmp[--n] = digits2[v * 2 + 1];
+		tmp[--n] = digits2[v * 2];
+	}
+	else
+		tmp[--n] = (char)('0' + v);
+
+	len = (int)sizeof(tmp) - n;
+	memcpy(buf, tmp + n, len);
+	buf[len] = 0;
+	return len;
+}
+
+int
+zkey_format(const uint64_t *key, char *buf)
+{
+	/* 32-bit limbs, the most significant first */
+	uint32_t limbs[4] = {(uint32_t)(key[1] >> 32), (uint32_t)key[1], (uint32_t)(key[0] >> 32), (uint32_t)key[0]};
+	uint32_t chunks[4];
+	int nchunks = 0, len = 0, i, first = 0;
+
+	/* all the 2D keys & the most of 3D ones */
+	if (0 == key[1])
+		return format64(key[0], buf);
+
+	/* by 9 decimal digits */
+	do
+	{
+		uint64_t rem = 0;
+		for (i = first; i < 4; i++)
+		{
+			uint64_t cur = (rem << 32) | limbs[i];
+			limbs[i] = (uint32_t)(cur / 1000000000U);
+			rem = cur % 1000000000U;
+		}
+		chunks[nchunks++] = (uint32_t)rem;
+		while (first < 4 && 0 == limbs[first])
+			first++;
+	} while (first < 4);
+
+	/* the most significant chunk without leading zeros */
+	{
+		uint32_t v = chunks[--nchunks];
+		char tmp[10];
+		int n = 0;
+		do
+		{
+			tmp[n++] = (char)('0' + v % 10);
+			v /= 10;
+		} while (v);
+		while (n)
+			buf[len++] = tmp[--n];
+	}
+	while (nchunks)
+	{
+		uint32_t v = chunks[--nchunks];
+		for (i = 8; i >= 0; i--)
+		{
+			buf[len + i] = (char)('0' + v % 10);
+			v /= 10;
+		}
+		len += 9;
+	}
+	buf[len] = 0;
+	return len;
+}
+
+int
+zkey_parse(const char *str, uint64_t *key)
+{
+	/* 32-bit limbs, the least significant first */
+	uint32_t limbs[3] = {0, 0, 0};
+	int n = 0;
+
+	while (str[n] >= '0' && str[n] <= '9')
+	{
+		uint64_t carry = (uint64_t)(str[n] - '0');
+		int i;
+		for (i = 0; i < 3; i++)
+		{
+			uint64_t cur = (uint64_t)limbs[i] * 10 + carry;
+			limbs[i] = (uint32_t)cur;
+			carry = cur >> 32;
+		}
+		if (carry)
+			return 0;
+		n++;
+	}
+	key[0] = ((uint64_t)limbs[1] << 32) | limbs[0];
+	key[1] = limbs[2];
+	return n;
+}
@@ -0,0 +1,73 @@
+/*
+ * contrib/zcurve/zkey.h
+ *
+ *
+ * zkey.h -- z-curve key core, bit interleaving without PostgreSQL dependencies
+ *
+ *   Keys are little-endian arrays of 64-bit words, 2D keys take one word
+ *   (x bits are even, y bits are odd), 3D keys take two (96 bits, z is the lowest, x is the highest).
+ *   The extension (bitkey.c) and standalone tools link the same code,
+ *   so the keys computed outside the server are equal to the ones in the index.
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#ifndef __ZCURVE_ZKEY_H
+#define __ZCURVE_ZKEY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* API version, incremented on incompatible changes only */
+#define ZKEY_API_VERSION 1
+
+/* words in the key buffer, enough for any supported dimension */
+#define ZKEY_WORDS 2
+
+/* decimal text form of the longest key with terminating zero */
+#define ZKEY_TEXTLEN 32
+
+/* encoding kernel compiled in, "bmi2" or "magic" */
+extern const char *zkey_kernel(void);
+
+/* coordinates to key & back, ndim is 2 or 3 */
+extern void zkey_encode2(const uint32_t *coords, uint64_t *key);
+extern void zkey_decode2(const uint64_t *key, uint32_t *coords);
+extern void zkey_encode3(const uint32_t *coords, uint64_t *key);
+extern void zkey_decode3(const uint64_t *key, uint32_t *coords);
+
+/* keys comparison, -1, 0 or 1 */
+extern int zkey_cmp2(const uint64_t *l, const uint64_t *r);
+extern int zkey_cmp3(const uint64_t *l, const uint64_t *r);
+
+/* key point is in the box with lo & hi corners, not 0 if yes */
+extern int zkey_between2(const uint64_t *key, const uint64_t *lo, const uint64_t *hi);
+extern int zkey_between3(const uint64_t *key, const uint64_t *lo, const uint64_t *hi);
+
+/*
+   diapason splitting by bit idx, the upper bound of the lower half is
+   set by zkey_setLowBits from the high key, the lower bound of the upper half
+   is set by zkey_clearLowBits from the low key
+*/
+extern void zkey_setLowBits2(uint64_t *key, int idx);
+extern void zkey_clearLowBits2(uint64_t *key, int idx);
+extern void zkey_setLowBits3(uint64_t *key, int idx);
+extern void zkey_clearLowBits3(uint64_t *key, int idx);
+
+/*
+   decimal text form, the same as numeric key value in the index,
+   returns the length, buf must hold ZKEY_TEXTLEN chars
+*/
+extern int zkey_format(const uint64_t *key, char *buf);
+
+/* decimal text to key, returns the number of chars parsed, 0 if no digits or the value does not fit 96 bits */
+extern int zkey_parse(const char *str, uint64_t *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ZCURVE_ZKEY_H */
@@ -0,0 +1,208 @@
+/*
+ * contrib/zcurve/zkey_check.c
+ *
+ *
+ * zkey_check.c -- fixed key vectors for zkey.c, run by "make zkey-check"
+ *
+ *   Expected keys are computed bit by bit outside of zkey.c, coordinates >= 2^24 and 2^32-1 included,
+ *   the program is built once for every encoding kernel, ZKEY_CHECK_KERNEL names the one expected.
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#include <stdio.h>
+#include <string.h>
+#include "zkey.h"
+
+typedef struct check2_s {
+	uint32_t	coords_[2];
+	uint64_t	key_;
+	const char	*text_;
+} check2_t;
+
+typedef struct check3_s {
+	uint32_t	coords_[3];
+	uint64_t	key_[2];
+	const char	*text_;
+} check3_t;
+
+/* the point, the box corners and if the point is in the box */
+typedef struct between_s {
+	uint32_t	point_[3];
+	uint32_t	lo_[3];
+	uint32_t	hi_[3];
+	int		in_;
+} between_t;
+
+static const check2_t vec2[] = {
+	{{0x00000000U, 0x00000000U}, 0x0000000000000000ULL, "0"},
+	{{0x00000001U, 0x00000000U}, 0x0000000000000001ULL, "1"},
+	{{0x00000000U, 0x00000001U}, 0x0000000000000002ULL, "2"},
+	{{0x00ffffffU, 0x01000000U}, 0x0002555555555555ULL, "656774945658197"},
+	{{0x01000000U, 0x00ffffffU}, 0x0001aaaaaaaaaaaaULL, "469124961184426"},
+	{{0x12345678U, 0x9abcdef0U}, 0x838c8fb0b3bcbf40ULL, "9479109304800558912"},
+	{{0x80000000U, 0x7fffffffU}, 0x6aaaaaaaaaaaaaaaULL, "7686143364045646506"},
+	{{0xffffffffU, 0x00000000U}, 0x5555555555555555ULL, "6148914691236517205"},
+	{{0x00000000U, 0xffffffffU}, 0xaaaaaaaaaaaaaaaaULL, "12297829382473034410"},
+	{{0xffffffffU, 0xffffffffU}, 0xffffffffffffffffULL, "18446744073709551615"},
+};
+
+static const check3_t vec3[] = {
+	{{0x00000000U, 0x00000000U, 0x00000000U}, {0x0000000000000000ULL, 0x0000000000000000ULL}, "0"},
+	{{0x00000001U, 0x00000000U, 0x00000000U}, {0x0000000000000004ULL, 0x0000000000000000ULL}, "4"},
+	{{0x00000000U, 0x00000001U, 0x00000000U}, {0x0000000000000002ULL, 0x0000000000000000ULL}, "2"},
+	{{0x00000000U, 0x00000000U, 0x00000001U}, {0x0000000000000001ULL, 0x0000000000000000ULL}, "1"},
+	{{0x001fffffU, 0x00200000U, 0x001fffffU}, {0x5b6db6db6db6db6dULL, 0x0000000000000001ULL}, "25034866957177248621"},
+	{{0x00ffffffU, 0x00ffffffU, 0x00ffffffU}, {0xffffffffffffffffULL, 0x00000000000000ffULL}, "4722366482869645213695"},
+	{{0x01000000U, 0x00000000U, 0x00000000U}, {0x0000000000000000ULL, 0x0000000000000400ULL}, "18889465931478580854784"},
+	{{0x00000000U, 0x01000000U, 0x00000000U}, {0x0000000000000000ULL, 0x0000000000000200ULL}, "9444732965739290427392"},
+	{{0x00000000U, 0x00000000U, 0x01000000U}, {0x0000000000000000ULL, 0x0000000000000100ULL}, "4722366482869645213696"},
+	{{0x01000000U, 0x01000001U, 0x01000002U}, {0x000000000000000aULL, 0x0000000000000700ULL}, "33056565380087516495882"},
+	{{0x12345678U, 0x9abcdef0U, 0x0fedcba9U}, {0xe7c17c67b97bea01ULL, 0x0000000040667967ULL}, "19930924385225609071562582529"},
+	{{0x80000000U, 0x7fffffffU, 0x80000001U}, {0x2492492492492493ULL, 0x00000000a9249249ULL}, "52347178804067508767162967187"},
+	{{0xffffffffU, 0x00000000U, 0x00000000U}, {0x4924924924924924ULL, 0x0000000092492492ULL}, "45273235722436764339167971620"},
+	{{0x00000000U, 0xffffffffU, 0x00000000U}, {0x2492492492492492ULL, 0x0000000049249249ULL}, "22636617861218382169583985810"},
+	{{0x00000000U, 0x00000000U, 0xffffffffU}, {0x9249249249249249ULL, 0x0000000024924924ULL}, "11318308930609191084791992905"},
+	{{0xffffffffU, 0xffffffffU, 0xffffffffU}, {0xffffffffffffffffULL, 0x00000000ffffffffULL}, "79228162514264337593543950335"},
+};
+
+/* 2D cases use the first two coordinates */
+static const between_t between2[] = {
+	/* carry over the 16-bit boundary */
+	{{0x00010000U, 0x00000000U}, {0x0000ffffU, 0x00000000U}, {0x00010001U, 0x00000000U}, 1},
+	{{0xffffffffU, 0x00000005U}, {0x00000000U, 0x00000000U}, {0xfffffffeU, 0xffffffffU}, 0},
+	{{0x00000005U, 0x01000000U}, {0x00000000U, 0x00000000U}, {0xffffffffU, 0x00ffffffU}, 0},
+	{{0xffffffffU, 0xffffffffU}, {0x00000000U, 0x00000000U}, {0xffffffffU, 0xffffffffU}, 1},
+};
+
+static const between_t between3[] = {
+	{{0x00010000U, 0x00000000U, 0x00000001U}, {0x0000ffffU, 0x00000000U, 0x00000000U}, {0x00010001U, 0x00000001U, 0x00000001U}, 1},
+	{{0x01000000U, 0x00000005U, 0x00000005U}, {0x00ffffffU, 0x00000000U, 0x00000000U}, {0x01000000U, 0x00000005U, 0x00000005U}, 1},
+	{{0xffffffffU, 0x00000000U, 0x00000000U}, {0x00000000U, 0x00000000U, 0x00000000U}, {0xfffffffeU, 0xffffffffU, 0xffffffffU}, 0},
+	{{0x00000005U, 0x01000000U, 0x00000007U}, {0x00000000U, 0x00000000U, 0x00000000U}, {0xffffffffU, 0x00ffffffU, 0xffffffffU}, 0},
+	{{0x00000000U, 0x00000000U, 0xffffffffU}, {0x00000000U, 0x00000000U, 0x00000000U}, {0xffffffffU, 0xffffffffU, 0xfffffffeU}, 0},
+	{{0x00000000U, 0x00000000U, 0x00ffffffU}, {0x00000000U, 0x00000000U, 0x01000000U}, {0xffffffffU, 0xffffffffU, 0xffffffffU}, 0},
+	{{0xffffffffU, 0xffffffffU, 0xffffffffU}, {0x00000000U, 0x00000000U, 0x00000000U}, {0xffffffffU, 0xffffffffU, 0xffffffffU}, 1},
+};
+
+#define NITEMS(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+static int failures = 0;
+
+static void
+fail(const char *what, int dim, int idx)
+{
+	fprintf(stderr, "zkey-check: %s, %dD vector %d\n", what, dim, idx);
+	failures++;
+}
+
+static int
+sign(int v)
+{
+	return (v > 0) - (v < 0);
+}
+
+static void
+check2(void)
+{
+	int i, j;
+
+	for (i = 0; i < NITEMS(vec2); i++)
+	{
+		uint64_t	key[ZKEY_WORDS] = {0, 0}, parsed[ZKEY_WORDS];
+		/* key buffers are ZKEY_WORDS long, 2D keys take the first word */
+		uint64_t	expected[ZKEY_WORDS] = {vec2[i].key_, 0};
+		uint32_t	back[2];
+		char		text[ZKEY_TEXTLEN];
+
+		zkey_encode2(vec2[i].coords_, key);
+		if (key[0] != vec2[i].key_)
+			fail("encode", 2, i);
+		zkey_decode2(expected, back);
+		if (memcmp(back, vec2[i].coords_, sizeof(back)))
+			fail("decode", 2, i);
+		if (zkey_format(expected, text) != (int)strlen(vec2[i].text_) || strcmp(text, vec2[i].text_))
+			fail("format", 2, i);
+		if (zkey_parse(vec2[i].text_, parsed) != (int)strlen(vec2[i].text_) || parsed[0] != vec2[i].key_ || parsed[1])
+			fail("parse", 2, i);
+
+		for (j = 0; j < NITEMS(vec2); j++)
+		{
+			int order = (vec2[i].key_ > vec2[j].key_) - (vec2[i].key_ < vec2[j].key_);
+			if (sign(zkey_cmp2(&vec2[i].key_, &vec2[j].key_)) != order)
+				fail("cmp", 2, i);
+		}
+	}
+
+	for (i = 0; i < NITEMS(between2); i++)
+	{
+		uint64_t key[ZKEY_WORDS], lo[ZKEY_WORDS], hi[ZKEY_WORDS];
+
+		zkey_encode2(between2[i].point_, key);
+		zkey_encode2(between2[i].lo_, lo);
+		zkey_encode2(between2[i].hi_, hi);
+		if ((0 != zkey_between2(key, lo, hi)) != between2[i].in_)
+			fail("between", 2, i);
+	}
+}
+
+static void
+check3(void)
+{
+	int i, j;
+
+	for (i = 0; i < NITEMS(vec3); i++)
+	{
+		uint64_t	key[ZKEY_WORDS], parsed[ZKEY_WORDS];
+		uint32_t	back[3];
+		char		text[ZKEY_TEXTLEN];
+
+		zkey_encode3(vec3[i].coords_, key);
+		if (key[0] != vec3[i].key_[0] || key[1] != vec3[i].key_[1])
+			fail("encode", 3, i);
+		zkey_decode3(vec3[i].key_, back);
+		if (memcmp(back, vec3[i].coords_, sizeof(back)))
+			fail("decode", 3, i);
+		if (zkey_format(vec3[i].key_, text) != (int)strlen(vec3[i].text_) || strcmp(text, vec3[i].text_))
+			fail("format", 3, i);
+		if (zkey_parse(vec3[i].text_, parsed) != (int)strlen(vec3[i].text_) ||
+			parsed[0] != vec3[i].key_[0] || parsed[1] != vec3[i].key_[1])
+			fail("parse", 3, i);
+
+		/* the high word decides first */
+		for (j = 0; j < NITEMS(vec3); j++)
+		{
+			const uint64_t *l = vec3[i].key_, *r = vec3[j].key_;
+			int expected = (l[1] != r[1]) ? ((l[1] > r[1]) ? 1 : -1) : ((l[0] > r[0]) - (l[0] < r[0]));
+			if (sign(zkey_cmp3(l, r)) != expected)
+				fail("cmp", 3, i);
+		}
+	}
+
+	for (i = 0; i < NITEMS(between3); i++)
+	{
+		uint64_t key[ZKEY_WORDS], lo[ZKEY_WORDS], hi[ZKEY_WORDS];
+
+		zkey_encode3(between3[i].point_, key);
+		zkey_encode3(between3[i].lo_, lo);
+		zkey_encode3(between3[i].hi_, hi);
+		if ((0 != zkey_between3(key, lo, hi)) != between3[i].in_)
+			fail("between", 3, i);
+	}
+}
+
+int
+main(void)
+{
+#ifdef ZKEY_CHECK_KERNEL
+	if (strcmp(zkey_kernel(), ZKEY_CHECK_KERNEL))
+	{
+		fprintf(stderr, "zkey-check: kernel %s is built instead of %s\n", zkey_kernel(), ZKEY_CHECK_KERNEL);
+		return 1;
+	}
+#endif
+	check2();
+	check3();
+	printf("zkey-check: kernel %s, %d 2D and %d 3D vectors, %s\n", zkey_kernel(),
+		NITEMS(vec2) + NITEMS(between2), NITEMS(vec3) + NITEMS(between3), failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,357 @@
+/*
+ * contrib/zcurve/zkey_encode.c
+ *
+ *
+ * zkey_encode.c -- zkey-encode, z-curve keys for CSV/TSV coordinates outside the server
+ *
+ *   zkey-encode [-n dims] [-d delimiter] [-k] < coords.csv > keys.txt
+ *	reads lines of 2 or 3 unsigned integer coordinates, writes one decimal key per line,
+ *	the same values zcurve_num_from_xy/zcurve_num_from_xyz give, so the output can be COPY'ed to the key column.
+ *	Comma, tab or semicolon delimited fields are accepted unless -d is given,
+ *	the number of coordinates is taken from the first data line unless -n is given,
+ *	-k keeps the input fields and appends the key as the last one,
+ *	the first line is skipped as a header if it does not start with a digit.
+ *
+ *   zkey-encode -b [count]
+ *	kernels microbenchmark, count random points (10M by default) are encoded & decoded back.
+ *
+ *   The tool depends on zkey.c only: cc -O2 -march=native -o zkey-encode zkey_encode.c zkey.c
+ *
+ * Modified by Boris Muratshin, mailto:bmuratshin@gmail.com
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "zkey.h"
+
+#define ZKEY_IOBUF (1 << 20)
+#define ZKEY_MAX_LINE (1 << 16)
+#define ZKEY_BENCH_DEFAULT 10000000
+
+/* buffered output, flushed by blocks */
+typedef struct zkey_out_s {
+	char	*buf_;
+	size_t	len_;
+} zkey_out_t;
+
+static void
+out_flush(zkey_out_t *out)
+{
+	if (out->len_ && fwrite(out->buf_, 1, out->len_, stdout) != out->len_)
+	{
+		perror("zkey-encode: write");
+		exit(1);
+	}
+	out->len_ = 0;
+}
+
+static void
+out_put(zkey_out_t *out, const char *data, size_t len)
+{
+	if (out->len_ + len > ZKEY_IOBUF)
+		out_flush(out);
+	memcpy(out->buf_ + out->len_, data, len);
+	out->len_ += len;
+}
+
+static int
+is_delim(char c, char delim)
+{
+	if (delim)
+		return c == delim;
+	return c == ',' || c == '\t' || c == ';';
+}
+
+/*
+   parses coordinates of the line [ptr, end), returns their number,
+   -1 on malformed line, *pdelim gets the delimiter met
+*/
+static int
+parse_coords(const char *ptr, const char *end, char delim, uint32_t *coords, char *pdelim)
+{
+	int n = 0;
+
+	for (;;)
+	{
+		uint64_t v = 0;
+		const char *start;
+
+		while (ptr < end && (*ptr == ' ' || *ptr == '"'))
+			ptr++;
+		start = ptr;
+		while (ptr < end && *ptr >= '0' && *ptr <= '9')
+		{
+			v = v * 10 + (uint64_t)(*ptr++ - '0');
+			if (v > 0xffffffffULL)
+				return -1;
+		}
+		if (ptr == start || n == 3)
+			return -1;
+		coords[n++] = (uint32_t)v;
+		while (ptr < end && (*ptr == ' ' || *ptr == '"'))
+			ptr++;
+		if (ptr == end)
+			return n;
+		if (!is_delim(*ptr, delim))
+			return -1;
+		*pdelim = *ptr++;
+	}
+}
+
+static int
+encode_stream(int ndim, char delim, int keep)
+{
+	zkey_out_t	out;
+	char		*in = (char *)malloc(ZKEY_IOBUF + ZKEY_MAX_LINE);
+	size_t		have = 0;
+	long		lineno = 0;
+	int		eof = 0;
+
+	out.buf_ = (char *)malloc(ZKEY_IOBUF);
+	out.len_ = 0;
+	if (!in || !out.buf_)
+	{
+		fprintf(stderr, "zkey-encode: out of memory\n");
+		return 1;
+	}
+
+	while (!eof || have)
+	{
+		char	*ptr = in;
+		char	*end;
+		size_t	got;
+
+		if (!eof)
+		{
+			got = fread(in + have, 1, ZKEY_IOBUF + ZKEY_MAX_LINE - have, stdin);
+			if (got == 0)
+			{
+				if (ferror(stdin))
+				{
+					perror("zkey-encode: read");
+					return 1;
+				}
+				eof = 1;
+			}
+			have += got;
+		}
+		end = in + have;
+
+		for (;;)
+		{
+			char	*eol = (char *)memchr(ptr, '\n', end - ptr);
+			char	*lend;
+			uint32_t coords[3];
+			uint64_t key[ZKEY_WORDS];
+			char	text[ZKEY_TEXTLEN];
+			char	fdelim = ',';
+			int	n, len;
+
+			if (!eol)
+			{
+				/* the last line without newline */
+				if (!eof || ptr == end)
+					break;
+				eol = end;
+			}
+			lend = eol;
+			if (lend > ptr && lend[-1] == '\r')
+				lend--;
+			lineno++;
+
+			if (lend == ptr)
+			{
+				ptr = eol + (eol < end);
+				continue;
+			}
+
+			n = parse_coords(ptr, lend, delim, coords, &fdelim);
+			if (n < 0 || (ndim && n != ndim) || n < 2)
+			{
+				/* header */
+				if (1 == lineno && !(*ptr >= '0' && *ptr <= '9'))
+				{
+					if (keep)
+					{
+						out_put(&out, ptr, lend - ptr);
+						out_put(&out, delim ? &delim : ",", 1);
+						out_put(&out, "zkey\n", 5);
+					}
+					ptr = eol + (eol < end);
+					continue;
+				}
+				out_flush(&out);
+				fprintf(stderr, "zkey-encode: line %ld: %s coordinates expected\n", lineno,
+					ndim == 3 ? "3" : (ndim == 2 ? "2" : "2 or 3"));
+				return 1;
+			}
+			ndim = n;
+
+			key[1] = 0;
+			if (2 == n)
+				zkey_encode2(coords, key);
+			else
+				zkey_encode3(coords, key);
+			len = zkey_format(key, text);
+
+			if (keep)
+			{
+				out_put(&out, ptr, lend - ptr);
+				out_put(&out, &fdelim, 1);
+			}
+			text[len++] = '\n';
+			out_put(&out, text, len);
+			ptr = eol + (eol < end);
+		}
+
+		/* incomplete line goes to the buffer start */
+		have = end - ptr;
+		if (have >= ZKEY_IOBUF + ZKEY_MAX_LINE)
+		{
+			fprintf(stderr, "zkey-encode: line %ld is too long\n", lineno + 1);
+			return 1;
+		}
+		memmove(in, ptr, have);
+		if (eof)
+			break;
+	}
+	out_flush(&out);
+	free(in);
+	free(out.buf_);
+	return 0;
+}
+
+/* xorshift64, the benchmark input */
+static uint32_t
+bench_random(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return (uint32_t)(*state >> 16);
+}
+
+static double
+bench_report(const char *name, clock_t start, long count, int failed)
+{
+	double sec = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("%-10s %10.2f ns/key %12.0f keys/s%s\n", name,
+		count ? sec * 1e9 / count : 0., sec > 0. ? count / sec : 0.,
+		failed ? "  ROUND TRIP FAILED" : "");
+	return sec;
+}
+
+static int
+bench(long count)
+{
+	uint32_t	*coords = (uint32_t *)malloc(sizeof(uint32_t) * 3 * count);
+	uint64_t	*keys = (uint64_t *)malloc(sizeof(uint64_t) * ZKEY_WORDS * count);
+	uint64_t	state = 88172645463325252ULL;
+	volatile uint32_t sink = 0;
+	size_t		bytes = 0;
+	clock_t		start;
+	double		sec;
+	long		i;
+	int		ndim, failed = 0;
+	char		text[ZKEY_TEXTLEN];
+
+	if (!coords || !keys)
+	{
+		fprintf(stderr, "zkey-encode: out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < 3 * count; i++)
+		coords[i] = bench_random(&state);
+
+	printf("kernel %s, %ld keys\n", zkey_kernel(), count);
+	for (ndim = 2; ndim <= 3; ndim++)
+	{
+		char name[32];
+
+		start = clock();
+		for (i = 0; i < count; i++)
+		{
+			keys[i * ZKEY_WORDS + 1] = 0;
+			if (2 == ndim)
+				zkey_encode2(coords + i * 3, keys + i * ZKEY_WORDS);
+			else
+				zkey_encode3(coords + i * 3, keys + i * ZKEY_WORDS);
+		}
+		sprintf(name, "encode%dd", ndim);
+		bench_report(name, start, count, 0);
+
+		start = clock();
+		for (i = 0; i < count; i++)
+		{
+			uint32_t back[3];
+			if (2 == ndim)
+				zkey_decode2(keys + i * ZKEY_WORDS, back);
+			else
+				zkey_decode3(keys + i * ZKEY_WORDS, back);
+			if (memcmp(back, coords + i * 3, sizeof(uint32_t) * ndim))
+				failed = 1;
+		}
+		sprintf(name, "decode%dd", ndim);
+		bench_report(name, start, count, failed);
+
+		/* text output, the way the stream mode writes it */
+		start = clock();
+		for (i = 0, bytes = 0; i < count; i++)
+		{
+			bytes += zkey_format(keys + i * ZKEY_WORDS, text) + 1;
+			sink += (uint32_t)text[0];
+		}
+		sprintf(name, "format%dd", ndim);
+		sec = bench_report(name, start, count, 0);
+		printf("%-10s %10.1f MB/s\n", "", sec > 0. ? bytes / sec / 1e6 : 0.);
+	}
+	free(coords);
+	free(keys);
+	return failed;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"usage: zkey-encode [-n 2|3] [-d delimiter] [-k] < coords > keys\n"
+		"       zkey-encode -b [count]\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	int	ndim = 0, keep = 0, i;
+	char	delim = 0;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (0 == strcmp(argv[i], "-n") && i + 1 < argc)
+		{
+			ndim = atoi(argv[++i]);
+			if (ndim != 2 && ndim != 3)
+				usage();
+		}
+		else if (0 == strcmp(argv[i], "-d") && i + 1 < argc)
+		{
+			++i;
+			delim = (0 == strcmp(argv[i], "\\t")) ? '\t' : argv[i][0];
+			if (!delim || (delim >= '0' && delim <= '9'))
+				usage();
+		}
+		else if (0 == strcmp(argv[i], "-k"))
+			keep = 1;
+		else if (0 == strcmp(argv[i], "-b"))
+		{
+			long count = (i + 1 < argc) ? atol(argv[++i]) : ZKEY_BENCH_DEFAULT;
+			if (count <= 0)
+				usage();
+			return bench(count);
+		}
+		else
+			usage();
+	}
+	return encode_stream(ndim, delim, keep);
+}